@@ -84,12 +84,14 @@ ADIV_SQUARES     <- 14L
 alpha_div <- function (
     counts, 
     metric, 
-    norm   = 'percent', 
-    cutoff = 10L, 
-    digits = 3L, 
-    tree   = NULL, 
-    margin = 1L,
-    cpus   = n_cpus() ) {
+    norm           = 'percent', 
+    cutoff         = 10L, 
+    digits         = 3L, 
+    tree           = NULL, 
+    margin         = 1L,
+    min_prevalence = 1L, 
+    min_abundance  = 0, 
+    cpus           = n_cpus() ) {
   
   metric <- match_metric(metric, div = 'alpha')
   args   <- mget(metric$params, environment())
@@ -144,7 +146,7 @@ ace <- function (counts, cutoff = 10L, margin = 1L, cpus = n_cpus()) {
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_ACE, counts, margin, norm, cpus, cutoff)
+  .Call(C_alpha_div, ADIV_ACE, counts, margin, 1L, 0, norm, cpus, cutoff)
 }
 
 
@@ -178,12 +180,12 @@ ace <- function (counts, cutoff = 10L, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     berger(ex_counts)
-berger <- function (counts, margin = 1L, cpus = n_cpus()) {
+berger <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_BERGER, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_BERGER, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -218,13 +220,13 @@ berger <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     brillouin(ex_counts)
-brillouin <- function (counts, margin = 1L, cpus = n_cpus()) {
+brillouin <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_BRILLOUIN, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_BRILLOUIN, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -265,7 +267,7 @@ chao1 <- function (counts, margin = 1L, cpus = n_cpus()) {
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_CHAO1, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_CHAO1, counts, margin, 1L, 0, norm, cpus, NULL)
 }
 
 
@@ -294,12 +296,12 @@ chao1 <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     faith(ex_counts, tree = ex_tree)
-faith <- function (counts, tree = NULL, margin = 1L, cpus = n_cpus()) {
+faith <- function (counts, tree = NULL, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_FAITH, counts, margin, norm, cpus, tree)
+  .Call(C_alpha_div, ADIV_FAITH, counts, margin, min_prevalence, min_abundance, norm, cpus, tree)
 }
 
 
@@ -333,13 +335,13 @@ faith <- function (counts, tree = NULL, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     fisher(ex_counts)
-fisher <- function (counts, digits = 3L, margin = 1L, cpus = n_cpus()) {
+fisher <- function (counts, digits = 3L, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_FISHER, counts, margin, norm, cpus, digits)
+  .Call(C_alpha_div, ADIV_FISHER, counts, margin, min_prevalence, min_abundance, norm, cpus, digits)
 }
 
 
@@ -374,12 +376,12 @@ fisher <- function (counts, digits = 3L, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     inv_simpson(ex_counts)
-inv_simpson <- function (counts, margin = 1L, cpus = n_cpus()) {
+inv_simpson <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_INV_SIMPSON, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_INV_SIMPSON, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -415,13 +417,13 @@ inv_simpson <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     margalef(ex_counts)
-margalef <- function (counts, margin = 1L, cpus = n_cpus()) {
+margalef <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_MARGALEF, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_MARGALEF, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -456,13 +458,13 @@ margalef <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     mcintosh(ex_counts)
-mcintosh <- function (counts, margin = 1L, cpus = n_cpus()) {
+mcintosh <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_MCINTOSH, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_MCINTOSH, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -496,13 +498,13 @@ mcintosh <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     menhinick(ex_counts)
-menhinick <- function (counts, margin = 1L, cpus = n_cpus()) {
+menhinick <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_MENHINICK, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_MENHINICK, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -529,12 +531,12 @@ menhinick <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     observed(ex_counts)
-observed <- function (counts, margin = 1L, cpus = n_cpus()) {
+observed <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_OBSERVED, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_OBSERVED, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -571,12 +573,12 @@ observed <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     shannon(ex_counts)
-shannon <- function (counts, margin = 1L, cpus = n_cpus()) {
+shannon <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_SHANNON, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_SHANNON, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -611,12 +613,12 @@ shannon <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     simpson(ex_counts)
-simpson <- function (counts, margin = 1L, cpus = n_cpus()) {
+simpson <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_alpha_div, ADIV_SIMPSON, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_SIMPSON, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
 
 
@@ -655,11 +657,11 @@ simpson <- function (counts, margin = 1L, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     squares(ex_counts)
-squares <- function (counts, margin = 1L, cpus = n_cpus()) {
+squares <- function (counts, margin = 1L, min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   assert_integer_counts()
   
-  .Call(C_alpha_div, ADIV_SQUARES, counts, margin, norm, cpus, NULL)
+  .Call(C_alpha_div, ADIV_SQUARES, counts, margin, min_prevalence, min_abundance, norm, cpus, NULL)
 }
@@ -34,6 +34,17 @@ G_UNIFRAC <- 4L
 V_UNIFRAC <- 5L
 
 
+# Apply `f` to the distances from C_beta_div(), which are
+# in the `distance` element when `k` is given, or on disk
+# when `file` is.
+map_dist <- function (x, f) {
+  if (inherits(x, 'ecodive_dist_file')) return (map_dist_file(x, f))
+  if (!is.list(x)) return (f(x))
+  x$distance <- f(x$distance)
+  return (x)
+}
+
+
 
 #' Beta Diversity Wrapper Function
 #' 
@@ -70,7 +81,12 @@ V_UNIFRAC <- 5L
 #'        be omitted if a tree is embedded with the `counts` object or as 
 #'        `attr(counts, 'tree')`.
 #' 
-#' @return A numeric vector.
+#' @return A `dist` object. When `reference` is given, a numeric matrix 
+#'         instead, with a row for each sample in `counts` and a column for 
+#'         each sample in `reference`. When `k` is given, a list of two 
+#'         \eqn{k \times n} matrices, `index` and `distance`, whose columns 
+#'         hold each sample's nearest neighbors. When `file` is given, an 
+#'         `ecodive_dist_file` object.
 #' 
 #' 
 #' @details
@@ -142,17 +158,29 @@ V_UNIFRAC <- 5L
 #'     # Generalized UniFrac distances
 #'     beta_div(ex_counts, 'GUniFrac', tree = ex_tree)
 #'     
+#'     # Two samples against the other two
+#'     beta_div(ex_counts[1:2,], 'bray', reference = ex_counts[3:4,])
+#'     
+#'     # Each sample's two nearest neighbors
+#'     beta_div(ex_counts, 'bray', k = 2)
+#'     
 beta_div <- function (
     counts, 
     metric, 
-    margin      = 1L, 
-    norm        = 'none', 
-    pseudocount = NULL, 
-    power       = 1.5, 
-    alpha       = 0.5, 
-    tree        = NULL, 
-    pairs       = NULL, 
-    cpus        = n_cpus() ) {
+    margin         = 1L, 
+    norm           = 'none', 
+    pseudocount    = NULL, 
+    power          = 1.5, 
+    alpha          = 0.5, 
+    tree           = NULL, 
+    pairs          = NULL, 
+    reference      = NULL, 
+    k              = NULL, 
+    file           = NULL, 
+    precision      = 'double', 
+    min_prevalence = 1L, 
+    min_abundance  = 0, 
+    cpus           = n_cpus() ) {
   
   metric <- match_metric(metric, div = 'beta')
   args   <- mget(metric$params, environment())
@@ -215,12 +243,12 @@ beta_div <- function (
 #' @export
 #' @examples
 #'     aitchison(ex_counts, pseudocount = 1)
-aitchison <- function (counts, margin = 1L, pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+aitchison <- function (counts, margin = 1L, pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'clr'
   validate_args()
   
-  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -255,12 +283,12 @@ aitchison <- function (counts, margin = 1L, pseudocount = NULL, pairs = NULL, cp
 #' @export
 #' @examples
 #'     bhattacharyya(ex_counts)
-bhattacharyya <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+bhattacharyya <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_beta_div, BDIV_BHATTACHARYYA, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_BHATTACHARYYA, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -295,10 +323,10 @@ bhattacharyya <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     bray(ex_counts)
-bray <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+bray <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_BRAY, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_BRAY, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -333,10 +361,10 @@ bray <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs
 #' @export
 #' @examples
 #'     canberra(ex_counts)
-canberra <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+canberra <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_CANBERRA, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_CANBERRA, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -370,10 +398,10 @@ canberra <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pa
 #' @export
 #' @examples
 #'     chebyshev(ex_counts)
-chebyshev <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+chebyshev <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_CHEBYSHEV, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_CHEBYSHEV, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -407,12 +435,12 @@ chebyshev <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, p
 #' @export
 #' @examples
 #'     chord(ex_counts)
-chord <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+chord <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'chord'
   validate_args()
   
-  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -447,10 +475,10 @@ chord <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     clark(ex_counts)
-clark <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+clark <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_CLARK, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_CLARK, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -486,12 +514,12 @@ clark <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs
 #' @export
 #' @examples
 #'     divergence(ex_counts)
-divergence <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+divergence <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_beta_div, BDIV_DIVERGENCE, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_DIVERGENCE, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -526,10 +554,10 @@ divergence <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL,
 #' @export
 #' @examples
 #'     euclidean(ex_counts)
-euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -567,13 +595,13 @@ euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, p
 #' @export
 #' @examples
 #'     gower(ex_counts)
-gower <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+gower <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
   # range_vec <- apply(counts, 2L, function (x) diff(range(x)))
   
-  .Call(C_beta_div, BDIV_GOWER, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_GOWER, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -610,14 +638,14 @@ gower <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs
 #' @export
 #' @examples
 #'     hellinger(ex_counts)
-hellinger <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+hellinger <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  sqc <- .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, norm, pairs, cpus, 0, NULL)
+  sqc <- .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
   
-  sqrt(sqc)
+  map_dist(sqc, sqrt)
 }
 
 
@@ -653,10 +681,10 @@ hellinger <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     horn(ex_counts)
-horn <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+horn <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_HORN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_HORN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -691,14 +719,14 @@ horn <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs
 #' @export
 #' @examples
 #'     jensen(ex_counts)
-jensen <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+jensen <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  jsd <- .Call(C_beta_div, BDIV_JSD, counts, margin, norm, pairs, cpus, 0, NULL)
+  jsd <- .Call(C_beta_div, BDIV_JSD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
   
-  sqrt(jsd)
+  map_dist(jsd, sqrt)
 }
 
 
@@ -733,12 +761,12 @@ jensen <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     jsd(ex_counts)
-jsd <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+jsd <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_beta_div, BDIV_JSD, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_JSD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -773,10 +801,10 @@ jsd <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     lorentzian(ex_counts)
-lorentzian <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+lorentzian <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_LORENTZIAN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_LORENTZIAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -811,10 +839,10 @@ lorentzian <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL,
 #' @export
 #' @examples
 #'     manhattan(ex_counts)
-manhattan <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+manhattan <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_MANHATTAN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_MANHATTAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -849,14 +877,14 @@ manhattan <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, p
 #' @export
 #' @examples
 #'     matusita(ex_counts)
-matusita <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+matusita <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  sqc <- .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, norm, pairs, cpus, 0, NULL)
+  sqc <- .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
   
-  sqrt(sqc)
+  map_dist(sqc, sqrt)
 }
 
 
@@ -905,10 +933,10 @@ matusita <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     minkowski(ex_counts, power = 2) # Equivalent to Euclidean
-minkowski <- function (counts, margin = 1L, power = 1.5, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+minkowski <- function (counts, margin = 1L, power = 1.5, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_MINKOWSKI, counts, margin, norm, pairs, cpus, pseudocount, power)
+  .Call(C_beta_div, BDIV_MINKOWSKI, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, power)
 }
 
 
@@ -946,14 +974,14 @@ minkowski <- function (counts, margin = 1L, power = 1.5, norm = 'none', pseudoco
 #' @export
 #' @examples
 #'     morisita(ex_counts)
-morisita <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+morisita <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
   assert_integer_counts()
   
-  .Call(C_beta_div, BDIV_MORISITA, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_MORISITA, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -988,10 +1016,10 @@ morisita <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     motyka(ex_counts)
-motyka <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+motyka <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_MOTYKA, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_MOTYKA, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -1026,14 +1054,14 @@ motyka <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pair
 #' @export
 #' @examples
 #'     psym_chisq(ex_counts)
-psym_chisq <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+psym_chisq <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  scs <- .Call(C_beta_div, BDIV_SQUARED_CHISQ, counts, margin, norm, pairs, cpus, 0, NULL)
+  scs <- .Call(C_beta_div, BDIV_SQUARED_CHISQ, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
   
-  2 * scs
+  map_dist(scs, function (x) 2 * x)
 }
 
 
@@ -1075,12 +1103,12 @@ psym_chisq <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     robust_aitchison(ex_counts)
-robust_aitchison <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+robust_aitchison <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'rclr'
   validate_args()
   
-  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1115,10 +1143,10 @@ robust_aitchison <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()
 #' @export
 #' @examples
 #'     soergel(ex_counts)
-soergel <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+soergel <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_SOERGEL, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_SOERGEL, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -1153,12 +1181,12 @@ soergel <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pai
 #' @export
 #' @examples
 #'     squared_chisq(ex_counts)
-squared_chisq <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+squared_chisq <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_beta_div, BDIV_SQUARED_CHISQ, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_SQUARED_CHISQ, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1193,12 +1221,12 @@ squared_chisq <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     squared_chord(ex_counts)
-squared_chord <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+squared_chord <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_SQUARED_CHORD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1233,13 +1261,13 @@ squared_chord <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     squared_euclidean(ex_counts)
-squared_euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+squared_euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  euc <- .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  euc <- .Call(C_beta_div, BDIV_EUCLIDEAN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
   
-  euc ^ 2
+  map_dist(euc, function (x) x ^ 2)
 }
 
 
@@ -1274,14 +1302,14 @@ squared_euclidean <- function (counts, margin = 1L, norm = 'none', pseudocount =
 #' @export
 #' @examples
 #'     topsoe(ex_counts)
-topsoe <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+topsoe <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'percent'
   validate_args()
   
-  jsd <- .Call(C_beta_div, BDIV_JSD, counts, margin, norm, pairs, cpus, 0, NULL)
+  jsd <- .Call(C_beta_div, BDIV_JSD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
   
-  2 * jsd
+  map_dist(jsd, function (x) 2 * x)
 }
 
 
@@ -1316,10 +1344,10 @@ topsoe <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     wave_hedges(ex_counts)
-wave_hedges <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, cpus = n_cpus()) {
+wave_hedges <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
-  .Call(C_beta_div, BDIV_WAVE_HEDGES, counts, margin, norm, pairs, cpus, pseudocount, NULL)
+  .Call(C_beta_div, BDIV_WAVE_HEDGES, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, pseudocount, NULL)
 }
 
 
@@ -1359,12 +1387,12 @@ wave_hedges <- function (counts, margin = 1L, norm = 'none', pseudocount = NULL,
 #' @export
 #' @examples
 #'     hamming(ex_counts)
-hamming <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+hamming <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_beta_div, BDIV_HAMMING, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_HAMMING, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1401,12 +1429,12 @@ hamming <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     jaccard(ex_counts)
-jaccard <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+jaccard <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_beta_div, BDIV_JACCARD, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_JACCARD, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1441,12 +1469,12 @@ jaccard <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     ochiai(ex_counts)
-ochiai <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+ochiai <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_beta_div, BDIV_OCHIAI, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_OCHIAI, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1483,12 +1511,12 @@ ochiai <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     sorensen(ex_counts)
-sorensen <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+sorensen <- function (counts, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   norm <- 'none'
   validate_args()
   
-  .Call(C_beta_div, BDIV_SORENSEN, counts, margin, norm, pairs, cpus, 0, NULL)
+  .Call(C_beta_div, BDIV_SORENSEN, counts, margin, min_prevalence, min_abundance, norm, pairs, reference, k, file, precision, cpus, 0, NULL)
 }
 
 
@@ -1521,11 +1549,11 @@ sorensen <- function (counts, margin = 1L, pairs = NULL, cpus = n_cpus()) {
 #' @export
 #' @examples
 #'     unweighted_unifrac(ex_counts, tree = ex_tree)
-unweighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+unweighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  .Call(C_unifrac, U_UNIFRAC, counts, tree, margin, pairs, cpus, NULL)
+  .Call(C_unifrac, U_UNIFRAC, counts, tree, margin, min_prevalence, min_abundance, pairs, reference, k, file, precision, cpus, NULL)
 }
 
 
@@ -1554,11 +1582,11 @@ unweighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL,
 #' @export
 #' @examples
 #'     weighted_unifrac(ex_counts, tree = ex_tree)
-weighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+weighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  .Call(C_unifrac, W_UNIFRAC, counts, tree, margin, pairs, cpus, NULL)
+  .Call(C_unifrac, W_UNIFRAC, counts, tree, margin, min_prevalence, min_abundance, pairs, reference, k, file, precision, cpus, NULL)
 }
 
 
@@ -1587,11 +1615,11 @@ weighted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, cp
 #' @export
 #' @examples
 #'     normalized_unifrac(ex_counts, tree = ex_tree)
-normalized_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+normalized_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  .Call(C_unifrac, N_UNIFRAC, counts, tree, margin, pairs, cpus, NULL)
+  .Call(C_unifrac, N_UNIFRAC, counts, tree, margin, min_prevalence, min_abundance, pairs, reference, k, file, precision, cpus, NULL)
 } 
 
 
@@ -1625,11 +1653,11 @@ normalized_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL,
 #' @export
 #' @examples
 #'     generalized_unifrac(ex_counts, tree = ex_tree, alpha = 0.5)
-generalized_unifrac <- function (counts, tree = NULL, alpha = 0.5, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+generalized_unifrac <- function (counts, tree = NULL, alpha = 0.5, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  .Call(C_unifrac, G_UNIFRAC, counts, tree, margin, pairs, cpus, alpha)
+  .Call(C_unifrac, G_UNIFRAC, counts, tree, margin, min_prevalence, min_abundance, pairs, reference, k, file, precision, cpus, alpha)
 }
 
 
@@ -1658,9 +1686,9 @@ generalized_unifrac <- function (counts, tree = NULL, alpha = 0.5, margin = 1L,
 #' @export
 #' @examples
 #'     variance_adjusted_unifrac(ex_counts, tree = ex_tree)
-variance_adjusted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, cpus = n_cpus()) {
+variance_adjusted_unifrac <- function (counts, tree = NULL, margin = 1L, pairs = NULL, reference = NULL, k = NULL, file = NULL, precision = 'double', min_prevalence = 1L, min_abundance = 0, cpus = n_cpus()) {
   
   validate_args()
   
-  .Call(C_unifrac, V_UNIFRAC, counts, tree, margin, pairs, cpus, NULL)
+  .Call(C_unifrac, V_UNIFRAC, counts, tree, margin, min_prevalence, min_abundance, pairs, reference, k, file, precision, cpus, NULL)
 }
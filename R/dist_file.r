@@ -0,0 +1,124 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+#' File-backed distance matrices
+#' 
+#' Beta diversity functions write their distances to disk when given a
+#' `file`, and return an `ecodive_dist_file` object in place of a `dist`.
+#' Only the rows and columns you ask for are read back into memory, so
+#' distance matrices larger than memory can be computed and used.
+#' 
+#' The file holds the lower triangle in the same order as a `dist` object,
+#' as 64-bit doubles. Set `options(ecodive.dist_file_type = 'float32')` to
+#' write 32-bit floats instead, halving the file size while keeping about
+#' seven significant digits.
+#' 
+#' Index the object like a matrix to read distances: `x[i, ]` returns the
+#' rows for samples `i`, and `x[i, j]` the distances between two sets of
+#' samples. Samples can be selected by position, name, or logical vector.
+#' `as.matrix(x)` reads the whole matrix into memory.
+#' 
+#' @param path   The path to a file written by a beta diversity function's
+#'        `file` argument.
+#' 
+#' @return An `ecodive_dist_file` object: a list with the file's `path`, its
+#'         `size` (number of samples), the sample `labels`, and the value
+#'         `type`.
+#' 
+#' @export
+#' @examples
+#'     path <- tempfile(fileext = '.ecd')
+#'     x    <- bray(ex_counts, file = path)
+#'     x
+#' 
+#'     x['Saliva', ]
+#'     x[c('Gums', 'Nose'), c('Saliva', 'Stool')]
+#' 
+#'     # Reattach to the file later
+#'     x <- dist_file(path)
+#'     as.matrix(x)
+#' 
+#'     unlink(path)
+#' 
+dist_file <- function (path) {
+  
+  validate_path()
+  
+  .Call(C_dist_file_info, normalizePath(path, mustWork = TRUE))
+}
+
+
+# Rewrite a distance file in place, one block at a time.
+map_dist_file <- function (x, f, block = 2^22) {
+  
+  n      <- as.numeric(x$size) * (x$size - 1) / 2
+  offset <- 0
+  
+  while (offset < n) {
+    vals   <- .Call(C_dist_file_slice, x$path, offset, min(block, n - offset))
+    .Call(C_dist_file_update, x$path, offset, f(vals))
+    offset <- offset + block
+  }
+  
+  return (x)
+}
+
+
+# Sample positions for `[`, from positions, names, or logicals.
+dist_file_index <- function (x, idx) {
+  
+  if (is.null(idx))         return (seq_len(x$size))
+  if (is.character(idx))    { idx <- match(idx, x$labels)             }
+  else if (is.logical(idx)) { idx <- which(rep_len(idx, x$size))      }
+  else                      { idx <- seq_len(x$size)[as.numeric(idx)] }
+  
+  if (anyNA(idx)) stop('Sample index is out of range.')
+  
+  return (as.integer(idx))
+}
+
+
+#' @export
+`[.ecodive_dist_file` <- function (x, i, j, drop = TRUE) {
+  
+  if (nargs() - !missing(drop) < 3)
+    stop('Index distance files with two subscripts, e.g. `x[i, ]`.')
+  
+  rows <- dist_file_index(x, if (missing(i)) NULL else i)
+  cols <- dist_file_index(x, if (missing(j)) NULL else j)
+  mtx  <- .Call(C_dist_file_extract, x$path, rows, cols)
+  
+  if (!is.null(x$labels))
+    dimnames(mtx) <- list(x$labels[rows], x$labels[cols])
+  
+  if (drop) mtx <- drop(mtx)
+  
+  return (mtx)
+}
+
+
+#' @export
+as.matrix.ecodive_dist_file <- function (x, ...) {
+  x[, , drop = FALSE]
+}
+
+
+#' @export
+dim.ecodive_dist_file <- function (x) {
+  c(x$size, x$size)
+}
+
+
+#' @export
+dimnames.ecodive_dist_file <- function (x) {
+  if (is.null(x$labels)) return (NULL)
+  list(x$labels, x$labels)
+}
+
+
+#' @export
+print.ecodive_dist_file <- function (x, ...) {
+  cat(x$size, 'x', x$size, x$type, 'distance matrix in', x$path, '\n')
+  invisible(x)
+}
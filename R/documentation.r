@@ -24,6 +24,16 @@
 #' @param digits   Precision of the returned values, in number of decimal 
 #'        places. E.g. the default `digits=3` could return `6.392`.
 #' 
+#' @param min_abundance   Drop features whose values sum to less than this 
+#'        across all samples before calculating diversity. See 
+#'        `min_prevalence`. Default: `0`
+#' 
+#' @param min_prevalence   Drop features found in fewer than this many 
+#'        samples before calculating diversity. Setting either threshold 
+#'        also drops features that are absent from every sample; the 
+#'        defaults keep every feature. Normalization sees only the kept 
+#'        features. Default: `1`
+#' 
 #' @param norm   Normalize the incoming counts. Options are:
 #'   
 #'   * `'none'`: No transformation.
@@ -37,7 +47,8 @@
 #' @param pairs   Which combinations of samples should distances be 
 #'        calculated for? The default value (`NULL`) calculates all-vs-all. 
 #'        Provide a numeric or logical vector specifying positions in the 
-#'        distance matrix to calculate. See examples.
+#'        distance matrix to calculate, or select pairs by study design with 
+#'        [pairs_within()] and related functions. See examples.
 #' 
 #' @param power   Scaling factor for the magnitude of differences between
 #'        communities (\eqn{p}). Default: `1.5`
@@ -46,6 +57,33 @@
 #'        \code{norm = 'clr'}. Ignored for other normalization methods. See 
 #'        **Pseudocount** section.
 #' 
+#' @param reference   Samples to compare against, in any format accepted by 
+#'        `counts` and with the same `margin`. When given, distances are 
+#'        calculated only from each sample in `counts` to each sample in 
+#'        `reference`, and returned as a matrix. Features are matched by name. 
+#'        Default: `NULL`
+#' 
+#' @param k   Keep only this many nearest neighbors of each sample, 
+#'        without storing the full distance matrix. Returns a list of 
+#'        `index` and `distance` matrices, with a column per sample and 
+#'        neighbors sorted nearest-first. Ties go to the lower index. With 
+#'        `reference`, neighbors are drawn from `reference` only. 
+#'        Default: `NULL`
+#' 
+#' @param file   Write the distances to this file instead of returning a 
+#'        `dist` object, for studies too large to hold one in memory. Returns 
+#'        an `ecodive_dist_file` object that reads distances from the file on 
+#'        demand; see [dist_file()]. Cannot be combined with `reference` or 
+#'        `k`. Default: `NULL`
+#' 
+#' @param precision   `'double'` or `'single'`. Single precision keeps 
+#'        normalized abundances as 32-bit floats, halving their memory and 
+#'        cache footprint; sums are still accumulated in double precision. 
+#'        A `file` is written as 32-bit floats. Most metrics agree with 
+#'        double precision to within one part in 10^7, but ratio metrics 
+#'        under CLR can lose far more; `vignette('performance')` lists the 
+#'        measured error for each metric. Default: `'double'`
+#' 
 #' @param margin  The margin containing samples. `1` if samples are rows, 
 #'        `2` if samples are columns. Ignored when `counts` is a special object 
 #'        class (e.g. `phyloseq`). Default: `1`
@@ -69,6 +107,10 @@
 #'   `vignette('performance')` for details on using optimized formats 
 #'   (e.g. sparse matrices) and parallel processing.
 #'   
+#'   Non-phylogenetic diversity metrics also accept a path to a file created 
+#'   by `write_ecomatrix()`. The file is memory-mapped rather than loaded, 
+#'   so tables larger than memory can be processed.
+#'   
 NULL
 
 
@@ -0,0 +1,56 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+#' Write counts to an ecomatrix file.
+#' 
+#' Saves a feature table in ecodive's binary sparse format, so that it can be
+#' passed by path to any diversity function. The file is memory-mapped rather
+#' than loaded into R, letting the operating system page data in and out as
+#' needed. This allows tables larger than available memory to be processed.
+#' 
+#' The file holds sample names but not feature names, so phylogenetic metrics
+#' (Faith and UniFrac) do not accept ecomatrix files.
+#' 
+#' [rarefy()] accepts an ecomatrix file too, and writes the rarefied counts
+#' to a new one given by its `file` argument.
+#' 
+#' @inherit documentation
+#' 
+#' @param path   Where to write the file. Any existing file is overwritten.
+#' 
+#' @return `path`, invisibly.
+#' 
+#' @export
+#' @examples
+#'     path <- tempfile(fileext = '.ecm')
+#'     write_ecomatrix(ex_counts, path)
+#' 
+#'     shannon(path)
+#'     bray(path)
+#' 
+#'     unlink(path)
+#' 
+write_ecomatrix <- function (counts, path, margin = 1L, cpus = n_cpus()) {
+  
+  validate_args()
+  
+  .Call(C_write_ecomatrix, counts, margin, path, cpus)
+  
+  invisible(path)
+}
+
+
+ecomatrix_file <- function (path) {
+  
+  path <- normalizePath(path, mustWork = TRUE)
+  info <- .Call(C_ecomatrix_info, path)
+  
+  structure(c(list(path = path), info), class = 'ecomatrix_file')
+}
+
+
+#' @export
+dim.ecomatrix_file <- function (x) {
+  c(x$n_samples, x$n_otus)
+}
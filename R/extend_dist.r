@@ -0,0 +1,162 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+#' Add new samples to a distance matrix
+#' 
+#' Extends distances calculated earlier to include samples that have
+#' arrived since. Only the distances involving a new sample are calculated;
+#' the rest are copied from `x` into the result as it is built. The result
+#' is the same as running `beta_div()` on all the samples at once.
+#' 
+#' Some distances depend on every sample in the table, so adding samples
+#' changes the old ones too:
+#' 
+#' * `'gower'`, which scales each feature by its range across samples.
+#' * CLR normalization (`'aitchison'`, or `norm = 'clr'`) when `pseudocount`
+#'   is left for ecodive to choose from the data, or when the new samples
+#'   have features that `counts` does not.
+#' 
+#' These raise an error unless `recompute = TRUE`, which calculates every
+#' distance anew.
+#' 
+#' There are no `min_prevalence` or `min_abundance` thresholds here, since
+#' the features they drop depend on every sample. Calculate `x` without
+#' them as well.
+#' 
+#' @inherit documentation
+#' 
+#' @param x   The distances among the samples in `counts`: a `dist` or
+#'        `ecodive_dist_file` object from `beta_div()` or one of the
+#'        metric functions.
+#' 
+#' @param counts   The samples `x` was calculated from, in the same order.
+#' 
+#' @param new_counts   The samples to add, in any format accepted by
+#'        `counts` except an ecomatrix file. Features are matched to those
+#'        of `counts` by name.
+#' 
+#' @param metric   The name of the beta diversity metric `x` was calculated
+#'        with. Flexible matching is supported, as in `beta_div()`. The
+#'        remaining arguments must also be the same as they were for `x`.
+#' 
+#' @param recompute   Calculate every distance, rather than only those
+#'        involving new samples. Required when the old distances would
+#'        change; see above. Default: `FALSE`
+#' 
+#' @return A `dist` object for the samples in `counts` followed by those in
+#'         `new_counts`. When `file` is given, an `ecodive_dist_file` object.
+#' 
+#' @export
+#' @examples
+#'     d <- bray(ex_counts[1:3,])
+#'     d
+#' 
+#'     # Only the three distances to Stool are calculated.
+#'     extend_dist(d, ex_counts[1:3,], ex_counts[4,,drop=FALSE], 'bray')
+#' 
+extend_dist <- function (
+    x,
+    counts,
+    new_counts,
+    metric,
+    margin      = 1L,
+    norm        = 'none',
+    pseudocount = NULL,
+    power       = 1.5,
+    alpha       = 0.5,
+    tree        = NULL,
+    file        = NULL,
+    precision   = 'double',
+    recompute   = FALSE,
+    cpus        = n_cpus() ) {
+  
+  metric <- match_metric(metric, div = 'beta')
+  
+  if (!inherits(x, c('dist', 'ecodive_dist_file')))
+    stop('`x` must be a dist or ecodive_dist_file object.')
+  
+  if (!isTRUE(recompute) && !isFALSE(recompute))
+    stop('`recompute` must be TRUE or FALSE.')
+  
+  add <- new.env()
+  assign('counts', new_counts, add)
+  assign('margin', margin,     add)
+  
+  validate_counts()
+  validate_margin()
+  validate_counts(add)
+  validate_margin(add)
+  
+  old <- as_triplets(counts, margin)
+  new <- tryCatch(
+    as_triplets(add$counts, add$margin),
+    error = function (e) stop(e$message, '\n`new_counts` must be a valid numeric matrix.') )
+  
+  n_old  <- if (inherits(x, 'dist')) attr(x, 'Size')   else x$size
+  labels <- if (inherits(x, 'dist')) attr(x, 'Labels') else x$labels
+  
+  if (old$dim[[1]] != n_old)
+    stop('`x` has ', n_old, ' samples, but `counts` has ', old$dim[[1]], '.')
+  
+  if (!is.null(labels) && !is.null(old$dimnames[[1]]) && !identical(as.character(labels), old$dimnames[[1]]))
+    stop('`counts` must have the same samples as `x`, in the same order.')
+  
+  if (!is.null(file) && inherits(x, 'ecodive_dist_file'))
+    if (identical(normalizePath(file, mustWork = FALSE), normalizePath(x$path)))
+      stop('`file` cannot be the file holding `x`.')
+  
+  
+  # Refuse when the old distances would change.
+  clr <- metric$id == 'aitchison'
+  if (!clr && 'norm' %in% metric$params)
+    clr <- identical(local({ validate_norm(); norm }), NORM_CLR)
+  
+  new_otus <- !is.null(new$dimnames[[2]]) && !all(new$dimnames[[2]] %in% old$dimnames[[2]])
+  
+  why <- NULL
+  if (metric$id == 'gower') {
+    why <- 'Gower distances scale each feature by its range across all samples'
+  } else if (clr && is.null(pseudocount)) {
+    why <- 'the CLR pseudocount is chosen from all samples; set `pseudocount`'
+  } else if (clr && new_otus) {
+    why <- 'CLR values depend on the number of features, and `new_counts` adds some'
+  }
+  
+  if (!is.null(why) && !recompute)
+    stop('Cannot extend `x`: ', why, '. Use `recompute = TRUE` to recalculate every distance.')
+  
+  
+  counts <- tryCatch(
+    stack_triplets(old, new),
+    error = function (e) stop(e$message, '\n`new_counts` must have the same features as `counts`.') )
+  
+  pairs <- NULL
+  if (!recompute)
+    pairs <- structure(list(type = PAIRS_NEW, n_old = n_old), class = 'ecodive_pairs')
+  
+  res <- beta_div(
+    counts      = counts,
+    metric      = metric$id,
+    margin      = 1L,
+    norm        = norm,
+    pseudocount = pseudocount,
+    power       = power,
+    alpha       = alpha,
+    tree        = tree,
+    pairs       = pairs,
+    file        = file,
+    precision   = precision,
+    cpus        = cpus )
+  
+  if (recompute) return (res)
+  
+  # Fills the old block of `res` in place.
+  if (inherits(x, 'dist') && !is.double(x)) storage.mode(x) <- 'double'
+  .Call(
+    C_dist_extend,
+    if (is.null(file))       res else res$path,
+    if (inherits(x, 'dist')) x   else x$path )
+  
+  return (res)
+}
@@ -0,0 +1,185 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+# Metrics that can be estimated from a sketch. Each has whether
+# the sketch is weighted, and the normalization it is built on.
+MINHASH_METRICS <- list(
+  jaccard = list(weighted = FALSE, norm = 'none'),
+  soergel = list(weighted = TRUE,  norm = 'none'),
+  bray    = list(weighted = TRUE,  norm = 'percent') )
+
+
+
+#' Approximate distances with MinHash sketches
+#' 
+#' Summarizes each sample as a fixed-length signature of hash values, from
+#' which distances can be estimated without revisiting the counts. Two
+#' samples' signatures agree at each position with probability equal to
+#' their Jaccard similarity, so the estimate's standard error is about
+#' \eqn{\sqrt{J(1-J)/size}}.
+#' 
+#' `'jaccard'` sketches which features are present. `'soergel'` (weighted
+#' Jaccard) uses Ioffe's improved consistent weighted sampling on the
+#' counts, and `'bray'` does the same on percentages, since the weighted
+#' Jaccard similarity \eqn{J} of relative abundances gives Bray-Curtis
+#' dissimilarity as \eqn{(1 - J) / (1 + J)}.
+#' 
+#' The standard error of a `'jaccard'` or `'soergel'` estimate is therefore
+#' at most \eqn{0.5/\sqrt{size}}. Converting to Bray-Curtis stretches the
+#' error by up to a factor of two at small \eqn{J}, where it is also
+#' smallest; a `'bray'` estimate's standard error is at most
+#' \eqn{0.56/\sqrt{size}}.
+#' 
+#' Features are hashed by name, so signatures do not depend on the order
+#' of the features, and the `signatures` of two tables sketched with the
+#' same `seed`, `size`, and `metric` can be joined with `cbind()`. Unnamed
+#' features are hashed by position.
+#' 
+#' Given `max_dist`, `minhash_dist()` avoids comparing every pair of
+#' samples. Signatures are split into `bands`; only samples that share every
+#' hash in at least one band are compared. By default, `bands` is chosen so
+#' that a pair exactly at `max_dist` is found with at least 95% probability,
+#' and closer pairs are found more reliably still. A pair that collides in
+#' several bands is kept once, so memory grows with the number of distinct
+#' pairs compared rather than with `bands`.
+#' 
+#' @inherit documentation
+#' 
+#' @name minhash
+#' 
+#' @param metric   The distance to estimate: `'jaccard'`, `'soergel'`, or
+#'        `'bray'`. Flexible matching is supported, as in `beta_div()`.
+#'        Default: `'jaccard'`
+#' 
+#' @param size   The number of hashes in each signature. Larger sizes give
+#'        more accurate estimates, in proportion to the square root of
+#'        `size`. Default: `128`
+#' 
+#' @param seed   An integer seed for the hash functions. Sketches must share
+#'        a seed to be compared. Default: `0`
+#' 
+#' @param sketch   A sketch returned by `minhash()`.
+#' 
+#' @param max_dist   Return only the pairs of samples whose estimated
+#'        distance is at most this, found by locality-sensitive hashing.
+#'        Must be in `[0, 1)`. Default: `NULL`
+#' 
+#' @param bands   The number of bands to split each signature into when
+#'        `max_dist` is given. More bands find more pairs, at the cost of
+#'        comparing more. Default: `NULL`, chosen from `max_dist`.
+#' 
+#' @return `minhash()` returns a sketch of class `ecodive_minhash`: a list
+#'         with elements `metric`, `size`, `seed`, and `signatures`, an
+#'         integer matrix with a column for each sample. Samples with no
+#'         features have signatures of `NA`.
+#' 
+#'         `minhash_dist()` returns a `dist` object of estimated distances.
+#'         With `max_dist`, a data frame with columns `sample1`, `sample2`,
+#'         and `distance` instead, one row for each pair found.
+#' 
+#' @export
+#' @examples
+#'     sketch <- minhash(ex_counts, 'bray', size = 1024)
+#'     sketch
+#' 
+#'     # Close to bray(ex_counts, norm = 'percent')
+#'     minhash_dist(sketch)
+#' 
+#'     # Only the pairs within a distance of 0.5
+#'     minhash_dist(sketch, max_dist = 0.5)
+#' 
+minhash <- function (
+    counts,
+    metric = 'jaccard',
+    size   = 128L,
+    seed   = 0L,
+    margin = 1L,
+    cpus   = n_cpus() ) {
+  
+  metric <- match_metric(metric, div = 'beta')$id
+  spec   <- MINHASH_METRICS[[metric]]
+  
+  if (is.null(spec))
+    stop('`metric` must be one of: ', paste(collapse = ', ', names(MINHASH_METRICS)))
+  
+  norm <- spec$norm
+  validate_counts()
+  validate_margin()
+  validate_norm()
+  validate_size()
+  validate_seed()
+  validate_cpus()
+  
+  otus <- tryCatch(dimnames(counts)[[3L - margin]], error = function (e) NULL)
+  if (!is.character(otus)) otus <- NULL
+  
+  signatures <- .Call(
+    C_minhash, counts, margin, norm, spec$weighted,
+    otus, size, seed, cpus )
+  
+  structure(
+    .Data = list(
+      metric     = metric,
+      size       = size,
+      seed       = seed,
+      signatures = signatures ),
+    class = 'ecodive_minhash' )
+}
+
+
+#' @rdname minhash
+#' @export
+minhash_dist <- function (sketch, max_dist = NULL, bands = NULL, cpus = n_cpus()) {
+  
+  if (!inherits(sketch, 'ecodive_minhash'))
+    stop('`sketch` must be a sketch created by minhash().')
+  
+  validate_max_dist()
+  validate_bands()
+  validate_cpus()
+  
+  size <- nrow(sketch$signatures)
+  bray <- sketch$metric == 'bray'
+  
+  if (is.null(max_dist)) {
+    d <- .Call(C_minhash_dist, sketch$signatures, cpus)
+    if (bray) d <- map_dist(d, function (x) x / (2 - x))
+    return (d)
+  }
+  
+  # Bray-Curtis distance d is Jaccard distance 2d / (1 + d).
+  if (bray) max_dist <- 2 * max_dist / (1 + max_dist)
+  
+  # The longest bands that still find a pair at max_dist
+  # with 95% probability.
+  if (is.null(bands)) {
+    s     <- 1 - max_dist
+    rows  <- seq_len(size)
+    found <- 1 - (1 - s ^ rows) ^ (size %/% rows)
+    bands <- size %/% max(1L, rows[found >= 0.95])
+  }
+  
+  if (bands > size)
+    stop('`bands` cannot be more than the sketch size, ', size, '.')
+  
+  res <- .Call(C_minhash_lsh, sketch$signatures, bands, max_dist, cpus)
+  if (bray) res$distance <- res$distance / (2 - res$distance)
+  
+  labels <- colnames(sketch$signatures)
+  if (!is.null(labels)) {
+    res$i <- labels[res$i]
+    res$j <- labels[res$j]
+  }
+  
+  data.frame(sample1 = res$i, sample2 = res$j, distance = res$distance)
+}
+
+
+#' @export
+print.ecodive_minhash <- function (x, ...) {
+  cat(
+    'MinHash sketch of', ncol(x$signatures), 'samples for', x$metric,
+    'distance, with size', x$size, 'and seed', paste0(x$seed, '\n') )
+  invisible(x)
+}
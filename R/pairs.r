@@ -0,0 +1,131 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+PAIRS_WITHIN      <- 1L
+PAIRS_BETWEEN     <- 2L
+PAIRS_CONSECUTIVE <- 3L
+PAIRS_ONE_VS_ALL  <- 4L
+PAIRS_NEW         <- 5L
+
+
+
+#' Sample pairs from a study design
+#' 
+#' Selects which distances to calculate from how the samples are grouped,
+#' rather than by their positions in the distance matrix. Pass the result as
+#' `pairs` to any beta diversity function. Pairs are generated as the
+#' distances are calculated, so no list of them is ever built, even for
+#' studies with tens of thousands of samples.
+#' 
+#' * `pairs_within()`: every pair of samples in the same group, e.g. all
+#'   samples from the same subject.
+#' * `pairs_between()`: every pair of samples in different groups.
+#' * `pairs_consecutive()`: each sample and the next one by `order` in the
+#'   same group, e.g. successive visits by each subject.
+#' * `pairs_one_vs_all()`: one sample against every other sample.
+#' 
+#' Samples whose group is `NA` are left out. Distances that are not
+#' selected are `NA` in the result, as with other `pairs` values.
+#' 
+#' @param groups   A vector with one element for each sample, giving its
+#'        group. When both `groups` and the samples are named, they are
+#'        matched by name, and samples missing from `groups` are left out.
+#' 
+#' @param order   A vector with one element for each sample that sorts the
+#'        samples within their groups, e.g. collection dates. Matched to
+#'        the samples in the same way as `groups`.
+#' 
+#' @param sample   The name or position of one sample.
+#' 
+#' @return A pair specification of class `ecodive_pairs`.
+#' 
+#' @name pairs_within
+#' @export
+#' @examples
+#'     site <- c(Saliva = 'oral', Gums = 'oral', Nose = 'skin', Stool = 'gut')
+#' 
+#'     bray(ex_counts, pairs = pairs_within(site))
+#' 
+#'     bray(ex_counts, pairs = pairs_between(site))
+#' 
+#'     bray(ex_counts, pairs = pairs_one_vs_all('Stool'))
+#' 
+#'     # All samples as one series, in the order given
+#'     bray(ex_counts, pairs = pairs_consecutive(order = 1:4))
+#' 
+pairs_within <- function (groups) {
+  structure(list(type = PAIRS_WITHIN, groups = groups), class = 'ecodive_pairs')
+}
+
+
+#' @rdname pairs_within
+#' @export
+pairs_between <- function (groups) {
+  structure(list(type = PAIRS_BETWEEN, groups = groups), class = 'ecodive_pairs')
+}
+
+
+#' @rdname pairs_within
+#' @export
+pairs_consecutive <- function (groups = NULL, order) {
+  structure(list(type = PAIRS_CONSECUTIVE, groups = groups, order = order), class = 'ecodive_pairs')
+}
+
+
+#' @rdname pairs_within
+#' @export
+pairs_one_vs_all <- function (sample) {
+  structure(list(type = PAIRS_ONE_VS_ALL, sample = sample), class = 'ecodive_pairs')
+}
+
+
+#' @export
+print.ecodive_pairs <- function (x, ...) {
+  
+  type <- c('within-group', 'between-group', 'consecutive', 'one-vs-all', 'new-sample')[[x$type]]
+  cat('Sample pairs:', type, '\n')
+  
+  invisible(x)
+}
+
+
+# The form C_beta_div() and C_unifrac() read: group codes
+# for each sample (NA to leave out), the samples sorted by
+# group and `order`, and the one-vs-all sample or the first
+# new sample from extend_dist(); 0-based.
+resolve_pairs <- function (pairs, n_samples, sample_names) {
+  
+  align <- function (x, arg) {
+    if (!is.null(names(x)) && !is.null(sample_names))
+      return (unname(x[sample_names]))
+    if (length(x) != n_samples)
+      stop('`', arg, '` must have one element for each of the ', n_samples, ' samples')
+    return (unname(x))
+  }
+  
+  group  <- rep(1L, n_samples)
+  sorted <- integer(0)
+  samp   <- -1L
+  
+  if (!is.null(pairs$groups))
+    group <- as.integer(factor(align(pairs$groups, 'groups')))
+  
+  if (pairs$type == PAIRS_CONSECUTIVE) {
+    ord    <- align(pairs$order, 'order')
+    sorted <- as.integer(order(group, ord, na.last = NA) - 1L)
+  }
+  
+  if (pairs$type == PAIRS_ONE_VS_ALL) {
+    samp <- pairs$sample
+    if (is.character(samp)) samp <- match(samp, sample_names)
+    stopifnot(length(samp) == 1, !is.na(samp), samp %% 1 == 0)
+    stopifnot(samp >= 1, samp <= n_samples)
+    samp <- as.integer(samp - 1L)
+  }
+  
+  if (pairs$type == PAIRS_NEW)
+    samp <- as.integer(pairs$n_old)
+  
+  list(type = pairs$type, group = group, order = sorted, sample = samp)
+}
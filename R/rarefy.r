@@ -32,8 +32,14 @@
 #'        or returned unrarefied due to insufficient depth. 
 #'        Default: `interactive()`
 #' 
+#' @param file    Write the rarefied counts to this ecomatrix file (see 
+#'        [write_ecomatrix()]) rather than returning them. Required when 
+#'        `counts` is an ecomatrix file, so that tables larger than memory 
+#'        can be rarefied. With `times`, give one path per rarefaction. 
+#'        Default: `NULL`
+#' 
 #' @return A rarefied matrix. The output class (`matrix`, `dgCMatrix`, etc.) 
-#'         matches the input class.
+#'         matches the input class. With `file`, the path(s) written.
 #' 
 #' @section Auto-Depth Selection:
 #'   If `depth` is `NULL`, the function defaults to the highest depth that retains 
@@ -89,11 +95,15 @@ rarefy <- function (
     drop   = TRUE, 
     margin = 1L, 
     cpus   = n_cpus(),
-    warn   = interactive() ) {
+    warn   = interactive(), 
+    file   = NULL ) {
   
   validate_args()
   assert_integer_counts()
   
+  if (inherits(counts, 'ecomatrix_file') && is.null(file))
+    stop('Rarefying an ecomatrix file requires `file`, a path to write the result to.')
+  
   
   # Ensure counts are double
   if (is.matrix(counts)) {
@@ -108,7 +118,10 @@ rarefy <- function (
   # auto-selection AND the warning check.
   if (is.null(depth) || isTRUE(warn)) {
     
-    if (is.matrix(counts)) {
+    if (inherits(counts, 'ecomatrix_file')) {
+      sums <- .Call(C_ecomatrix_sums, counts) # samples are rows
+    }
+    else if (is.matrix(counts)) {
       if (margin == 1L) sums <- rowSums(counts)
       else              sums <- colSums(counts)
     }
@@ -170,6 +183,20 @@ rarefy <- function (
   }
   
   
+  # Stream to ecomatrix files; C drops short samples.
+  if (!is.null(file)) {
+    
+    seeds <- seed
+    if (!is.null(times))
+      seeds <- ((seed + 2**31 - 1 + seq_len(times)) %% 2**32) - 2**31
+    
+    for (i in seq_along(file))
+      .Call(C_rarefy_file, counts, depth, seeds[[i]], margin, drop, file[[i]], cpus)
+    
+    return (file)
+  }
+  
+  
   # Call C function
   if (is.null(times)) {
     result <- .Call(C_rarefy, counts, depth, seed, margin, cpus)
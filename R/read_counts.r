@@ -0,0 +1,70 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+#' Read a feature table from a text or BIOM file.
+#' 
+#' Parses delimited text (TSV/CSV) or BIOM-JSON (v1.0) directly into a sparse
+#' matrix. The file is memory-mapped and tokenized in parallel, and only
+#' non-zero values are kept, so large tables load without ever building the
+#' dense table in memory.
+#' 
+#' @section Delimited text:
+#' The first field of each row is its ID, and the header line holds the
+#' column IDs. Leading comment lines without any `sep` characters, such as
+#' `# Constructed from biom file`, are skipped. A final `taxonomy` or
+#' `Consensus Lineage` column is dropped. Empty fields are read as zero.
+#' 
+#' @section BIOM:
+#' Files beginning with `{` are read as BIOM-JSON, in either sparse or dense
+#' layout. Feature and sample IDs are taken from `rows` and `columns`;
+#' metadata is ignored. BIOM v2 (HDF5) files are not supported.
+#' 
+#' @inheritParams documentation
+#' 
+#' @param path   Path to the file to read.
+#' 
+#' @param margin   For delimited text, whether samples are in rows (`1`) or
+#'        columns (`2`) of the file. Ignored for BIOM files, which always
+#'        store samples in columns. Default: `2`
+#' 
+#' @param sep   Field delimiter for delimited text. The default, `NULL`, uses
+#'        `","` for `.csv` files and `"\t"` otherwise.
+#' 
+#' @return A `dgCMatrix` with features in rows and samples in columns. Pass
+#'         it to diversity functions with `margin = 2`.
+#' 
+#' @export
+#' @examples
+#'     if (requireNamespace('Matrix', quietly = TRUE)) {
+#'       
+#'       path <- tempfile(fileext = '.tsv')
+#'       write.table(
+#'         x = t(ex_counts), file = path, sep = '\t', 
+#'         quote = FALSE, col.names = NA )
+#'       
+#'       counts <- read_counts(path)
+#'       counts[1:4, 1:4]
+#'       
+#'       bray(counts, margin = 2)
+#'       
+#'       unlink(path)
+#'     }
+#' 
+read_counts <- function (path, margin = 2L, sep = NULL, cpus = n_cpus()) {
+  
+  if (!requireNamespace('Matrix', quietly = TRUE))
+    stop('The Matrix package is required for read_counts().')
+  
+  validate_args()
+  
+  res <- .Call(C_read_counts, path, sep, margin, cpus)
+  
+  Matrix::sparseMatrix(
+    i        = res$i, 
+    p        = res$p, 
+    x        = res$x, 
+    dims     = c(res$n_otus, res$n_samples), 
+    dimnames = list(res$otu_names, res$sample_names), 
+    index1   = FALSE )
+}
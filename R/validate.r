@@ -9,13 +9,17 @@ NORM_CHORD   <- 3L
 NORM_BINARY  <- 4L
 NORM_RCLR    <- 5L
 
+PRECISION_DOUBLE <- 0L
+PRECISION_SINGLE <- 1L
+
 
 validate_args <- function () {
   env  <- parent.frame()
   args <- ls(env)
   
-  # move counts, norm, pseudocount, and margin to head of the line
-  args <- unique(c(intersect(c('counts', 'norm', 'pseudocount', 'margin'), args), sort(args)))
+  # move counts, margin, tree, reference, norm, and pseudocount to head of the line
+  head <- c('counts', 'margin', 'tree', 'reference', 'norm', 'pseudocount')
+  args <- unique(c(intersect(head, args), sort(args)))
   
   for (arg in args)
     do.call(paste0('validate_', arg), list(env))
@@ -40,6 +44,29 @@ validate_alpha <- function (env = parent.frame()) {
 }
 
 
+validate_bands <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(bands)) {
+        
+        stopifnot(is.numeric(bands))
+        stopifnot(length(bands) == 1)
+        stopifnot(!is.na(bands))
+        stopifnot(bands > 0)
+        stopifnot(bands %% 1 == 0)
+        
+        bands <- as.integer(min(bands, .Machine$integer.max))
+      }
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`bands` must be a positive integer or NULL.')
+  )
+}
+
+
 validate_counts <- function (env = parent.frame()) {
   tryCatch(
     with(env, {
@@ -62,9 +89,14 @@ validate_counts <- function (env = parent.frame()) {
       }
       
       # Derive matrix from simple vector or complex object.
-      if (!inherits(counts, c('matrix', 'dgCMatrix', 'dgTMatrix', 'dgeMatrix', 'simple_triplet_matrix'))) {
+      if (!inherits(counts, c('matrix', 'dgCMatrix', 'dgTMatrix', 'dgeMatrix', 'simple_triplet_matrix', 'ecomatrix_file'))) {
         
-        if (inherits(counts, 'rbiom')) {
+        if (is.character(counts) && length(counts) == 1) {
+          counts <- ecomatrix_file(counts) # samples are rows
+          margin <- 1L
+        }
+        
+        else if (inherits(counts, 'rbiom')) {
           counts <- counts$counts # dgCMatrix
           margin <- 2L
         }
@@ -200,6 +232,128 @@ validate_drop <- function (env = parent.frame()) {
 }
 
 
+validate_file <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(file)) {
+        
+        if (exists('reference', inherits = FALSE) && !is.null(reference))
+          stop('`reference` cannot be combined with `file`')
+        if (exists('k', inherits = FALSE) && !is.null(k))
+          stop('`k` cannot be combined with `file`')
+        
+        # rarefy() writes one file per rarefaction.
+        n_files <- 1
+        if (exists('times', inherits = FALSE) && !is.null(times))
+          n_files <- times
+        
+        stopifnot(is.character(file))
+        stopifnot(length(file) == n_files)
+        stopifnot(!anyNA(file))
+        stopifnot(all(nzchar(file)))
+        stopifnot(all(dir.exists(dirname(file))))
+        
+        file <- normalizePath(file, mustWork = FALSE)
+        remove('n_files')
+      }
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`file` must be a writable file path or NULL.')
+  )
+}
+
+
+validate_k <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(k)) {
+        
+        if (exists('pairs', inherits = FALSE) && !is.null(pairs))
+          stop('`pairs` cannot be combined with `k`')
+        
+        stopifnot(is.numeric(k))
+        stopifnot(length(k) == 1)
+        stopifnot(!is.na(k))
+        stopifnot(k > 0)
+        stopifnot(k %% 1 == 0)
+        
+        k <- as.integer(min(k, .Machine$integer.max))
+      }
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`k` must be a positive integer or NULL.')
+  )
+}
+
+
+validate_max_dist <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(max_dist)) {
+        
+        stopifnot(is.numeric(max_dist))
+        stopifnot(length(max_dist) == 1)
+        stopifnot(!is.na(max_dist))
+        stopifnot(max_dist >= 0)
+        stopifnot(max_dist < 1)
+        
+        max_dist <- as.double(max_dist)
+      }
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`max_dist` must be a number in [0, 1) or NULL.')
+  )
+}
+
+
+validate_min_abundance <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      stopifnot(is.numeric(min_abundance))
+      stopifnot(length(min_abundance) == 1)
+      stopifnot(is.finite(min_abundance))
+      stopifnot(min_abundance >= 0)
+      
+      min_abundance <- as.double(min_abundance)
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`min_abundance` must be a single non-negative number.')
+  )
+}
+
+
+validate_min_prevalence <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      stopifnot(is.numeric(min_prevalence))
+      stopifnot(length(min_prevalence) == 1)
+      stopifnot(!is.na(min_prevalence))
+      stopifnot(min_prevalence > 0)
+      stopifnot(min_prevalence %% 1 == 0)
+      
+      min_prevalence <- as.integer(min(min_prevalence, .Machine$integer.max))
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`min_prevalence` must be a positive integer.')
+  )
+}
+
+
 validate_newick <- function (env = parent.frame()) {
   tryCatch(
     with(env, {
@@ -219,8 +373,15 @@ validate_newick <- function (env = parent.frame()) {
 
 validate_pairs <- function (env = parent.frame()) {
   
+  # Already checked against `pairs` by validate_reference().
+  if (is.numeric(env$reference)) return (invisible())
+  
+  # Samples are rows when margin is 1.
   with(env, {
-    if (ncol(counts) < 2)
+    if (exists('margin', inherits = FALSE) && margin == 1L) {
+      if (nrow(counts) < 2) stop('`counts` must have at least two samples.')
+    }
+    else if (ncol(counts) < 2)
       stop('`counts` must have at least two samples.')
   })
   
@@ -229,8 +390,9 @@ validate_pairs <- function (env = parent.frame()) {
       
       if (!is.null(pairs)) {
         
-        n_samples   <- ncol(counts)
-        n_distances <- n_samples * (n_samples - 1) / 2
+        by_row      <- exists('margin', inherits = FALSE) && margin == 1L
+        n_samples   <- if (by_row) nrow(counts) else ncol(counts)
+        n_distances <- as.double(n_samples) * (n_samples - 1) / 2
         
         if (is.function(pairs))
           pairs <- local({
@@ -238,7 +400,13 @@ validate_pairs <- function (env = parent.frame()) {
             mapply(pairs, m[1,], m[2,])
           })
         
-        if (is.logical(pairs)) {
+        if (inherits(pairs, 'ecodive_pairs')) {
+          pairs <- resolve_pairs(
+            pairs        = pairs, 
+            n_samples    = n_samples, 
+            sample_names = if (by_row) rownames(counts) else colnames(counts) )
+        }
+        else if (is.logical(pairs)) {
           if (length(pairs) != n_distances)
             stop('logical vector `pairs` must have length ', n_distances)
           pairs <- which(pairs)
@@ -246,7 +414,9 @@ validate_pairs <- function (env = parent.frame()) {
         else if (is.numeric(pairs)) {
           if (is.double(pairs)) {
             if (any(pairs %% 1 > 0)) stop('non-integer values')
-            pairs <- as.integer(pairs)
+            # Long dist vectors need double indices.
+            if (n_distances <= .Machine$integer.max)
+              pairs <- as.integer(pairs)
           }
           if (!all(pairs >= 1 & pairs <= n_distances))
             stop('expected `pairs` values between 1 and ', n_distances)
@@ -255,12 +425,30 @@ validate_pairs <- function (env = parent.frame()) {
           stop('cannot be ', typeof(pairs))
         }
         
-        remove('n_samples', 'n_distances')
+        remove('by_row', 'n_samples', 'n_distances')
       }
     }),
     
     error = function (e) 
-      stop(e$message, '\n`pairs` must be a numeric or logical vector.')
+      stop(e$message, '\n`pairs` must be a numeric or logical vector, or a pair specification such as pairs_within().')
+  )
+}
+
+
+validate_path <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      stopifnot(is.character(path))
+      stopifnot(length(path) == 1)
+      stopifnot(!is.na(path))
+      stopifnot(nzchar(path))
+      
+      path <- normalizePath(path, mustWork = FALSE)
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`path` must be a single file path.')
   )
 }
 
@@ -282,6 +470,20 @@ validate_power <- function (env = parent.frame()) {
 }
 
 
+validate_precision <- function (env = parent.frame()) {
+  with(env, {
+    
+    precision <- switch(
+      EXPR = match.arg(
+        arg     = tolower(precision), 
+        choices = c('double', 'single') ),
+      'double' = PRECISION_DOUBLE,
+      'single' = PRECISION_SINGLE )
+    
+  })
+}
+
+
 validate_pseudocount <- function (env = parent.frame()) {
   with(env, {
     
@@ -297,7 +499,8 @@ validate_pseudocount <- function (env = parent.frame()) {
         mtx_pkg,
         'base'   = range(counts),
         'slam'   = range(counts$v),
-        'Matrix' = range(counts@x) )
+        'Matrix' = range(counts@x),
+        'file'   = c(counts$min_val, counts$max_val) )
       
       if (length(val_range) == 2 && !all(is.finite(val_range)))
         stop('`counts` contains non-finite values; cannot perform CLR normalization.')
@@ -339,7 +542,8 @@ validate_pseudocount <- function (env = parent.frame()) {
           has_zeros <- switch(
             mtx_pkg,
             'slam'   = length(counts$v) < counts$nrow * counts$ncol,
-            'Matrix' = length(counts@x) < prod(dim(counts)) )
+            'Matrix' = length(counts@x) < prod(dim(counts)),
+            'file'   = counts$nnz < prod(dim(counts)) )
         
         
         if (!has_zeros) {
@@ -354,7 +558,8 @@ validate_pseudocount <- function (env = parent.frame()) {
             mtx_pkg,
             'base'   = min(counts[counts > 0]),
             'slam'   = min(counts$v[counts$v > 0]),
-            'Matrix' = min(counts@x[counts@x > 0]) )
+            'Matrix' = min(counts@x[counts@x > 0]),
+            'file'   = counts$min_pos )
           
           pseudocount <- pseudocount / 2
           
@@ -375,6 +580,60 @@ validate_pseudocount <- function (env = parent.frame()) {
 }
 
 
+validate_radius <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(radius)) {
+        
+        stopifnot(is.numeric(radius))
+        stopifnot(length(radius) == 1)
+        stopifnot(!is.na(radius))
+        stopifnot(radius >= 0)
+        
+        radius <- as.double(radius)
+      }
+      
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`radius` must be a non-negative number or NULL.')
+  )
+}
+
+
+validate_reference <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (!is.null(reference)) {
+        
+        if (!is.null(pairs))
+          stop('`pairs` cannot be combined with `reference`')
+        
+        ref <- new.env()
+        assign('counts', reference, ref)
+        assign('margin', margin,    ref)
+        validate_counts(ref)
+        validate_margin(ref)
+        
+        # Query samples first; C code sees their number.
+        qry       <- as_triplets(counts,     margin)
+        ref       <- as_triplets(ref$counts, ref$margin)
+        counts    <- stack_triplets(qry, ref, fixed = exists('tree', inherits = FALSE))
+        reference <- as.integer(qry$dim[[1]])
+        margin    <- 1L
+        
+        remove('qry', 'ref')
+      }
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`reference` must be a valid numeric matrix with the same features as `counts`.')
+  )
+}
+
+
 validate_margin <- function (env = parent.frame()) {
   tryCatch(
     with(env, {
@@ -427,6 +686,47 @@ validate_seed <- function (env = parent.frame()) {
 }
 
 
+validate_sep <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      if (is.null(sep))
+        sep <- ifelse(grepl('\\.csv$', path, ignore.case = TRUE), ',', '\t')
+      
+      stopifnot(is.character(sep))
+      stopifnot(length(sep) == 1)
+      stopifnot(!is.na(sep))
+      stopifnot(nchar(sep, type = 'bytes') == 1)
+      stopifnot(!sep %in% c('\n', '\r', '"'))
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`sep` must be a single character, such as "\\t" or ",".')
+  )
+}
+
+
+validate_size <- function (env = parent.frame()) {
+  tryCatch(
+    with(env, {
+      
+      stopifnot(is.numeric(size))
+      stopifnot(length(size) == 1)
+      stopifnot(!is.na(size))
+      stopifnot(size > 0)
+      stopifnot(size <= 65536)
+      stopifnot(size %% 1 == 0)
+      
+      if (!is.integer(size))
+        size <- as.integer(size)
+    }),
+    
+    error = function (e) 
+      stop(e$message, '\n`size` must be an integer between 1 and 65536.')
+  )
+}
+
+
 validate_times <- function (env = parent.frame()) {
   tryCatch(
     with(env, {
@@ -472,6 +772,9 @@ validate_tree <- function (env = parent.frame()) {
       
       stopifnot(hasName(tree, 'tip.label'))
       
+      if (inherits(counts, 'ecomatrix_file'))
+        stop('ecomatrix files do not store OTU names')
+      
       if (margin == 1L) {
         
         stopifnot(!is.null(colnames(counts)))
@@ -553,7 +856,8 @@ assert_integer_counts <- function (env = parent.frame()) {
       get_matrix_package(counts),
       'base'   = all(counts   %% 1 == 0),
       'slam'   = all(counts$v %% 1 == 0),
-      'Matrix' = all(counts@x %% 1 == 0) )
+      'Matrix' = all(counts@x %% 1 == 0),
+      'file'   = counts$integral )
     
     if (!isTRUE(all_ints))
       stop('`counts` must be whole numbers (integers).')
@@ -568,8 +872,89 @@ get_matrix_package <- function (counts) {
     return ('base')
   } else if (inherits(counts, 'simple_triplet_matrix')) {
     return ('slam')
+  } else if (inherits(counts, 'ecomatrix_file')) {
+    return ('file')
   } else {
     return ('Matrix')
   }
 }
 
+
+# Non-zero values as 1-based triplets, samples as rows.
+as_triplets <- function (counts, margin) {
+  
+  mtx_pkg <- get_matrix_package(counts)
+  
+  if (mtx_pkg == 'file')
+    stop('ecomatrix files do not store feature names')
+  
+  if (inherits(counts, 'dgeMatrix')) {
+    counts  <- as.matrix(counts)
+    mtx_pkg <- 'base'
+  }
+  
+  trp <- switch(
+    mtx_pkg,
+    'base' = local({
+      ij <- which(counts != 0, arr.ind = TRUE)
+      list(
+        i = ij[,1], j = ij[,2], v = counts[ij], 
+        dim = dim(counts), dimnames = dimnames(counts) )
+    }),
+    'slam' = list(
+      i = counts$i, j = counts$j, v = counts$v, 
+      dim = c(counts$nrow, counts$ncol), dimnames = counts$dimnames ),
+    'Matrix' = list(
+      i = counts@i + 1L, 
+      j = if (inherits(counts, 'dgCMatrix')) {
+        rep.int(seq_len(counts@Dim[[2]]), diff(counts@p)) } else { counts@j + 1L },
+      v = counts@x, dim = counts@Dim, dimnames = counts@Dimnames ))
+  
+  if (margin == 2L)
+    trp <- list(
+      i = trp$j, j = trp$i, v = trp$v, 
+      dim = rev(trp$dim), dimnames = rev(trp$dimnames) )
+  
+  return (trp)
+}
+
+
+# The samples of `qry` then `ref` as one simple_triplet_matrix,
+# with features matched by name, or by position if unnamed.
+# When `fixed`, `ref` may not add features (e.g. tree tips).
+stack_triplets <- function (qry, ref, fixed = FALSE) {
+  
+  q_otus <- qry$dimnames[[2]]
+  r_otus <- ref$dimnames[[2]]
+  
+  if (is.null(q_otus) || is.null(r_otus)) {
+    if (qry$dim[[2]] != ref$dim[[2]])
+      stop('features must be named, or equal in number')
+    otus <- if (is.null(q_otus)) r_otus else q_otus
+    r_j  <- ref$j
+  }
+  else {
+    if (fixed && !all(r_otus %in% q_otus))
+      stop('`reference` has features that are not in `tree`')
+    otus <- c(q_otus, setdiff(r_otus, q_otus))
+    r_j  <- match(r_otus, otus)[ref$j]
+  }
+  
+  q_sams  <- qry$dimnames[[1]]
+  r_sams  <- ref$dimnames[[1]]
+  samples <- NULL
+  if (!is.null(q_sams) || !is.null(r_sams))
+    samples <- c(
+      if (is.null(q_sams)) seq_len(qry$dim[[1]]) else q_sams, 
+      if (is.null(r_sams)) seq_len(ref$dim[[1]]) else r_sams )
+  
+  structure(
+    .Data = list(
+      i        = c(as.integer(qry$i), as.integer(ref$i) + as.integer(qry$dim[[1]])),
+      j        = c(as.integer(qry$j), as.integer(r_j)),
+      v        = c(qry$v, ref$v),
+      nrow     = as.integer(qry$dim[[1]] + ref$dim[[1]]),
+      ncol     = as.integer(if (is.null(otus)) qry$dim[[2]] else length(otus)),
+      dimnames = list(samples, otus) ),
+    class = 'simple_triplet_matrix' )
+}
@@ -0,0 +1,185 @@
+# Copyright (c) 2026 ecodive authors
+# Licensed under the MIT License: https://opensource.org/license/mit
+
+
+# Metrics that satisfy the triangle inequality. Each has the C
+# algorithm, a fixed normalization (or NULL to use `norm`), and
+# whether the C result is squared.
+VPTREE_METRICS <- list(
+  aitchison        = list(algorithm = BDIV_EUCLIDEAN,     norm = 'clr',     root = FALSE),
+  chebyshev        = list(algorithm = BDIV_CHEBYSHEV,     norm = NULL,      root = FALSE),
+  chord            = list(algorithm = BDIV_EUCLIDEAN,     norm = 'chord',   root = FALSE),
+  euclidean        = list(algorithm = BDIV_EUCLIDEAN,     norm = NULL,      root = FALSE),
+  hamming          = list(algorithm = BDIV_HAMMING,       norm = 'none',    root = FALSE),
+  hellinger        = list(algorithm = BDIV_SQUARED_CHORD, norm = 'percent', root = TRUE),
+  jaccard          = list(algorithm = BDIV_JACCARD,       norm = 'none',    root = FALSE),
+  jensen           = list(algorithm = BDIV_JSD,           norm = 'percent', root = TRUE),
+  manhattan        = list(algorithm = BDIV_MANHATTAN,     norm = NULL,      root = FALSE),
+  matusita         = list(algorithm = BDIV_SQUARED_CHORD, norm = 'percent', root = TRUE),
+  minkowski        = list(algorithm = BDIV_MINKOWSKI,     norm = NULL,      root = FALSE),
+  robust_aitchison = list(algorithm = BDIV_EUCLIDEAN,     norm = 'rclr',    root = FALSE) )
+
+
+
+#' Nearest-sample search with a vantage-point tree
+#' 
+#' Builds an index over a reference panel once, then finds the reference
+#' samples nearest to any number of query samples. For each query, the
+#' triangle inequality rules out most of the panel without computing its
+#' distance, so searches are much faster than `beta_div()` with `reference`
+#' on large panels.
+#' 
+#' The index is an ordinary list holding the reference counts and the tree,
+#' so it can be kept with `saveRDS()` and reloaded with `readRDS()`.
+#' 
+#' Only true metrics can be indexed: `'aitchison'`, `'chebyshev'`,
+#' `'chord'`, `'euclidean'`, `'hamming'`, `'hellinger'`, `'jaccard'`,
+#' `'jensen'`, `'manhattan'`, `'matusita'`, `'minkowski'` (with
+#' `power >= 1`), and `'robust_aitchison'`.
+#' 
+#' With CLR normalization, query features that are not in the reference are
+#' dropped, and the pseudocount is the one chosen when the index was built.
+#' 
+#' @inherit documentation
+#' 
+#' @name vptree
+#' 
+#' @param reference   The reference panel, in any format accepted by
+#'        `counts` except an ecomatrix file.
+#' 
+#' @param metric   The name of a beta diversity metric; see above. Flexible
+#'        matching is supported, as in `beta_div()`. Default: `'euclidean'`
+#' 
+#' @param index   An index returned by `vptree()`.
+#' 
+#' @param counts   The query samples, with the same features as the
+#'        reference. Features are matched by name.
+#' 
+#' @param k   How many of the nearest reference samples to return for each
+#'        query. Default: `NULL`
+#' 
+#' @param radius   Return every reference sample within this distance of
+#'        each query. When combined with `k`, only the `k` nearest of those
+#'        are returned. Default: `NULL`
+#' 
+#' @return `vptree()` returns an index of class `ecodive_vptree`.
+#' 
+#'         `vptree_query()` returns a list with elements `index` (positions
+#'         in the reference) and `distance`, sorted nearest-first. With `k`,
+#'         these are \eqn{k \times n} matrices with a column for each query,
+#'         padded with `NA`; with only `radius`, they are lists of vectors,
+#'         one for each query.
+#' 
+#' @export
+#' @examples
+#'     index <- vptree(ex_counts[1:3,], 'hellinger')
+#' 
+#'     # The reference sample nearest to the fourth sample
+#'     vptree_query(index, ex_counts[4,,drop=FALSE], k = 1)
+#' 
+#'     # All within a distance of 0.5
+#'     vptree_query(index, ex_counts, radius = 0.5)
+#' 
+vptree <- function (
+    reference,
+    metric      = 'euclidean',
+    margin      = 1L,
+    norm        = 'none',
+    pseudocount = NULL,
+    power       = 1.5,
+    cpus        = n_cpus() ) {
+  
+  metric <- match_metric(metric, div = 'beta')$id
+  spec   <- VPTREE_METRICS[[metric]]
+  
+  if (is.null(spec))
+    stop('`metric` must be a true metric: ', paste(collapse = ', ', names(VPTREE_METRICS)))
+  
+  if (!is.null(spec$norm)) norm <- spec$norm
+  
+  counts <- reference
+  validate_counts()
+  validate_margin()
+  validate_norm()
+  validate_pseudocount()
+  validate_power()
+  validate_cpus()
+  
+  if (metric == 'minkowski' && power < 1)
+    stop('`power` must be at least 1 for minkowski to be a metric.')
+  
+  trp <- as_triplets(counts, margin)
+  stm <- structure(
+    .Data = list(
+      i = as.integer(trp$i), j = as.integer(trp$j), v = trp$v,
+      nrow = as.integer(trp$dim[[1]]), ncol = as.integer(trp$dim[[2]]),
+      dimnames = trp$dimnames ),
+    class = 'simple_triplet_matrix' )
+  
+  tree <- .Call(
+    C_vptree_build, spec$algorithm, stm, norm, spec$root,
+    cpus, pseudocount, power )
+  
+  structure(
+    .Data = list(
+      metric      = metric,
+      algorithm   = spec$algorithm,
+      norm        = norm,
+      root        = spec$root,
+      pseudocount = pseudocount,
+      power       = power,
+      counts      = trp,
+      order       = tree$order,
+      radius      = tree$radius ),
+    class = 'ecodive_vptree' )
+}
+
+
+#' @rdname vptree
+#' @export
+vptree_query <- function (index, counts, k = NULL, radius = NULL, margin = 1L, cpus = n_cpus()) {
+  
+  if (!inherits(index, 'ecodive_vptree'))
+    stop('`index` must be an index created by vptree().')
+  
+  validate_counts()
+  validate_margin()
+  validate_k()
+  validate_radius()
+  validate_cpus()
+  
+  if (is.null(k) && is.null(radius))
+    stop('`k` or `radius` must be given.')
+  
+  ref <- index$counts
+  qry <- tryCatch(
+    as_triplets(counts, margin),
+    error = function (e) stop(e$message, '\n`counts` must be a valid numeric matrix.') )
+  
+  # CLR depends on the number of features, which must stay
+  # as it was when the tree was built.
+  otus <- qry$dimnames[[2]]
+  if (identical(index$norm, NORM_CLR) && !is.null(otus) && !is.null(ref$dimnames[[2]])) {
+    kept <- which(otus %in% ref$dimnames[[2]])
+    keep <- qry$j %in% kept
+    qry  <- list(
+      i = qry$i[keep], j = match(qry$j[keep], kept), v = qry$v[keep],
+      dim = c(qry$dim[[1]], length(kept)), dimnames = list(qry$dimnames[[1]], otus[kept]) )
+  }
+  
+  stm <- tryCatch(
+    stack_triplets(qry, ref),
+    error = function (e) stop(e$message, '\n`counts` must have the same features as the reference.') )
+  
+  .Call(
+    C_vptree_query, index$algorithm, stm, index$norm, index$root,
+    as.integer(qry$dim[[1]]), index$order, index$radius, k, radius,
+    cpus, index$pseudocount, index$power )
+}
+
+
+#' @export
+print.ecodive_vptree <- function (x, ...) {
+  cat('VP-tree index of', length(x$order), 'samples by', x$metric, 'distance\n')
+  invisible(x)
+}
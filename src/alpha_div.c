@@ -18,12 +18,14 @@
 #define ADIV_SIMPSON     13
 #define ADIV_SQUARES     14
 
-static int     n_samples;
-static int    *pos_vec;
-static int    *otu_vec;
-static double *val_vec;
-static SEXP   *sexp_extra;
-static double *result_vec;
+static int       n_samples;
+static R_xlen_t *pos_vec;
+static int      *otu_vec;
+static int      *otu_map; // tree tip of each OTU, or NULL
+static double   *val_vec;
+static int      *int_vec;
+static SEXP     *sexp_extra;
+static double   *result_vec;
 
 /*
  * FOREACH_SAMPLE iterates over all samples, ensuring that each 
@@ -36,10 +38,10 @@ static double *result_vec;
     int n_threads = ((worker_t *)arg)->n;                      \
                                                                \
     for (; sample < n_samples; sample += n_threads) {          \
-      double *val_begin = val_vec + pos_vec[sample];           \
-      double *val_end   = val_vec + pos_vec[sample + 1];       \
-      int     nnz       = val_end - val_begin;                 \
-      double result     = 0;                                   \
+      R_xlen_t pos_begin = pos_vec[sample];                    \
+      R_xlen_t pos_end   = pos_vec[sample + 1];                \
+      int      nnz       = (int)(pos_end - pos_begin);         \
+      double result    = 0;                                    \
       if (nnz) {                                               \
         expression;                                            \
       }                                                        \
@@ -52,13 +54,24 @@ static double *result_vec;
 
 /*
  * FOREACH_VAL iterates over each value for the current sample.
- * Sets val to point to each value in val_vec in turn.
+ * Sets val to point to each value in val_vec in turn. Integer
+ * counts are read from int_vec and presented through a double,
+ * so expressions like `*val * *val` can't overflow.
  */
 #define FOREACH_VAL(expression)                                \
   do {                                                         \
-    double *val = val_begin;                                   \
-    for (; val != val_end; val++) {                            \
-      expression;                                              \
+    if (int_vec) {                                             \
+      for (R_xlen_t k = pos_begin; k < pos_end; k++) {         \
+        double  cnt = int_vec[k];                              \
+        double *val = &cnt;                                    \
+        expression;                                            \
+      }                                                        \
+    }                                                          \
+    else {                                                     \
+      double *val = val_vec + pos_begin;                       \
+      for (; val != val_vec + pos_end; val++) {                \
+        expression;                                            \
+      }                                                        \
     }                                                          \
   } while (0)
 
@@ -201,12 +214,12 @@ static void *faith(void *arg) {
     
     memset(has_edge_vec, 0, n_edges * sizeof(char));
     
-    int *otu_begin = otu_vec + pos_vec[sample];
-    int *otu_end   = otu_vec + pos_vec[sample + 1];
+    int *otu_begin = otu_vec + pos_begin;
+    int *otu_end   = otu_vec + pos_end;
     
     for (int *otu = otu_begin; otu != otu_end; otu++) {
       
-      int node_i = *otu;    // start at OTU tip/leaf in tree
+      int node_i = otu_map ? otu_map[*otu] : *otu; // OTU tip/leaf in tree
       while (node_i > -1) { // traverse until we hit the tree's root
         
         node_t *node   = node_vec + node_i;
@@ -447,29 +460,39 @@ static void *squares(void *arg) {
 // R interface. Distributes work across threads.
 //======================================================
 SEXP C_alpha_div(
-    SEXP sexp_algorithm, SEXP sexp_otu_mtx, 
-    SEXP sexp_margin,    SEXP sexp_norm, 
-    SEXP sexp_n_threads, SEXP sexp_extra_args ) {
+    SEXP sexp_algorithm,     SEXP sexp_otu_mtx, 
+    SEXP sexp_margin,        SEXP sexp_min_prevalence, 
+    SEXP sexp_min_abundance, SEXP sexp_norm, 
+    SEXP sexp_n_threads,     SEXP sexp_extra_args ) {
   
   init_n_ptrs(10);
   
+  int algorithm  = asInteger(sexp_algorithm);
   int norm       = asInteger(sexp_norm);
+  int min_prevalence   = asInteger(sexp_min_prevalence);
+  double min_abundance = asReal(sexp_min_abundance);
   int n_threads  = asInteger(sexp_n_threads);
   sexp_extra     = &sexp_extra_args;
   
-  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin);
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
+  
+  // Richness estimators extrapolate from the rare features.
+  if (algorithm != ADIV_ACE && algorithm != ADIV_CHAO1)
+    prune_otus(em, min_prevalence, min_abundance);
   if (norm) normalize(em, norm, n_threads, 0);
   
   n_samples = em->n_samples;
   pos_vec   = em->pos_vec;
   otu_vec   = em->otu_vec;
+  otu_map   = em->otu_map;
   val_vec   = em->val_vec;
+  int_vec   = em->int_vec;
   
   
   // function to run
   // void * (*adiv_func)(void *) = NULL;
   pthread_func_t adiv_func = NULL;
-  switch (asInteger(sexp_algorithm)) {
+  switch (algorithm) {
     case ADIV_ACE:         adiv_func = ace_setup(n_threads);   break;
     case ADIV_BERGER:      adiv_func = berger;                 break;
     case ADIV_BRILLOUIN:   adiv_func = brillouin;              break;
@@ -29,17 +29,23 @@
 #define BDIV_SQUARED_CHORD 23
 #define BDIV_WAVE_HEDGES   24
 
-static int     n_samples;
-static int     n_otus;
-static int     n_dist;
-static int     n_pairs;
-static int    *pos_vec;
-static int    *otu_vec;
-static double *val_vec;
-static double *clr_vec;
-static int    *pairs_vec;
-static double *dist_vec;
-static SEXP   *sexp_extra;
+static int       n_samples;
+static int       n_otus;
+static R_xlen_t  n_dist;
+static R_xlen_t  n_pairs;
+static R_xlen_t *pos_vec;
+static int      *otu_vec;
+static double   *val_vec;
+static int      *int_vec;
+static float    *flt_vec;   // single-precision values, or NULL
+static double   *clr_vec;
+static R_xlen_t *pair_vec;  // sorted 0-based pair indices, or NULL
+static int       pair_spec; // pairs come from pair_spec_next()
+static int       n_query;   // query samples, ahead of the reference; or 0
+static int      *pair_list; // sam_i, sam_j of each listed pair, or NULL
+static double   *dist_vec;  // NULL when keeping k nearest neighbors
+static float    *dist_flt;  // a float32 file's values, or NULL
+static SEXP     *sexp_extra;
 
 
 /*
@@ -47,20 +53,75 @@ static SEXP   *sexp_extra;
  * samples. Skips unwanted pairings and pairings not assigned to 
  * the current thread. Ensures all threads process the same 
  * number of pairs. The code should assign to `distance`.
+ * Distance indices are R_xlen_t, since more than 46,341 samples
+ * give more than 2^31 pairs. With n_query, the first n_query 
+ * samples are compared to the rest, filling a column-major
+ * n_query x n_ref matrix instead. Without dist_vec, each
+ * distance is offered to the k-nearest-neighbor heaps. With
+ * pair_list, each listed pair's distance goes to the same
+ * position in dist_vec. Requested `pairs` are sorted, and
+ * each thread takes one contiguous batch of them, so a row's
+ * sample i is decoded once and stays in cache. A pair
+ * specification is expanded row by row as it is walked, each
+ * thread taking every n_threads-th row.
  * 
  * The FOREACH_OTU macro iterates through all OTU abundances for 
  * a given pair of samples, assigning the values to `x` and `y`.
+ * With CLR, OTUs absent from both samples are not zero; they are
+ * visited once each, n_otus in all. FOREACH_OTU_ZEROS instead 
+ * runs `zeros` once with `n_zeros` set to their count, for 
+ * kernels that have a closed form.
+ * Integer counts are read directly from int_vec, and single-
+ * precision values from flt_vec; the expression is compiled
+ * once for each storage type by MERGE_OTUS. Sums are always
+ * accumulated in double.
  * 
  * Implemented as macros to avoid the overhead of a function
  * call or the messiness of duplicated code.
  */
+#define STORE_DISTANCE(idx)                                    \
+  if      (dist_flt) { dist_flt[idx] = (float)distance;      } \
+  else if (dist_vec) { dist_vec[idx] = distance;             } \
+  else               { knn_add(thread_i, sam_i, sam_j, distance); }
+
 #define FOREACH_PAIR(expression)                               \
   do {                                                         \
     int thread_i  = ((worker_t *)arg)->i;                      \
     int n_threads = ((worker_t *)arg)->n;                      \
-    int dist_idx  = 0;                                         \
+    R_xlen_t dist_idx = 0;                                     \
+                                                               \
+    if (pair_list) { /* Listed Pairs of Samples */             \
+                                                               \
+      R_xlen_t pair_idx = thread_i;                            \
+      for (; pair_idx < n_pairs; pair_idx += n_threads) {      \
+                                                               \
+        int sam_i = pair_list[2 * pair_idx];                   \
+        int sam_j = pair_list[2 * pair_idx + 1];               \
+                                                               \
+        double distance = 0;                                   \
+                                                               \
+        expression;                                            \
+                                                               \
+        dist_vec[pair_idx] = distance;                         \
+      }                                                        \
+                                                               \
+    } else if (n_query) { /* Query vs Reference */             \
+                                                               \
+      for (int sam_j = n_query; sam_j < n_samples; sam_j++) {  \
+        for (int sam_i = 0; sam_i < n_query; sam_i++) {        \
+          if (dist_idx % n_threads == thread_i) {              \
+                                                               \
+            double distance = 0;                               \
                                                                \
-    if (pairs_vec == NULL) { /* All vs All */                  \
+            expression;                                        \
+                                                               \
+            STORE_DISTANCE(dist_idx);                          \
+          }                                                    \
+          dist_idx++;                                          \
+        }                                                      \
+      }                                                        \
+                                                               \
+    } else if (!pair_vec && !pair_spec) { /* All vs All */     \
                                                                \
       for (int sam_i = 0; sam_i < n_samples - 1; sam_i++) {    \
         for (int sam_j = sam_i + 1; sam_j < n_samples; sam_j++) {\
@@ -70,49 +131,64 @@ static SEXP   *sexp_extra;
                                                                \
             expression;                                        \
                                                                \
-            dist_vec[dist_idx] = distance;                     \
+            STORE_DISTANCE(dist_idx);                          \
           }                                                    \
           dist_idx++;                                          \
         }                                                      \
       }                                                        \
                                                                \
-    } else { /* Specific Pairs of Samples */                   \
+    } else if (pair_spec) { /* Pairs from a Specification */   \
                                                                \
-      int pair_idx = thread_i;                                 \
-      for (; pair_idx < n_pairs; pair_idx += n_threads) {      \
+      for (int sam_i = thread_i; sam_i < n_samples - 1; sam_i += n_threads) { \
+        int sam_j = pair_spec_next(sam_i, sam_i);              \
+        for (; sam_j < n_samples; sam_j = pair_spec_next(sam_i, sam_j)) { \
                                                                \
-        dist_idx = pairs_vec[pair_idx]; /* 1-based */          \
+          double distance = 0;                                 \
                                                                \
-        int sam_i          = 0;                                \
-        int sam_j          = dist_idx;                         \
-        int pairs_in_block = n_samples - 1;                    \
+          expression;                                          \
                                                                \
-        while (sam_j > pairs_in_block) {                       \
-          sam_i++;                                             \
-          sam_j -= pairs_in_block;                             \
-          pairs_in_block--;                                    \
+          STORE_DISTANCE(PAIR_ROW_START(sam_i, n_samples) + sam_j - sam_i - 1); \
         }                                                      \
+      }                                                        \
                                                                \
-        sam_j += sam_i;                                        \
+    } else { /* Specific Pairs, Sorted by Row */               \
+                                                               \
+      R_xlen_t block     = n_pairs / n_threads + 1;            \
+      R_xlen_t pair_idx  = block * thread_i;                   \
+      R_xlen_t pair_end  = pair_idx + block < n_pairs ? pair_idx + block : n_pairs; \
+      R_xlen_t row_start = 0, row_end = 0;                     \
+      int      sam_i     = 0;                                  \
+                                                               \
+      for (; pair_idx < pair_end; pair_idx++) {                \
+                                                               \
+        dist_idx = pair_vec[pair_idx];                         \
+                                                               \
+        if (dist_idx >= row_end) {                             \
+          sam_i     = pair_row(dist_idx, n_samples);           \
+          row_start = PAIR_ROW_START(sam_i, n_samples);        \
+          row_end   = row_start + n_samples - sam_i - 1;       \
+        }                                                      \
+                                                               \
+        int sam_j = sam_i + 1 + (int)(dist_idx - row_start);   \
                                                                \
         double distance = 0;                                   \
                                                                \
         expression;                                            \
                                                                \
-        dist_vec[dist_idx - 1] = distance;                     \
+        STORE_DISTANCE(dist_idx);                              \
       }                                                        \
     }                                                          \
   } while (0)
 
 
-#define FOREACH_OTU(expression)                                \
+#define MERGE_OTUS(T, vals, expression, zeros)                 \
   do {                                                         \
     int    *i      = otu_vec + pos_vec[sam_i];                 \
     int    *j      = otu_vec + pos_vec[sam_j];                 \
     int    *i_end  = otu_vec + pos_vec[sam_i + 1];             \
     int    *j_end  = otu_vec + pos_vec[sam_j + 1];             \
-    double *val_i  = val_vec + pos_vec[sam_i];                 \
-    double *val_j  = val_vec + pos_vec[sam_j];                 \
+    T      *val_i  = vals + pos_vec[sam_i];                    \
+    T      *val_j  = vals + pos_vec[sam_j];                    \
     double  x_zero = clr_vec ? clr_vec[sam_i] : 0;             \
     double  y_zero = clr_vec ? clr_vec[sam_j] : 0;             \
     int     otu = 0, n_ops = 0;                                \
@@ -152,16 +228,26 @@ static SEXP   *sexp_extra;
       expression;                                              \
     }                                                          \
     if (clr_vec) { /* Double zeros */                          \
+      double n_zeros = n_otus - n_ops;                         \
       x = x_zero, y = y_zero;                                  \
-      while (n_ops < n_otus) {                                 \
-        n_ops++;                                               \
-        expression;                                            \
-      }                                                        \
+      zeros;                                                   \
     }                                                          \
     (void)otu;                                                 \
   } while (0)
 
 
+#define FOREACH_OTU_ZEROS(expression, zeros)                   \
+  do {                                                         \
+    if      (int_vec) { MERGE_OTUS(int,    int_vec, expression, zeros); } \
+    else if (flt_vec) { MERGE_OTUS(float,  flt_vec, expression, zeros); } \
+    else              { MERGE_OTUS(double, val_vec, expression, zeros); } \
+  } while (0)
+
+
+#define FOREACH_OTU(expression)                                \
+  FOREACH_OTU_ZEROS(expression, for (; n_zeros > 0; n_zeros--) { expression; })
+
+
 #define WITH_ABJ(expression)                                   \
   do {                                                         \
     int *i     = otu_vec + pos_vec[sam_i];                     \
@@ -186,8 +272,6 @@ static SEXP   *sexp_extra;
 
 
 
-
-
 //======================================================
 // Bhattacharyya
 // -log(sum(sqrt(x * y)))
@@ -215,9 +299,12 @@ static void *bray(void *arg) {
     double diffs = 0;
     double sums  = 0;
     
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       sums  += x + y;
       diffs += fabs(x - y);
+      ,
+      sums  += n_zeros * (x + y);
+      diffs += n_zeros * fabs(x - y);
     );
   
     distance = diffs / sums;
@@ -235,7 +322,10 @@ static void *bray(void *arg) {
 //======================================================
 static void *canberra(void *arg) {
   FOREACH_PAIR(
-    FOREACH_OTU(distance += fabs(x - y) / (x + y));
+    FOREACH_OTU_ZEROS(
+      distance += fabs(x - y) / (x + y),
+      distance += n_zeros * fabs(x - y) / (x + y)
+    );
   );
   
   return NULL;
@@ -248,9 +338,11 @@ static void *canberra(void *arg) {
 //======================================================
 static void *chebyshev(void *arg) {
   FOREACH_PAIR(
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       double d = fabs(x - y);
       if (d > distance) distance = d;
+      ,
+      if (n_zeros && fabs(x - y) > distance) distance = fabs(x - y);
     );
   );
   
@@ -265,9 +357,12 @@ static void *chebyshev(void *arg) {
 static void *clark(void *arg) {
   FOREACH_PAIR(
     
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       double d = (x - y) / (x + y);
       distance += d * d;
+      ,
+      double d = (x - y) / (x + y);
+      distance += n_zeros * d * d;
     );
   
     distance = sqrt(distance);
@@ -284,10 +379,14 @@ static void *clark(void *arg) {
 static void *divergence(void *arg) {
   FOREACH_PAIR(
     
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       double diff = x - y;
       double sum  = x + y;
       distance += (diff * diff) / (sum * sum);
+      ,
+      double diff = x - y;
+      double sum  = x + y;
+      distance += n_zeros * (diff * diff) / (sum * sum);
     );
   
     distance = 2 * distance;
@@ -304,9 +403,12 @@ static void *divergence(void *arg) {
 static void *euclidean(void *arg) {
   FOREACH_PAIR(
     
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       double d = x - y;
       distance += d * d;
+      ,
+      double d = x - y;
+      distance += n_zeros * d * d;
     );
   
     distance = sqrt(distance);
@@ -343,44 +445,50 @@ static void *gower(void *arg) {
   return NULL;
 }
 
-static pthread_func_t gower_setup(void) {
-  
-  gower_range_vec = (double*) safe_malloc(n_otus * sizeof(double));
-  double *min_vec = (double*) safe_malloc(n_otus * sizeof(double));
-  double *max_vec = (double*) safe_malloc(n_otus * sizeof(double));
-  int    *obs_vec = (int*)    safe_malloc(n_otus * sizeof(int));
-  
-  memset(min_vec, 0, n_otus * sizeof(double));
-  memset(max_vec, 0, n_otus * sizeof(double));
-  memset(obs_vec, 0, n_otus * sizeof(int));
-  
-  
-  // Initialize min to first sample's values.
-  for (int i = 0; i < pos_vec[1]; i++) {
-    min_vec[otu_vec[i]] = val_vec[i];
-  }
+// Each OTU's range across all samples, from the CSC view.
+// Absent OTUs count as zero, as do min values for OTUs
+// not in the first sample.
+static ecomatrix_t *gower_em;
+
+static void *gower_range(void *arg) {
   
-  // Search for min/max values across all samples.
-  for (int i = 0; i < pos_vec[n_samples]; i++) {
-    int    otu = otu_vec[i];
-    double val = val_vec[i];
-    obs_vec[otu]++;
-    if (val < min_vec[otu]) min_vec[otu] = val;
-    if (val > max_vec[otu]) max_vec[otu] = val;
-  }
+  int       thread_i    = ((worker_t *)arg)->i;
+  int       n_threads   = ((worker_t *)arg)->n;
+  R_xlen_t *csc_pos_vec = gower_em->csc_pos_vec;
+  int      *csc_sam_vec = gower_em->csc_sam_vec;
+  double   *csc_val_vec = gower_em->csc_val_vec;
   
-  // Assign final range values
-  for (int otu = 0; otu < n_otus; otu++) {
-    if (obs_vec[otu] < n_samples) {
-      gower_range_vec[otu] = max_vec[otu];
+  for (int otu = thread_i; otu < n_otus; otu += n_threads) {
+    
+    R_xlen_t begin = csc_pos_vec[otu];
+    R_xlen_t end   = csc_pos_vec[otu + 1];
+    double   min   = (begin < end && csc_sam_vec[begin] == 0) ? csc_val_vec[begin] : 0;
+    double   max   = 0;
+    
+    for (R_xlen_t i = begin; i < end; i++) {
+      double val = csc_val_vec[i];
+      if (val < min) min = val;
+      if (val > max) max = val;
+    }
+    
+    if (end - begin < n_samples) {
+      gower_range_vec[otu] = max;
     } else {
-      gower_range_vec[otu] = max_vec[otu] - min_vec[otu];
+      gower_range_vec[otu] = max - min;
     }
   }
   
-  free_one(min_vec);
-  free_one(max_vec);
-  free_one(obs_vec);
+  return NULL;
+}
+
+static pthread_func_t gower_setup(ecomatrix_t *em, int n_threads) {
+  
+  build_csc(em, n_threads);
+  
+  gower_em        = em;
+  gower_range_vec = (double*) safe_malloc(n_otus * sizeof(double));
+  
+  run_parallel(gower_range, n_threads, n_otus);
   
   return gower;
 }
@@ -413,12 +521,18 @@ static void *horn(void *arg) {
     double sum_x2 = 0;
     double sum_y2 = 0;
     
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       distance += x * y;
       sum_x    += x;
       sum_y    += y;
       sum_x2   += x * x;
       sum_y2   += y * y;
+      ,
+      distance += n_zeros * x * y;
+      sum_x    += n_zeros * x;
+      sum_y    += n_zeros * y;
+      sum_x2   += n_zeros * x * x;
+      sum_y2   += n_zeros * y * y;
     );
     
     sum_x2 /= sum_x * sum_x;
@@ -471,7 +585,10 @@ static void *jsd(void *arg) {
 static void *lorentzian(void *arg) {
   
   FOREACH_PAIR(
-    FOREACH_OTU(distance += log(1 + fabs(x - y)));
+    FOREACH_OTU_ZEROS(
+      distance += log(1 + fabs(x - y)),
+      distance += n_zeros * log(1 + fabs(x - y))
+    );
   );
   
   return NULL;
@@ -485,7 +602,10 @@ static void *lorentzian(void *arg) {
 static void *manhattan(void *arg) {
   
   FOREACH_PAIR(
-    FOREACH_OTU(distance += fabs(x - y));
+    FOREACH_OTU_ZEROS(
+      distance += fabs(x - y),
+      distance += n_zeros * fabs(x - y)
+    );
   );
   
   return NULL;
@@ -495,6 +615,8 @@ static void *manhattan(void *arg) {
 //======================================================
 // Minkowski
 // sum(abs(x - y)^p) ^ (1/p)
+// p = 1 and p = 2 are Manhattan and Euclidean, and p = 3
+// is multiplied out; other powers call pow() per OTU.
 //======================================================
 static void *minkowski(void *arg) {
   
@@ -503,7 +625,10 @@ static void *minkowski(void *arg) {
   
   FOREACH_PAIR(
     
-    FOREACH_OTU(distance += pow(fabs(x - y), power));
+    FOREACH_OTU_ZEROS(
+      distance += pow(fabs(x - y), power),
+      distance += n_zeros * pow(fabs(x - y), power)
+    );
   
     distance = pow(distance, inv_power);
   );
@@ -511,6 +636,35 @@ static void *minkowski(void *arg) {
   return NULL;
 }
 
+static void *minkowski_3(void *arg) {
+  
+  FOREACH_PAIR(
+    
+    FOREACH_OTU_ZEROS(
+      double d = fabs(x - y);
+      distance += d * d * d;
+      ,
+      double d = fabs(x - y);
+      distance += n_zeros * d * d * d;
+    );
+  
+    distance = cbrt(distance);
+  );
+  
+  return NULL;
+}
+
+static pthread_func_t minkowski_setup(void) {
+  
+  double power = asReal(*sexp_extra);
+  
+  if (power == 1) return manhattan;
+  if (power == 2) return euclidean;
+  if (power == 3) return minkowski_3;
+  
+  return minkowski;
+}
+
 
 //======================================================
 // Morisita
@@ -556,9 +710,12 @@ static void *motyka(void *arg) {
     
     double sums = 0;
   
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       distance += (x > y) ? x : y;
       sums     += x + y;
+      ,
+      distance += n_zeros * ((x > y) ? x : y);
+      sums     += n_zeros * (x + y);
     );
     
     distance /= sums;
@@ -606,9 +763,12 @@ static void *soergel(void *arg) {
     double min_sum = 0;
     double max_sum = 0;
   
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       if (x < y) { min_sum += x; max_sum += y; } 
       else       { min_sum += y; max_sum += x; }
+      ,
+      if (x < y) { min_sum += n_zeros * x; max_sum += n_zeros * y; } 
+      else       { min_sum += n_zeros * y; max_sum += n_zeros * x; }
     );
     
     distance = 1 - (min_sum / max_sum);
@@ -659,9 +819,12 @@ static void *squared_chord(void *arg) {
 static void *wave_hedges(void *arg) {
   
   FOREACH_PAIR(
-    FOREACH_OTU(
+    FOREACH_OTU_ZEROS(
       if (x > y) { distance += (x - y) / x; }
       else       { distance += (y - x) / y; }
+      ,
+      if (x > y) { distance += n_zeros * (x - y) / x; }
+      else       { distance += n_zeros * (y - x) / y; }
     );
   );
   
@@ -671,60 +834,584 @@ static void *wave_hedges(void *arg) {
 
 
 //======================================================
-// R interface. Distributes work across threads.
+// Kernels over shared OTUs.
+// 
+// Several metrics reduce to per-sample totals plus one
+// sum over the OTUs that two samples share:
+//   Bray     sum(x) + sum(y) - 2 * sum(min(x, y))
+//   Motyka   sum(max) = sum(x) + sum(y) - sum(min)
+//   Soergel  sum(min) / sum(max)
+//   Jaccard, Sorensen, Ochiai: shared count; nnz(x), nnz(y)
+//   Horn, Morisita: sum(x * y); sum(x^2), sum(x * (x - 1))
+// The totals are found once per sample, and each pair then
+// visits only the intersection of its OTU lists. When one
+// list is much longer, it is galloped over rather than
+// walked.
+// 
+// Metrics built on sqrt() or log() also cache a transform
+// of every value, so that an OTU in only one sample costs
+// nothing and a shared OTU at most one call:
+//   Bhattacharyya   -log(sum(sqrt(x) * sqrt(y)))
+//   Squared Chord   sum(x) + sum(y) - 2 * sum(sqrt(x) * sqrt(y))
+//   JSD             log(2) * (sum(x) + sum(y)) / 2 + sum(x log x
+//                   + y log y - (x+y) log(x+y)) / 2
+//   Lorentzian      sum(log1p(x)) + sum(log1p(y)) + sum(log1p(
+//                   abs(x-y)) - log1p(x) - log1p(y))
 //======================================================
-SEXP C_beta_div(
-    SEXP sexp_algorithm,   SEXP sexp_otu_mtx,   
-    SEXP sexp_margin,      SEXP sexp_norm, 
-    SEXP sexp_pairs_vec,   SEXP sexp_n_threads, 
-    SEXP sexp_pseudocount, SEXP sexp_extra_args ) {
+
+#define TOT_SUM 0 // sum(x)
+#define TOT_SQ  1 // sum(x^2)
+#define TOT_SIM 2 // sum(x * (x - 1))
+#define TOT_MIN 3 // min(x, 0)
+#define TOT_TFM 4 // sum(tfm_vec)
+#define TOT_N   5
+
+#define SHARED_MIN   0
+#define SHARED_DOT   1
+#define SHARED_COUNT 2
+#define SHARED_ROOT  3 // tfm_vec = sqrt(x)
+#define SHARED_XLOGX 4 // tfm_vec = x * log(x)
+#define SHARED_LOG1P 5 // tfm_vec = log1p(abs(x))
+
+// Gallop through the longer list past this length ratio.
+#define GALLOP_RATIO 8
+
+static int     shared_algorithm;
+static int     shared_kind;
+static double *tot_mtx; // TOT_N totals per sample
+static double *tfm_vec; // transformed values, or NULL
+
+// Stored zeros are kept, and 0 * log(0) would be NaN.
+static double xlogx (double x) {
+  return x > 0 ? x * log(x) : 0;
+}
+
+static double shared_transform (double x) {
+  switch (shared_kind) {
+    case SHARED_ROOT:  return sqrt(x);
+    case SHARED_XLOGX: return xlogx(x);
+  }
+  return log1p(fabs(x)); // SHARED_LOG1P
+}
+
+static void *calc_totals(void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int sam = thread_i; sam < n_samples; sam += n_threads) {
+    double *tot = tot_mtx + (size_t)sam * TOT_N;
+    tot[TOT_SUM] = tot[TOT_SQ] = tot[TOT_SIM] = tot[TOT_MIN] = tot[TOT_TFM] = 0;
+    for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++) {
+      double x = int_vec ? int_vec[i] : val_vec[i];
+      tot[TOT_SUM] += x;
+      tot[TOT_SQ]  += x * x;
+      tot[TOT_SIM] += x * (x - 1);
+      if (x < tot[TOT_MIN]) tot[TOT_MIN] = x;
+      if (tfm_vec) {
+        tfm_vec[i]    = shared_transform(x);
+        tot[TOT_TFM] += tfm_vec[i];
+      }
+    }
+  }
   
-  int norm        = asInteger(sexp_norm);
-  int pseudocount = asReal(sexp_pseudocount);
-  int n_threads   = asInteger(sexp_n_threads);
-  sexp_extra      = &sexp_extra_args;
-  init_n_ptrs(10);
+  return NULL;
+}
+
+// Distance between two samples given their shared sum `s`.
+static double shared_distance (int sam_i, int sam_j, double s) {
+  
+  double *tot_i = tot_mtx + (size_t)sam_i * TOT_N;
+  double *tot_j = tot_mtx + (size_t)sam_j * TOT_N;
+  double  Sx    = tot_i[TOT_SUM];
+  double  Sy    = tot_j[TOT_SUM];
+  double  A     = (double)(pos_vec[sam_i + 1] - pos_vec[sam_i]);
+  double  B     = (double)(pos_vec[sam_j + 1] - pos_vec[sam_j]);
+  
+  switch (shared_algorithm) {
+    case BDIV_BRAY:     return (Sx + Sy - 2 * s) / (Sx + Sy);
+    case BDIV_MOTYKA:   return (Sx + Sy - s) / (Sx + Sy);
+    case BDIV_SOERGEL:  return 1 - s / (Sx + Sy - s);
+    case BDIV_JACCARD:  return (A + B - 2 * s) / (A + B - s);
+    case BDIV_SORENSEN: return 1 - (2 * s) / (A + B);
+    case BDIV_OCHIAI:   return 1 - s / sqrt(A * B);
+    case BDIV_HORN: {
+      double z = tot_i[TOT_SQ] / (Sx * Sx) + tot_j[TOT_SQ] / (Sy * Sy);
+      return 1 - (2 * s) / (z * Sx * Sy);
+    }
+    case BDIV_BHATTACHARYYA: return -1 * log(s);
+    case BDIV_LORENTZIAN:    return tot_i[TOT_TFM] + tot_j[TOT_TFM] + s;
+    
+    // Rounding can leave identical samples just below zero.
+    case BDIV_SQUARED_CHORD: {
+      double d = Sx + Sy - 2 * s;
+      return d < 0 ? 0 : d;
+    }
+    case BDIV_JSD: {
+      double d = (log(2.0) * (Sx + Sy) + s) / 2;
+      return d < 0 ? 0 : d;
+    }
+  }
   
-  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin);
-  if (norm) normalize(em, norm, n_threads, pseudocount);
+  // BDIV_MORISITA
+  double z = tot_i[TOT_SIM] / (Sx * (Sx - 1)) + tot_j[TOT_SIM] / (Sy * (Sy - 1));
+  return 1 - (2 * s) / (z * Sx * Sy);
+}
+
+
+/*
+ * SHARED_OTUS runs `expression` for each OTU present in both 
+ * sam_i and sam_j, with their values in `x` and `y`, and their
+ * positions in val_vec and tfm_vec in `pos_x` and `pos_y`.
+ * Every shared term is symmetric, so the shorter list is
+ * always `a`.
+ */
+#define SHARED_OTUS(T, vals, expression)                       \
+  do {                                                         \
+    int *a     = otu_vec + pos_vec[sam_i];                     \
+    int *a_end = otu_vec + pos_vec[sam_i + 1];                 \
+    int *b     = otu_vec + pos_vec[sam_j];                     \
+    int *b_end = otu_vec + pos_vec[sam_j + 1];                 \
+    R_xlen_t pos_a = pos_vec[sam_i];                           \
+    R_xlen_t pos_b = pos_vec[sam_j];                           \
+    if (a_end - a > b_end - b) {                               \
+      int *t = a; a = b; b = t; t = a_end; a_end = b_end; b_end = t; \
+      R_xlen_t tp = pos_a; pos_a = pos_b; pos_b = tp;          \
+    }                                                          \
+    int *a_begin = a, *b_begin = b;                            \
+    R_xlen_t pos_x = 0, pos_y = 0;                             \
+    double x, y;                                               \
+                                                               \
+    if (b_end - b > GALLOP_RATIO * (a_end - a)) {              \
+      for (; a != a_end && b != b_end; a++) {                  \
+        if (*b < *a) { /* gallop to the first b >= *a */       \
+          ptrdiff_t step = 1;                                  \
+          int *lo = b;                                         \
+          while (step < b_end - lo && lo[step] < *a) {         \
+            lo += step; step *= 2;                             \
+          }                                                    \
+          int *hi = (step < b_end - lo) ? lo + step : b_end;   \
+          while (hi - lo > 1) {                                \
+            int *mid = lo + (hi - lo) / 2;                     \
+            if (*mid < *a) { lo = mid; } else { hi = mid; }    \
+          }                                                    \
+          b = hi;                                              \
+        }                                                      \
+        if (b != b_end && *b == *a) {                          \
+          pos_x = pos_a + (a - a_begin);                       \
+          pos_y = pos_b + (b - b_begin);                       \
+          x = vals[pos_x];                                     \
+          y = vals[pos_y];                                     \
+          expression;                                          \
+          b++;                                                 \
+        }                                                      \
+      }                                                        \
+    }                                                          \
+    else {                                                     \
+      while (a != a_end && b != b_end) {                       \
+        if      (*a < *b) { a++; }                             \
+        else if (*a > *b) { b++; }                             \
+        else {                                                 \
+          pos_x = pos_a + (a - a_begin);                       \
+          pos_y = pos_b + (b - b_begin);                       \
+          x = vals[pos_x];                                     \
+          y = vals[pos_y];                                     \
+          expression;                                          \
+          a++; b++;                                            \
+        }                                                      \
+      }                                                        \
+    }                                                          \
+    (void)x; (void)y; (void)pos_x; (void)pos_y;                \
+  } while (0)
+
+
+#define FOREACH_SHARED(expression)                             \
+  do {                                                         \
+    if      (int_vec) { SHARED_OTUS(int,    int_vec, expression); } \
+    else if (flt_vec) { SHARED_OTUS(float,  flt_vec, expression); } \
+    else              { SHARED_OTUS(double, val_vec, expression); } \
+  } while (0)
+
+
+static void *shared_min(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += (x < y) ? x : y);
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+static void *shared_dot(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += x * y);
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+static void *shared_count(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += 1);
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+static void *shared_root(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += tfm_vec[pos_x] * tfm_vec[pos_y]);
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+static void *shared_xlogx(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += tfm_vec[pos_x] + tfm_vec[pos_y] - xlogx(x + y));
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+static void *shared_log1p(void *arg) {
+  FOREACH_PAIR(
+    double s = 0;
+    FOREACH_SHARED(s += log1p(fabs(x - y)) - tfm_vec[pos_x] - tfm_vec[pos_y]);
+    distance = shared_distance(sam_i, (int)sam_j, s);
+  );
+  return NULL;
+}
+
+
+
+//======================================================
+// Inverted index engine for all-vs-all distances.
+// 
+// Walking each OTU's posting list in the CSC view finds
+// the shared sums for all pairs at once: sum(len^2)/2
+// steps in all, rather than about n_samples * nnz for
+// pairwise intersections.
+// 
+// Each thread owns every n_threads-th row of dist_vec.
+// For each OTU in the row's sample, it adds that OTU's
+// contribution for every later sample in the posting
+// list, then finishes the row from the totals. Rows stay
+// in cache, and no locks are needed. For a float file, a
+// row is summed in a per-thread double buffer instead.
+//======================================================
+
+// A posting-list step (a scattered write) costs about as
+// much as two merge steps; measured on dense tables.
+#define INV_COST_RATIO 2
+
+static ecomatrix_t *inv_em;
+static double      *csc_tfm_vec; // tfm_vec in CSC order, or NULL
+static double      *inv_row_mtx; // a row per thread, for dist_flt
+
+static void *calc_csc_transform(void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int otu = thread_i; otu < n_otus; otu += n_threads)
+    for (R_xlen_t i = inv_em->csc_pos_vec[otu]; i < inv_em->csc_pos_vec[otu + 1]; i++)
+      csc_tfm_vec[i] = shared_transform(inv_em->csc_val_vec[i]);
+  
+  return NULL;
+}
+
+// INV_ROW(sam) + sam_j is the dist_vec index of (sam, sam_j).
+#define INV_ROW(sam)                                           \
+  ((R_xlen_t)(sam) * n_samples - (R_xlen_t)(sam) * ((sam) + 1) / 2 - (sam) - 1)
+
+// `expression` sees the posting list positions of x and y
+// as `lo` and `q`, for looking up csc_tfm_vec.
+#define INV_ACCUMULATE(expression)                             \
+  do {                                                         \
+    int       thread_i    = ((worker_t *)arg)->i;              \
+    int       n_threads   = ((worker_t *)arg)->n;              \
+    R_xlen_t *csc_pos_vec = inv_em->csc_pos_vec;               \
+    int      *csc_sam_vec = inv_em->csc_sam_vec;               \
+    double   *csc_val_vec = inv_em->csc_val_vec;               \
+                                                               \
+    for (int sam = thread_i; sam < n_samples - 1; sam += n_threads) { \
+                                                               \
+      double *row = dist_flt                                   \
+        ? inv_row_mtx + (size_t)thread_i * n_samples           \
+        : dist_vec + INV_ROW(sam);                             \
+      for (int sam_j = sam + 1; sam_j < n_samples; sam_j++)    \
+        row[sam_j] = 0;                                        \
+                                                               \
+      for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++) { \
+                                                               \
+        /* Find this sample in the OTU's posting list. */      \
+        int      otu = otu_vec[i];                             \
+        R_xlen_t lo  = csc_pos_vec[otu];                       \
+        R_xlen_t end = csc_pos_vec[otu + 1];                   \
+        R_xlen_t hi  = end - 1;                                \
+        while (lo < hi) {                                      \
+          R_xlen_t mid = lo + (hi - lo) / 2;                   \
+          if (csc_sam_vec[mid] < sam) { lo = mid + 1; }        \
+          else                        { hi = mid;     }        \
+        }                                                      \
+                                                               \
+        double x = csc_val_vec[lo];                            \
+        for (R_xlen_t q = lo + 1; q < end; q++) {              \
+          double  y = csc_val_vec[q];                          \
+          double *d = row + csc_sam_vec[q];                    \
+          expression;                                          \
+        }                                                      \
+      }                                                        \
+                                                               \
+      for (int sam_j = sam + 1; sam_j < n_samples; sam_j++) {  \
+        double distance = shared_distance(sam, sam_j, row[sam_j]); \
+        if (dist_flt) { dist_flt[INV_ROW(sam) + sam_j] = (float)distance; } \
+        else          { row[sam_j] = distance; }               \
+      }                                                        \
+    }                                                          \
+  } while (0)
+
+static void *inv_min(void *arg) {
+  INV_ACCUMULATE(*d += (x < y) ? x : y);
+  return NULL;
+}
+
+static void *inv_dot(void *arg) {
+  INV_ACCUMULATE(*d += x * y);
+  return NULL;
+}
+
+static void *inv_count(void *arg) {
+  INV_ACCUMULATE((void)x; (void)y; *d += 1);
+  return NULL;
+}
+
+static void *inv_root(void *arg) {
+  INV_ACCUMULATE((void)x; (void)y; *d += csc_tfm_vec[lo] * csc_tfm_vec[q]);
+  return NULL;
+}
+
+static void *inv_xlogx(void *arg) {
+  INV_ACCUMULATE(*d += csc_tfm_vec[lo] + csc_tfm_vec[q] - xlogx(x + y));
+  return NULL;
+}
+
+static void *inv_log1p(void *arg) {
+  INV_ACCUMULATE(*d += log1p(fabs(x - y)) - csc_tfm_vec[lo] - csc_tfm_vec[q]);
+  return NULL;
+}
+
+
+// The cost model picks the engine; the undocumented
+// `ecodive.inverted_index` option forces one for tests.
+static int use_inverted (ecomatrix_t *em) {
+  
+  int force = asLogical(GetOption1(install("ecodive.inverted_index")));
+  if (force != NA_LOGICAL) return force;
+  
+  // Posting list lengths give the engine's cost.
+  int *len_vec = (int*) safe_malloc(((size_t)n_otus + 1) * sizeof(int));
+  memset(len_vec, 0, n_otus * sizeof(int));
+  for (R_xlen_t i = 0; i < em->nnz; i++) len_vec[otu_vec[i]]++;
+  
+  double inv_cost = (double)n_dist;
+  for (int otu = 0; otu < n_otus; otu++)
+    inv_cost += (double)len_vec[otu] * (len_vec[otu] - 1) / 2;
+  free_one(len_vec);
+  
+  double merge_cost = (double)(n_samples - 1) * em->nnz;
+  return inv_cost * INV_COST_RATIO <= merge_cost;
+}
+
+
+// Returns a shared-OTU worker for this metric, or NULL to
+// use full merges: with CLR's non-zero "zeros", or when
+// a sum(min), sqrt(), or log() metric meets negative values.
+static pthread_func_t shared_setup(ecomatrix_t *em, int algorithm, int n_threads, int all_vs_all) {
+  
+  int kind = -1;
+  
+  switch (algorithm) {
+    case BDIV_BRAY:    case BDIV_MOTYKA: case BDIV_SOERGEL:  kind = SHARED_MIN;   break;
+    case BDIV_HORN:    case BDIV_MORISITA:                   kind = SHARED_DOT;   break;
+    case BDIV_JACCARD: case BDIV_OCHIAI: case BDIV_SORENSEN: kind = SHARED_COUNT; break;
+    case BDIV_BHATTACHARYYA: case BDIV_SQUARED_CHORD:        kind = SHARED_ROOT;  break;
+    case BDIV_JSD:                                           kind = SHARED_XLOGX; break;
+    case BDIV_LORENTZIAN:                                    kind = SHARED_LOG1P; break;
+  }
+  if (kind < 0 || clr_vec || n_samples < 2) return NULL;
+  
+  shared_algorithm = algorithm;
+  shared_kind      = kind;
+  tot_mtx          = (double*) safe_malloc((size_t)n_samples * TOT_N * sizeof(double));
+  tfm_vec          = NULL;
+  csc_tfm_vec      = NULL;
+  inv_row_mtx      = NULL;
+  if (kind >= SHARED_ROOT)
+    tfm_vec = (double*) safe_malloc(((size_t)em->nnz + 1) * sizeof(double));
+  run_parallel(calc_totals, n_threads, em->nnz);
+  
+  if (kind == SHARED_MIN || kind == SHARED_ROOT || kind == SHARED_XLOGX) {
+    for (int sam = 0; sam < n_samples; sam++) {
+      if (tot_mtx[(size_t)sam * TOT_N + TOT_MIN] < 0) {
+        tot_mtx = free_one(tot_mtx);
+        tfm_vec = free_one(tfm_vec);
+        return NULL;
+      }
+    }
+  }
+  
+  if (all_vs_all && use_inverted(em)) {
+    build_csc(em, n_threads);
+    inv_em = em;
+    if (dist_flt)
+      inv_row_mtx = (double*) safe_malloc(((size_t)n_threads * n_samples + 1) * sizeof(double));
+    if (tfm_vec) {
+      csc_tfm_vec = (double*) safe_malloc(((size_t)em->nnz + 1) * sizeof(double));
+      run_parallel(calc_csc_transform, n_threads, em->nnz);
+    }
+    switch (kind) {
+      case SHARED_MIN:   return inv_min;
+      case SHARED_DOT:   return inv_dot;
+      case SHARED_ROOT:  return inv_root;
+      case SHARED_XLOGX: return inv_xlogx;
+      case SHARED_LOG1P: return inv_log1p;
+      default:           return inv_count;
+    }
+  }
+  
+  switch (kind) {
+    case SHARED_MIN:   return shared_min;
+    case SHARED_DOT:   return shared_dot;
+    case SHARED_ROOT:  return shared_root;
+    case SHARED_XLOGX: return shared_xlogx;
+    case SHARED_LOG1P: return shared_log1p;
+    default:           return shared_count;
+  }
+}
+
+
+
+//======================================================
+// Point the kernels at `em` and return the one for this
+// algorithm, or NULL if the algorithm is unknown.
+//======================================================
+static pthread_func_t bdiv_kernel(ecomatrix_t *em, int algorithm, int n_threads) {
   
   n_samples = em->n_samples;
   n_otus    = em->n_otus;
   pos_vec   = em->pos_vec;
   otu_vec   = em->otu_vec;
   val_vec   = em->val_vec;
+  int_vec   = em->int_vec;
+  flt_vec   = NULL;
   clr_vec   = em->clr_vec;
+  pair_list = NULL;
+  
+  switch (algorithm) {
+    case BDIV_BHATTACHARYYA: return bhattacharyya;
+    case BDIV_BRAY:          return bray;
+    case BDIV_CANBERRA:      return canberra;
+    case BDIV_CHEBYSHEV:     return chebyshev;
+    case BDIV_CLARK:         return clark;
+    case BDIV_DIVERGENCE:    return divergence;
+    case BDIV_EUCLIDEAN:     return euclidean;
+    case BDIV_GOWER:         return gower_setup(em, n_threads);
+    case BDIV_HAMMING:       return hamming;
+    case BDIV_HORN:          return horn;
+    case BDIV_JACCARD:       return jaccard;
+    case BDIV_JSD:           return jsd;
+    case BDIV_LORENTZIAN:    return lorentzian;
+    case BDIV_MANHATTAN:     return manhattan;
+    case BDIV_MINKOWSKI:     return minkowski_setup();
+    case BDIV_MORISITA:      return morisita;
+    case BDIV_MOTYKA:        return motyka;
+    case BDIV_OCHIAI:        return ochiai;
+    case BDIV_SOERGEL:       return soergel;
+    case BDIV_SORENSEN:      return sorensen;
+    case BDIV_SQUARED_CHISQ: return squared_chisq;
+    case BDIV_SQUARED_CHORD: return squared_chord;
+    case BDIV_WAVE_HEDGES:   return wave_hedges;
+  }
+  
+  return NULL;
+}
+
+
+
+//======================================================
+// Distances for arbitrary lists of sample pairs, for
+// callers such as vptree.c that choose pairs as they go.
+// bdiv_pairs_setup() returns the kernel to pass to each
+// bdiv_pairs() call, which fills dist[i] for pair i.
+//======================================================
+pthread_func_t bdiv_pairs_setup(ecomatrix_t *em, int algorithm, int n_threads, SEXP *sexp_extra_args) {
+  
+  sexp_extra = sexp_extra_args;
+  
+  pthread_func_t bdiv_func = bdiv_kernel(em, algorithm, n_threads);
+  if (bdiv_func == NULL) { // # nocov start
+    free_all();
+    error("Invalid beta diversity algorithm.");
+  } // # nocov end
+  
+  n_query     = 0;
+  dist_flt    = NULL;
+  pair_vec    = NULL;
+  pair_spec   = 0;
+  
+  pthread_func_t shared_func = shared_setup(em, algorithm, n_threads, 0);
+  return shared_func ? shared_func : bdiv_func;
+}
+
+void bdiv_pairs(pthread_func_t bdiv_func, int *pairs, R_xlen_t n, double *dist, int n_threads) {
+  
+  pair_list = pairs;
+  n_pairs   = n;
+  dist_vec  = dist;
+  
+  run_parallel(bdiv_func, n_threads, n);
+  
+  pair_list = NULL;
+}
+
+
+
+//======================================================
+// R interface. Distributes work across threads.
+//======================================================
+SEXP C_beta_div(
+    SEXP sexp_algorithm,     SEXP sexp_otu_mtx,   
+    SEXP sexp_margin,        SEXP sexp_min_prevalence, 
+    SEXP sexp_min_abundance, SEXP sexp_norm, 
+    SEXP sexp_pairs_vec,     SEXP sexp_n_query, 
+    SEXP sexp_k,             SEXP sexp_file, 
+    SEXP sexp_precision,     SEXP sexp_n_threads,   
+    SEXP sexp_pseudocount,   SEXP sexp_extra_args ) {
+  
+  int norm        = asInteger(sexp_norm);
+  double pseudocount = asReal(sexp_pseudocount);
+  int min_prevalence   = asInteger(sexp_min_prevalence);
+  double min_abundance = asReal(sexp_min_abundance);
+  int n_threads   = asInteger(sexp_n_threads);
+  int single      = asInteger(sexp_precision) == PRECISION_SINGLE;
+  sexp_extra      = &sexp_extra_args;
+  init_n_ptrs(20);
+  
+  int algorithm   = asInteger(sexp_algorithm);
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
+  prune_otus(em, min_prevalence, min_abundance);
+  if (norm) normalize(em, norm, n_threads, pseudocount);
   
   
   // function to run
-  // void * (*bdiv_func)(void *) = NULL;
-  pthread_func_t bdiv_func = NULL;
-  
-  switch (asInteger(sexp_algorithm)) {
-    case BDIV_BHATTACHARYYA: bdiv_func = bhattacharyya; break;
-    case BDIV_BRAY:          bdiv_func = bray;          break;
-    case BDIV_CANBERRA:      bdiv_func = canberra;      break;
-    case BDIV_CHEBYSHEV:     bdiv_func = chebyshev;     break;
-    case BDIV_CLARK:         bdiv_func = clark;         break;
-    case BDIV_DIVERGENCE:    bdiv_func = divergence;    break;
-    case BDIV_EUCLIDEAN:     bdiv_func = euclidean;     break;
-    case BDIV_GOWER:         bdiv_func = gower_setup(); break;
-    case BDIV_HAMMING:       bdiv_func = hamming;       break;
-    case BDIV_HORN:          bdiv_func = horn;          break;
-    case BDIV_JACCARD:       bdiv_func = jaccard;       break;
-    case BDIV_JSD:           bdiv_func = jsd;           break;
-    case BDIV_LORENTZIAN:    bdiv_func = lorentzian;    break;
-    case BDIV_MANHATTAN:     bdiv_func = manhattan;     break;
-    case BDIV_MINKOWSKI:     bdiv_func = minkowski;     break;
-    case BDIV_MORISITA:      bdiv_func = morisita;      break;
-    case BDIV_MOTYKA:        bdiv_func = motyka;        break;
-    case BDIV_OCHIAI:        bdiv_func = ochiai;        break;
-    case BDIV_SOERGEL:       bdiv_func = soergel;       break;
-    case BDIV_SORENSEN:      bdiv_func = sorensen;      break;
-    case BDIV_SQUARED_CHISQ: bdiv_func = squared_chisq; break;
-    case BDIV_SQUARED_CHORD: bdiv_func = squared_chord; break;
-    case BDIV_WAVE_HEDGES:   bdiv_func = wave_hedges;   break;
-  }
+  pthread_func_t bdiv_func = bdiv_kernel(em, algorithm, n_threads);
   
   if (bdiv_func == NULL) { // # nocov start
     error("Invalid beta diversity algorithm.");
@@ -732,48 +1419,113 @@ SEXP C_beta_div(
   } // # nocov end
   
   
-  // Create the dist object to return
-  n_dist                = n_samples * (n_samples - 1) / 2;
-  SEXP sexp_result_dist = PROTECT(allocVector(REALSXP, n_dist));
-  dist_vec              = REAL(sexp_result_dist);
+  // Create the dist object to return, or for query-vs-
+  // reference, a matrix sized to the output. For the k
+  // nearest neighbors, heaps stand in for dist_vec; with
+  // `file`, distances go straight to a mapped file.
+  n_query = isNull(sexp_n_query) ? 0 : asInteger(sexp_n_query);
+  int k   = isNull(sexp_k)       ? 0 : asInteger(sexp_k);
+  SEXP sexp_result_dist;
+  
+  if (k) {
+    
+    int n_rows       = n_query ? n_query : n_samples;
+    int n_nbrs       = n_query ? n_samples - n_query : n_samples - 1;
+    n_dist           = n_query 
+      ? (R_xlen_t)n_query * (n_samples - n_query) 
+      : (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(knn_alloc(
+      n_rows, n_nbrs, n_query, k, n_threads, em->sexp_sample_names ));
+    
+  } else if (n_query) {
+    
+    n_dist           = (R_xlen_t)n_query * (n_samples - n_query);
+    sexp_result_dist = PROTECT(new_query_mtx(em, n_query));
+    
+  } else if (!isNull(sexp_file)) {
+    
+    n_dist           = (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(sexp_file);
+    
+  } else {
+    
+    n_dist           = (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(allocVector(REALSXP, n_dist));
+    
+    SEXP sexp_dist_class = PROTECT(mkString("dist"));
+    SEXP sexp_size_val   = PROTECT(ScalarInteger(n_samples));
+    SEXP sexp_diag_val   = PROTECT(ScalarLogical(0));
+    SEXP sexp_upper_val  = PROTECT(ScalarLogical(0));
+    
+    setAttrib(sexp_result_dist, R_ClassSymbol,     sexp_dist_class);
+    setAttrib(sexp_result_dist, install("Size"),   sexp_size_val);
+    setAttrib(sexp_result_dist, install("Diag"),   sexp_diag_val);
+    setAttrib(sexp_result_dist, install("Upper"),  sexp_upper_val);
+    setAttrib(sexp_result_dist, install("Labels"), em->sexp_sample_names);
+    UNPROTECT(4);
+  }
+  
+  dist_vec = NULL;
+  dist_flt = NULL;
   
-  SEXP sexp_dist_class = PROTECT(mkString("dist"));
-  SEXP sexp_size_val   = PROTECT(ScalarInteger(n_samples));
-  SEXP sexp_diag_val   = PROTECT(ScalarLogical(0));
-  SEXP sexp_upper_val  = PROTECT(ScalarLogical(0));
+  if (!isNull(sexp_file)) {
+    int   is_float;
+    void *values = new_dist_file(sexp_file, n_samples, em->sexp_sample_names, single, &is_float);
+    if (is_float) { dist_flt = (float*)  values; }
+    else          { dist_vec = (double*) values; }
+  }
+  else if (!k) {
+    dist_vec = REAL(sexp_result_dist);
+  }
   
-  setAttrib(sexp_result_dist, R_ClassSymbol,     sexp_dist_class);
-  setAttrib(sexp_result_dist, install("Size"),   sexp_size_val);
-  setAttrib(sexp_result_dist, install("Diag"),   sexp_diag_val);
-  setAttrib(sexp_result_dist, install("Upper"),  sexp_upper_val);
-  setAttrib(sexp_result_dist, install("Labels"), em->sexp_sample_names);
   
+  // Avoid allocating pair_vec for common all-vs-all case
+  pair_vec  = NULL;
+  pair_spec = TYPEOF(sexp_pairs_vec) == VECSXP;
   
-  // Avoid allocating pairs_vec for common all-vs-all case
   if (isNull(sexp_pairs_vec)) {
     
-    pairs_vec = NULL;
-    n_pairs   = n_dist;
+    n_pairs = n_dist;
     
   } else {
     
-    pairs_vec = INTEGER(sexp_pairs_vec);
-    n_pairs   = LENGTH(sexp_pairs_vec);
+    if (pair_spec) { pair_spec_setup(sexp_pairs_vec, n_samples); n_pairs = n_dist; }
+    else           { pair_vec = sort_pairs(sexp_pairs_vec); n_pairs = XLENGTH(sexp_pairs_vec); }
     
-    for (int i = 0; i < n_dist; i++)
-      dist_vec[i] = NA_REAL;
+    if (dist_flt) { for (R_xlen_t i = 0; i < n_dist; i++) dist_flt[i] = (float)NA_REAL; }
+    else          { for (R_xlen_t i = 0; i < n_dist; i++) dist_vec[i] = NA_REAL;        }
     
     if (n_pairs == 0) {
       free_all();
-      UNPROTECT(5);
-      return sexp_result_dist;
+      UNPROTECT(1);
+      return isNull(sexp_file) ? sexp_result_dist : C_dist_file_info(sexp_file);
     }
   }
   
   
-  run_parallel(bdiv_func, n_threads, n_pairs);
+  // Shared-OTU kernels where the metric allows, else full
+  // merges.
+  pthread_func_t shared_func = shared_setup(
+    em, algorithm, n_threads, isNull(sexp_pairs_vec) && !n_query && !k );
+  
+  if (shared_func) bdiv_func = shared_func;
+  
+  // Narrow the normalized values once every engine has
+  // read what it needs from them in double.
+  if (single && !int_vec) {
+    flt_vec = flt_val_vec(em);
+    val_vec = NULL;
+  }
+  
+  if (k) {
+    knn_run(bdiv_func, n_threads, n_pairs);
+    knn_finish(n_threads);
+  }
+  else {
+    run_parallel(bdiv_func, n_threads, n_pairs);
+  }
   
   free_all();
-  UNPROTECT(5);
-  return sexp_result_dist;
+  UNPROTECT(1);
+  return isNull(sexp_file) ? sexp_result_dist : C_dist_file_info(sexp_file);
 }
@@ -0,0 +1,343 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * On-disk dist objects, for studies whose distance matrices
+ * are larger than memory.
+ *
+ * The file holds the lower triangle in the order R's dist
+ * objects use, in native byte order:
+ *
+ *   ecd_header_t
+ *   double dist_vec[n_samples * (n_samples - 1) / 2]
+ *          (float when ECD_FLOAT is set; padded to 8 bytes)
+ *   char   names[]   n_samples NUL-terminated strings
+ *
+ * new_dist_file() maps the file read-write, so the pair loops
+ * write distances straight into it, as float or double.
+ */
+
+#include "ecodive.h"
+
+#define ECD_MAGIC   "ECODIST"
+#define ECD_VERSION 1
+
+#define ECD_FLOAT   1
+#define ECD_NAMES   2
+
+#define PAD8(n) (((n) + 7) & ~((size_t)7))
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t flags;
+  int32_t  n_samples;
+  int32_t  reserved;
+  uint64_t names_len;
+} ecd_header_t;
+
+
+static R_xlen_t dist_length (ecd_header_t *hdr) {
+  return (R_xlen_t)hdr->n_samples * (hdr->n_samples - 1) / 2;
+}
+
+static size_t names_offset (ecd_header_t *hdr) {
+  size_t val_size = (hdr->flags & ECD_FLOAT) ? sizeof(float) : sizeof(double);
+  return sizeof(ecd_header_t) + PAD8((size_t)dist_length(hdr) * val_size);
+}
+
+static ecd_header_t *map_dist_file (const char *path, size_t *n_bytes, int writable) {
+  
+  ecd_header_t *hdr = writable
+    ? (ecd_header_t*) safe_mmap_rw(path, n_bytes, 0)
+    : (ecd_header_t*) safe_mmap(path, n_bytes);
+  
+  if (*n_bytes < sizeof(ecd_header_t) || memcmp(hdr->magic, ECD_MAGIC, 8)) {
+    free_all();
+    error("'%s' is not a distance file.", path);
+  }
+  
+  if (hdr->version != ECD_VERSION) {
+    free_all();
+    error("'%s' was written by an incompatible version of ecodive.", path);
+  }
+  
+  if (hdr->n_samples < 1 || *n_bytes < names_offset(hdr) + hdr->names_len) {
+    free_all();
+    error("'%s' is truncated.", path);
+  }
+  
+  return hdr;
+}
+
+
+
+//=========================================================
+// Create a file for all of n_samples' distances, as float
+// when `single` or the ecodive.dist_file_type option asks.
+// Returns where the pair loops should write them: floats
+// when *is_float is set, else doubles.
+//=========================================================
+
+void* new_dist_file (SEXP sexp_file, int n_samples, SEXP sexp_names, int single, int *is_float) {
+  
+  const char *path      = CHAR(asChar(sexp_file));
+  SEXP        sexp_type = GetOption1(install("ecodive.dist_file_type"));
+  
+  *is_float = single || (isString(sexp_type) && !strcmp(CHAR(asChar(sexp_type)), "float32"));
+  
+  ecd_header_t hdr;
+  memset(&hdr, 0, sizeof(ecd_header_t));
+  memcpy(hdr.magic, ECD_MAGIC, 8);
+  
+  hdr.version   = ECD_VERSION;
+  hdr.flags     = *is_float ? ECD_FLOAT : 0;
+  hdr.n_samples = n_samples;
+  
+  if (isString(sexp_names) && LENGTH(sexp_names) == n_samples) {
+    hdr.flags |= ECD_NAMES;
+    for (int i = 0; i < n_samples; i++)
+      hdr.names_len += strlen(CHAR(STRING_ELT(sexp_names, i))) + 1;
+  }
+  
+  size_t n_bytes = names_offset(&hdr) + hdr.names_len;
+  char  *addr    = (char*) safe_mmap_rw(path, &n_bytes, 1);
+  
+  memcpy(addr, &hdr, sizeof(ecd_header_t));
+  
+  if (hdr.flags & ECD_NAMES) {
+    char *name = addr + names_offset(&hdr);
+    for (int i = 0; i < n_samples; i++) {
+      size_t len = strlen(CHAR(STRING_ELT(sexp_names, i))) + 1;
+      memcpy(name, CHAR(STRING_ELT(sexp_names, i)), len);
+      name += len;
+    }
+  }
+  
+  return addr + sizeof(ecd_header_t);
+}
+
+
+
+//=========================================================
+// The R object for a distance file: its path, size,
+// labels, and value type.
+//=========================================================
+
+SEXP C_dist_file_info(SEXP sexp_path) {
+  
+  const char *path    = CHAR(asChar(sexp_path));
+  size_t      n_bytes = 0;
+  init_n_ptrs(1);
+  
+  ecd_header_t *hdr = map_dist_file(path, &n_bytes, 0);
+  
+  const char *names[] = { "path", "size", "labels", "type", "" };
+  SEXP sexp_info = PROTECT(mkNamed(VECSXP, names));
+  
+  SET_VECTOR_ELT(sexp_info, 0, sexp_path);
+  SET_VECTOR_ELT(sexp_info, 1, ScalarInteger(hdr->n_samples));
+  SET_VECTOR_ELT(sexp_info, 3, mkString((hdr->flags & ECD_FLOAT) ? "float32" : "float64"));
+  
+  if (hdr->flags & ECD_NAMES) {
+    
+    const char *name     = (char*)hdr + names_offset(hdr);
+    const char *name_end = name + hdr->names_len;
+    
+    SEXP sexp_labels = PROTECT(allocVector(STRSXP, hdr->n_samples));
+    
+    for (int i = 0; i < hdr->n_samples; i++) {
+      const char *nul = memchr(name, '\0', name_end - name);
+      if (!nul) {
+        free_all();
+        error("'%s' has invalid sample names.", path);
+      }
+      SET_STRING_ELT(sexp_labels, i, mkCharLen(name, nul - name));
+      name = nul + 1;
+    }
+    
+    SET_VECTOR_ELT(sexp_info, 2, sexp_labels);
+    UNPROTECT(1);
+  }
+  
+  SEXP sexp_class = PROTECT(mkString("ecodive_dist_file"));
+  setAttrib(sexp_info, R_ClassSymbol, sexp_class);
+  
+  free_all();
+  UNPROTECT(2);
+  return sexp_info;
+}
+
+
+
+//=========================================================
+// Distances between two sets of samples, as a matrix.
+// `rows` and `cols` are 1-based and already validated.
+//=========================================================
+
+SEXP C_dist_file_extract(SEXP sexp_path, SEXP sexp_rows, SEXP sexp_cols) {
+  
+  const char *path    = CHAR(asChar(sexp_path));
+  size_t      n_bytes = 0;
+  init_n_ptrs(1);
+  
+  ecd_header_t *hdr    = map_dist_file(path, &n_bytes, 0);
+  double       *dbl    = (double*)(hdr + 1);
+  float        *flt    = (float*) (hdr + 1);
+  int           is_flt = (hdr->flags & ECD_FLOAT) != 0;
+  R_xlen_t      n      = hdr->n_samples;
+  
+  int  n_rows   = LENGTH(sexp_rows), *rows = INTEGER(sexp_rows);
+  int  n_cols   = LENGTH(sexp_cols), *cols = INTEGER(sexp_cols);
+  SEXP sexp_mtx = PROTECT(allocMatrix(REALSXP, n_rows, n_cols));
+  double *mtx   = REAL(sexp_mtx);
+  
+  for (int c = 0; c < n_cols; c++) {
+    for (int r = 0; r < n_rows; r++) {
+      
+      R_xlen_t i = rows[r] - 1, j = cols[c] - 1;
+      if (i > j) { R_xlen_t t = i; i = j; j = t; }
+      
+      R_xlen_t idx = i * n - i * (i + 1) / 2 + j - i - 1;
+      
+      mtx[(R_xlen_t)c * n_rows + r] = (i == j) ? 0 : is_flt ? flt[idx] : dbl[idx];
+    }
+  }
+  
+  free_all();
+  UNPROTECT(1);
+  return sexp_mtx;
+}
+
+
+
+//=========================================================
+// Read or overwrite a run of the condensed vector, so R
+// can stream through files larger than memory. `offset`
+// is 0-based.
+//=========================================================
+
+SEXP C_dist_file_slice(SEXP sexp_path, SEXP sexp_offset, SEXP sexp_n) {
+  
+  const char *path    = CHAR(asChar(sexp_path));
+  size_t      n_bytes = 0;
+  init_n_ptrs(1);
+  
+  ecd_header_t *hdr    = map_dist_file(path, &n_bytes, 0);
+  R_xlen_t      offset = (R_xlen_t)asReal(sexp_offset);
+  R_xlen_t      n      = (R_xlen_t)asReal(sexp_n);
+  
+  if (offset < 0 || n < 0 || offset + n > dist_length(hdr)) {
+    free_all();
+    error("Slice is outside of '%s'.", path);
+  }
+  
+  SEXP    sexp_vals = PROTECT(allocVector(REALSXP, n));
+  double *vals      = REAL(sexp_vals);
+  
+  if (hdr->flags & ECD_FLOAT) {
+    float *flt = (float*)(hdr + 1) + offset;
+    for (R_xlen_t i = 0; i < n; i++) vals[i] = flt[i];
+  }
+  else {
+    memcpy(vals, (double*)(hdr + 1) + offset, n * sizeof(double));
+  }
+  
+  free_all();
+  UNPROTECT(1);
+  return sexp_vals;
+}
+
+
+SEXP C_dist_file_update(SEXP sexp_path, SEXP sexp_offset, SEXP sexp_vals) {
+  
+  const char *path    = CHAR(asChar(sexp_path));
+  size_t      n_bytes = 0;
+  init_n_ptrs(1);
+  
+  ecd_header_t *hdr    = map_dist_file(path, &n_bytes, 1);
+  R_xlen_t      offset = (R_xlen_t)asReal(sexp_offset);
+  R_xlen_t      n      = XLENGTH(sexp_vals);
+  double       *vals   = REAL(sexp_vals);
+  
+  if (offset < 0 || offset + n > dist_length(hdr)) {
+    free_all();
+    error("Slice is outside of '%s'.", path);
+  }
+  
+  if (hdr->flags & ECD_FLOAT) {
+    float *flt = (float*)(hdr + 1) + offset;
+    for (R_xlen_t i = 0; i < n; i++) flt[i] = (float)vals[i];
+  }
+  else {
+    memcpy((double*)(hdr + 1) + offset, vals, n * sizeof(double));
+  }
+  
+  free_all();
+  return sexp_path;
+}
+
+
+
+//=========================================================
+// Copy the distances among the first samples of `dst` from
+// `src`, which holds only those samples, so an extended
+// matrix needs no recalculation of them. Each is a dist or
+// a file path; a dist `dst` is filled in place.
+//=========================================================
+
+static void *dist_values (SEXP sexp_x, int *n_samples, int *is_flt, int writable) {
+  
+  if (!isString(sexp_x)) {
+    *n_samples = asInteger(getAttrib(sexp_x, install("Size")));
+    *is_flt    = 0;
+    return REAL(sexp_x);
+  }
+  
+  size_t        n_bytes = 0;
+  ecd_header_t *hdr     = map_dist_file(CHAR(asChar(sexp_x)), &n_bytes, writable);
+  
+  *n_samples = hdr->n_samples;
+  *is_flt    = (hdr->flags & ECD_FLOAT) != 0;
+  return hdr + 1;
+}
+
+
+SEXP C_dist_extend(SEXP sexp_dst, SEXP sexp_src) {
+  
+  int n_dst, n_src, dst_flt, src_flt;
+  init_n_ptrs(2);
+  
+  void *dst = dist_values(sexp_dst, &n_dst, &dst_flt, 1);
+  void *src = dist_values(sexp_src, &n_src, &src_flt, 0);
+  
+  if (n_src > n_dst) {
+    free_all();
+    error("Cannot extend distances for %i samples to %i.", n_src, n_dst);
+  }
+  
+  // Row i of the old triangle is a run of n_src - i - 1
+  // values; only its start moves.
+  for (int i = 0; i < n_src - 1; i++) {
+    
+    R_xlen_t from = PAIR_ROW_START(i, n_src);
+    R_xlen_t to   = PAIR_ROW_START(i, n_dst);
+    R_xlen_t len  = n_src - i - 1;
+    
+    if (!dst_flt && !src_flt) {
+      memcpy((double*)dst + to, (double*)src + from, len * sizeof(double));
+    }
+    else if (!dst_flt) {
+      for (R_xlen_t k = 0; k < len; k++) ((double*)dst)[to + k] = ((float*)src)[from + k];
+    }
+    else if (!src_flt) {
+      for (R_xlen_t k = 0; k < len; k++) ((float*)dst)[to + k] = (float)((double*)src)[from + k];
+    }
+    else {
+      memcpy((float*)dst + to, (float*)src + from, len * sizeof(float));
+    }
+  }
+  
+  free_all();
+  return sexp_dst;
+}
@@ -0,0 +1,427 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * On-disk ecomatrix, for tables too large to hold in R.
+ *
+ * The file is the CSR layout of ecomatrix_t, in native byte
+ * order, with each section padded to a multiple of 8 bytes:
+ *
+ *   ecm_header_t
+ *   int64  pos_vec[n_samples + 1]
+ *   int    otu_vec[nnz]
+ *   double val_vec[nnz]   (int when ECM_INT_VALS is set)
+ *   char   names[]        n_samples NUL-terminated strings
+ *
+ * The header also records value statistics, so R can validate
+ * arguments without reading the rest of the file.
+ *
+ * parse_ecmfile() maps the file read-only; the ecomatrix
+ * vectors point straight into the mapping. write_ecmfile()
+ * writes one, optionally replacing values with rarefied
+ * counts.
+ */
+
+#include "ecodive.h"
+
+#define ECM_MAGIC    "ECODIVE"
+#define ECM_VERSION  2
+
+#define ECM_INT_VALS 1
+#define ECM_INTEGRAL 2
+#define ECM_NAMES    4
+
+#define PAD8(n) (((n) + 7) & ~((size_t)7))
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t flags;
+  int32_t  n_samples;
+  int32_t  n_otus;
+  int64_t  nnz;
+  uint64_t names_len;
+  double   min_val;  // smallest stored value
+  double   max_val;  // largest stored value
+  double   min_pos;  // smallest positive value, or 0
+} ecm_header_t;
+
+
+
+//=========================================================
+// Sanity checks shared by the reader and info functions.
+//=========================================================
+
+static void check_header (ecm_header_t *hdr, size_t n_bytes, const char *path) {
+  
+  if (n_bytes < sizeof(ecm_header_t) || memcmp(hdr->magic, ECM_MAGIC, 8)) {
+    free_all();
+    error("'%s' is not an ecomatrix file.", path);
+  }
+  
+  if (hdr->version != ECM_VERSION) {
+    free_all();
+    error("'%s' was written by an incompatible version of ecodive.", path);
+  }
+  
+  if (hdr->n_samples < 1 || hdr->n_otus < 1 || hdr->nnz < 0) {
+    free_all();
+    error("'%s' has an invalid header.", path);
+  }
+  
+  // section_offset() must not overflow. 24 bytes covers
+  // the padding of three sections.
+  size_t room  = SIZE_MAX - sizeof(ecm_header_t) - 24;
+  size_t n_pos = (size_t)hdr->n_samples + 1;
+  int    bad   = n_pos > room / sizeof(int64_t);
+  
+  if (!bad) {
+    room -= n_pos * sizeof(int64_t);
+    bad   = (uint64_t)hdr->nnz > room / (sizeof(int) + sizeof(double));
+  }
+  if (!bad) {
+    room -= (size_t)hdr->nnz * (sizeof(int) + sizeof(double));
+    bad   = hdr->names_len > room;
+  }
+  
+  if (bad) {
+    free_all();
+    error("'%s' has an invalid header.", path);
+  }
+}
+
+static size_t section_offset (ecm_header_t *hdr, int section) {
+  
+  size_t val_size = (hdr->flags & ECM_INT_VALS) ? sizeof(int) : sizeof(double);
+  size_t offset   = sizeof(ecm_header_t);
+  
+  if (section > 0) offset += PAD8((size_t)(hdr->n_samples + 1) * sizeof(int64_t));
+  if (section > 1) offset += PAD8((size_t)hdr->nnz * sizeof(int));
+  if (section > 2) offset += PAD8((size_t)hdr->nnz * val_size);
+  if (section > 3) offset += hdr->names_len;
+  
+  return offset;
+}
+
+
+
+//=========================================================
+// Map an ecomatrix file. Samples are always rows in the
+// file, so margin is ignored.
+//=========================================================
+
+void parse_ecmfile (ecomatrix_t *em, SEXP sexp_ecmfile, int margin) {
+  
+  (void)margin;
+  
+  const char *path    = CHAR(asChar(get(sexp_ecmfile, "path")));
+  size_t      n_bytes = 0;
+  char       *addr    = (char*) safe_mmap(path, &n_bytes);
+  
+  ecm_header_t *hdr = (ecm_header_t*) addr;
+  check_header(hdr, n_bytes, path);
+  
+  if (n_bytes < section_offset(hdr, 4)) {
+    free_all();
+    error("'%s' is truncated.", path);
+  }
+  
+  em->n_samples = hdr->n_samples;
+  em->n_otus    = hdr->n_otus;
+  em->nnz       = (R_xlen_t)hdr->nnz;
+  em->pos_vec   = (R_xlen_t*)(addr + section_offset(hdr, 0));
+  em->otu_vec   = (int*)(addr + section_offset(hdr, 1));
+  
+  if (hdr->flags & ECM_INT_VALS) { em->int_vec = (int*)   (addr + section_offset(hdr, 2)); }
+  else                           { em->val_vec = (double*)(addr + section_offset(hdr, 2)); }
+  
+  if (em->pos_vec[0] != 0 || em->pos_vec[em->n_samples] != em->nnz) {
+    free_all();
+    error("'%s' has an invalid pos_vec.", path);
+  }
+  
+  // Every kernel indexes by these, so one bad entry would
+  // read or write out of bounds. Rows must not run
+  // backwards, and each row's OTUs must be strictly
+  // increasing and in range.
+  for (int sam = 0; sam < em->n_samples; sam++) {
+    
+    R_xlen_t begin = em->pos_vec[sam];
+    R_xlen_t end   = em->pos_vec[sam + 1];
+    
+    if (end < begin || end > em->nnz) {
+      free_all();
+      error("'%s' has an invalid pos_vec.", path);
+    }
+    
+    for (R_xlen_t i = begin; i < end; i++) {
+      int otu = em->otu_vec[i];
+      if (otu < 0 || otu >= em->n_otus || (i > begin && otu <= em->otu_vec[i - 1])) {
+        free_all();
+        error("'%s' has an invalid otu_vec.", path);
+      }
+    }
+  }
+  
+  
+  // Sample names
+  // --------------------------------------------
+  
+  if (hdr->flags & ECM_NAMES) {
+    
+    const char *name     = addr + section_offset(hdr, 3);
+    const char *name_end = name + hdr->names_len;
+    
+    SEXP sexp_names = safe_preserve(allocVector(STRSXP, em->n_samples));
+    
+    for (int i = 0; i < em->n_samples; i++) {
+      const char *nul = memchr(name, '\0', name_end - name);
+      if (!nul) {
+        free_all();
+        error("'%s' has invalid sample names.", path);
+      }
+      SET_STRING_ELT(sexp_names, i, mkCharLen(name, nul - name));
+      name = nul + 1;
+    }
+    
+    em->sexp_sample_names = sexp_names;
+  }
+}
+
+
+
+//=========================================================
+// Write an ecomatrix to a file. When cnt_vec is given, its
+// counts replace the stored values and its zeros are left
+// out. When keep_vec is given, only samples it flags are
+// written. Filtered entries are streamed one at a time, so
+// no second copy of the table is held in memory.
+//=========================================================
+
+static void write_fail (FILE *fp) {
+  fclose(fp);
+  free_all();
+  error("Unable to write ecomatrix file.");
+}
+
+static void write_pad (FILE *fp, size_t n_bytes) {
+  
+  static const char zeros[8] = {0};
+  
+  size_t n_pad = PAD8(n_bytes) - n_bytes;
+  if (ferror(fp) || (n_pad && fwrite(zeros, 1, n_pad, fp) != n_pad))
+    write_fail(fp); // # nocov
+}
+
+static void write_block (FILE *fp, const void *ptr, size_t n_bytes) {
+  
+  if (n_bytes && fwrite(ptr, 1, n_bytes, fp) != n_bytes)
+    write_fail(fp);
+  
+  write_pad(fp, n_bytes);
+}
+
+// Runs `body` for each written entry `i` of sample `sam`.
+#define FOREACH_KEPT(body)                                     \
+  for (int sam = 0; sam < em->n_samples; sam++) {              \
+    if (keep_vec && !keep_vec[sam]) continue;                  \
+    for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam+1]; i++) { \
+      if (cnt_vec && !cnt_vec[i]) continue;                    \
+      body                                                     \
+    }                                                          \
+  }
+
+void write_ecmfile (ecomatrix_t *em, uint32_t *cnt_vec, int *keep_vec, const char *path) {
+  
+  R_xlen_t *pos_vec  = em->pos_vec;
+  int      *otu_vec  = em->otu_vec;
+  int      *int_vec  = em->int_vec;
+  double   *val_vec  = em->val_vec;
+  SEXP      names    = em->sexp_sample_names;
+  int       filtered = cnt_vec || keep_vec;
+  
+  
+  // Header, including value statistics
+  // --------------------------------------------
+  
+  ecm_header_t hdr;
+  memset(&hdr, 0, sizeof(ecm_header_t));
+  memcpy(hdr.magic, ECM_MAGIC, 8);
+  
+  hdr.version   = ECM_VERSION;
+  hdr.flags     = ECM_INTEGRAL;
+  hdr.n_otus    = em->n_otus;
+  hdr.min_val   = R_PosInf;
+  hdr.max_val   = R_NegInf;
+  hdr.min_pos   = R_PosInf;
+  
+  if (int_vec || cnt_vec) hdr.flags |= ECM_INT_VALS;
+  
+  for (int sam = 0; sam < em->n_samples; sam++)
+    if (!keep_vec || keep_vec[sam]) hdr.n_samples++;
+  
+  FOREACH_KEPT(
+    double x = cnt_vec ? cnt_vec[i] : int_vec ? int_vec[i] : val_vec[i];
+    if (x < hdr.min_val)          hdr.min_val = x;
+    if (x > hdr.max_val)          hdr.max_val = x;
+    if (x > 0 && x < hdr.min_pos) hdr.min_pos = x;
+    if (x != floor(x))            hdr.flags  &= ~ECM_INTEGRAL;
+    hdr.nnz++;
+  );
+  
+  if (!hdr.nnz)            hdr.min_val = hdr.max_val = 0;
+  if (hdr.min_pos > 1e308) hdr.min_pos = 0;
+  
+  if (hdr.n_samples == 0) {
+    free_all();
+    error("No samples are left to write.");
+  }
+  
+  int has_names = isString(names) && LENGTH(names) == em->n_samples;
+  if (has_names) {
+    hdr.flags |= ECM_NAMES;
+    for (int i = 0; i < em->n_samples; i++)
+      if (!keep_vec || keep_vec[i])
+        hdr.names_len += strlen(CHAR(STRING_ELT(names, i))) + 1;
+  }
+  
+  
+  // Header, then each section
+  // --------------------------------------------
+  
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    free_all();
+    error("Unable to open '%s' for writing.", path);
+  }
+  
+  write_block(fp, &hdr, sizeof(ecm_header_t));
+  
+  if (!filtered) {
+    
+    write_block(fp, pos_vec, (size_t)(em->n_samples + 1) * sizeof(R_xlen_t));
+    write_block(fp, otu_vec, (size_t)em->nnz * sizeof(int));
+    
+    if (int_vec) { write_block(fp, int_vec, (size_t)em->nnz * sizeof(int));    }
+    else         { write_block(fp, val_vec, (size_t)em->nnz * sizeof(double)); }
+  }
+  
+  else {
+    
+    // Each kept sample's end offset follows a leading 0.
+    R_xlen_t pos = 0;
+    fwrite(&pos, sizeof(R_xlen_t), 1, fp);
+    for (int sam = 0; sam < em->n_samples; sam++) {
+      if (keep_vec && !keep_vec[sam]) continue;
+      for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++)
+        if (!cnt_vec || cnt_vec[i]) pos++;
+      fwrite(&pos, sizeof(R_xlen_t), 1, fp);
+    }
+    write_pad(fp, (size_t)(hdr.n_samples + 1) * sizeof(R_xlen_t));
+    
+    FOREACH_KEPT( fwrite(otu_vec + i, sizeof(int), 1, fp); );
+    write_pad(fp, (size_t)hdr.nnz * sizeof(int));
+    
+    if (hdr.flags & ECM_INT_VALS) {
+      FOREACH_KEPT(
+        int x = cnt_vec ? (int)cnt_vec[i] : int_vec[i];
+        fwrite(&x, sizeof(int), 1, fp);
+      );
+      write_pad(fp, (size_t)hdr.nnz * sizeof(int));
+    }
+    else {
+      FOREACH_KEPT( fwrite(val_vec + i, sizeof(double), 1, fp); );
+      write_pad(fp, (size_t)hdr.nnz * sizeof(double));
+    }
+  }
+  
+  if (has_names) {
+    for (int i = 0; i < em->n_samples; i++) {
+      if (keep_vec && !keep_vec[i]) continue;
+      const char *name = CHAR(STRING_ELT(names, i));
+      if (fwrite(name, 1, strlen(name) + 1, fp) != strlen(name) + 1)
+        write_fail(fp); // # nocov
+    }
+  }
+  
+  if (ferror(fp)) write_fail(fp); // # nocov
+  fclose(fp);
+}
+
+
+SEXP C_write_ecomatrix(
+    SEXP sexp_otu_mtx, SEXP sexp_margin,
+    SEXP sexp_path,    SEXP sexp_n_threads ) {
+  
+  int n_threads = asInteger(sexp_n_threads);
+  init_n_ptrs(10);
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
+  write_ecmfile(em, NULL, NULL, CHAR(asChar(sexp_path)));
+  
+  free_all();
+  
+  return sexp_path;
+}
+
+
+
+//=========================================================
+// Per-sample sums, for picking a rarefaction depth.
+//=========================================================
+
+SEXP C_ecomatrix_sums(SEXP sexp_ecmfile) {
+  
+  init_n_ptrs(5);
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_ecmfile, ScalarInteger(1), 1);
+  SEXP sexp_sums  = PROTECT(allocVector(REALSXP, em->n_samples));
+  double *sums    = REAL(sexp_sums);
+  
+  for (int sam = 0; sam < em->n_samples; sam++) {
+    sums[sam] = 0;
+    for (R_xlen_t i = em->pos_vec[sam]; i < em->pos_vec[sam + 1]; i++)
+      sums[sam] += em->int_vec ? em->int_vec[i] : em->val_vec[i];
+  }
+  
+  free_all();
+  UNPROTECT(1);
+  return sexp_sums;
+}
+
+
+
+//=========================================================
+// Header fields for R-side argument validation.
+//=========================================================
+
+SEXP C_ecomatrix_info(SEXP sexp_path) {
+  
+  const char  *path = CHAR(asChar(sexp_path));
+  ecm_header_t hdr;
+  
+  FILE *fp = fopen(path, "rb");
+  if (!fp) error("Unable to open '%s'.", path);
+  
+  size_t n_read = fread(&hdr, 1, sizeof(ecm_header_t), fp);
+  fclose(fp);
+  
+  check_header(&hdr, n_read, path);
+  
+  const char *names[] = {
+    "n_samples", "n_otus", "nnz", "min_val",
+    "max_val",   "min_pos", "integral", "" };
+  
+  SEXP sexp_info = PROTECT(mkNamed(VECSXP, names));
+  
+  SET_VECTOR_ELT(sexp_info, 0, ScalarInteger(hdr.n_samples));
+  SET_VECTOR_ELT(sexp_info, 1, ScalarInteger(hdr.n_otus));
+  SET_VECTOR_ELT(sexp_info, 2, ScalarReal((double)hdr.nnz));
+  SET_VECTOR_ELT(sexp_info, 3, ScalarReal(hdr.min_val));
+  SET_VECTOR_ELT(sexp_info, 4, ScalarReal(hdr.max_val));
+  SET_VECTOR_ELT(sexp_info, 5, ScalarReal(hdr.min_pos));
+  SET_VECTOR_ELT(sexp_info, 6, ScalarLogical((hdr.flags & ECM_INTEGRAL) != 0));
+  
+  UNPROTECT(1);
+  return sexp_info;
+}
@@ -8,7 +8,7 @@
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h> // R_registerRoutines, R_useDynamicSymbols
 
-#include <inttypes.h> // uint32_t, uint64_t
+#include <inttypes.h> // uint16_t, uint32_t, uint64_t
 #include <math.h>     // exp, fabs, floor, log, lgamma, pow, round, sqrt
 #include <string.h>   // memcpy, memset, strlen, strncpy
 #include <stdlib.h>   // calloc, free, malloc, NULL, qsort, strtod
@@ -29,15 +29,21 @@ typedef void *(*pthread_func_t)(void *);
 
 // ecomatrix data structure
 typedef struct {
-  int     n_samples;
-  int     n_otus;
-  int     nnz;
-  int    *sam_vec;
-  int    *pos_vec;
-  int    *otu_vec;
-  double *val_vec;
-  double *clr_vec;
-  SEXP    sexp_sample_names;
+  int       n_samples;
+  int       n_otus;
+  R_xlen_t  nnz;
+  int      *sam_vec;
+  R_xlen_t *pos_vec; // 64-bit offsets; nnz may exceed 2^31
+  int      *otu_vec;
+  double   *val_vec;
+  int      *int_vec; // integer counts; NULL once val_vec is in use
+  float    *flt_vec; // single-precision val_vec; NULL unless requested
+  double   *clr_vec;
+  int      *otu_map; // original index of each kept OTU; NULL if unpruned
+  R_xlen_t *csc_pos_vec; // OTU-major view; NULL until build_csc()
+  int      *csc_sam_vec;
+  double   *csc_val_vec;
+  SEXP      sexp_sample_names;
 } ecomatrix_t;
 
 // ecotree data structures
@@ -58,11 +64,39 @@ typedef struct {
   int n;
 } worker_t;
 
+// `precision` argument from R.
+#define PRECISION_DOUBLE 0
+#define PRECISION_SINGLE 1
+
+// First dist_vec index (0-based) of sample i's row.
+#define PAIR_ROW_START(i, n)                                   \
+  ((R_xlen_t)(i) * (n) - (R_xlen_t)(i) * ((i) + 1) / 2)
+
 
 /* --- ecomatrix.c --- */
-ecomatrix_t* new_ecomatrix(SEXP sexp_matrix, SEXP sexp_margin);
+ecomatrix_t* new_ecomatrix(SEXP sexp_matrix, SEXP sexp_margin, int n_threads);
+ecomatrix_t* new_ecomatrix_triplet(
+    int n_samples, int n_otus, R_xlen_t nnz, int *sam_vec, 
+    int *otu_vec, double *val_vec, int n_threads );
+void prune_otus(ecomatrix_t *em, int min_prevalence, double min_abundance);
+double* dbl_val_vec(ecomatrix_t *em);
+float* flt_val_vec(ecomatrix_t *em);
 double* rw_val_vec(ecomatrix_t *em);
 double* rw_clr_vec(ecomatrix_t *em);
+void build_csc(ecomatrix_t *em, int n_threads);
+SEXP new_query_mtx(ecomatrix_t *em, int n_query);
+
+/* --- beta_div.c --- */
+pthread_func_t bdiv_pairs_setup(ecomatrix_t *em, int algorithm, int n_threads, SEXP *sexp_extra_args);
+void bdiv_pairs(pthread_func_t bdiv_func, int *pairs, R_xlen_t n, double *dist, int n_threads);
+
+/* --- distfile.c --- */
+void* new_dist_file(SEXP sexp_file, int n_samples, SEXP sexp_names, int single, int *is_float);
+SEXP C_dist_file_info(SEXP sexp_path);
+
+/* --- ecmfile.c --- */
+void parse_ecmfile(ecomatrix_t *em, SEXP sexp_ecmfile, int margin);
+void write_ecmfile(ecomatrix_t *em, uint32_t *cnt_vec, int *keep_vec, const char *path);
 
 /* --- ecotree.c --- */
 ecotree_t* new_ecotree(SEXP sexp_phylo_tree);
@@ -71,6 +105,13 @@ ecotree_t* new_ecotree(SEXP sexp_phylo_tree);
 SEXP get(SEXP, const char *);
 void set(SEXP, const char *, SEXP);
 
+/* --- knn.c --- */
+SEXP knn_alloc(int n_rows, int n_nbrs, int n_query, int k, int n_threads, SEXP sexp_names);
+void knn_add(int thread_i, int sam_i, int sam_j, double distance);
+void knn_run(pthread_func_t func, int n_threads, R_xlen_t n_tasks);
+double knn_bound(int row);
+void knn_finish(int n_threads);
+
 /* --- memory.c --- */
 void  init_n_ptrs(int n);
 void* safe_malloc(size_t bytes);
@@ -78,12 +119,23 @@ int   is_safe_ptr(void *ptr);
 void  free_all(void);
 void* free_one(void *ptr);
 void* maybe_free_one(void *ptr);
+void* safe_mmap(const char *path, size_t *n_bytes);
+void* safe_mmap_rw(const char *path, size_t *n_bytes, int create);
+void* safe_scratch(size_t n_bytes);
+int   is_mapped_ptr(void *ptr);
+SEXP  safe_preserve(SEXP sexp);
 
 /* --- normalize.c --- */
-void normalize(ecomatrix_t *em, int norm, int n_threads, int pseudocount_);
+void normalize(ecomatrix_t *em, int norm, int n_threads, double pseudocount_);
+
+/* --- pairs.c --- */
+R_xlen_t* sort_pairs(SEXP sexp_pairs_vec);
+int pair_row(R_xlen_t dist_idx, int n_samples);
+void pair_spec_setup(SEXP sexp_spec, int n_samples);
+int pair_spec_next(int sam_i, int sam_j);
 
 /* --- parallel.c --- */
-void run_parallel(pthread_func_t func, int n_threads, int n_tasks);
+void run_parallel(pthread_func_t func, int n_threads, R_xlen_t n_tasks);
 
 
 #endif
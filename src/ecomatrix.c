@@ -3,38 +3,84 @@
 
 #include "ecodive.h"
 
+static int n_threads;
+
 
 //=========================================================
 // Ensure we don't overwrite values in other R objects.
+// Vectors from a mapped file get a scratch mapping.
 //=========================================================
 
-static void rw_vec (void **ptr, int n_bytes) {
+static void *new_vec (void *src, size_t n_bytes) {
+  if (is_mapped_ptr(src)) return safe_scratch(n_bytes);
+  return safe_malloc(n_bytes);
+}
+
+static void rw_vec (void **ptr, size_t n_bytes) {
   
   if (is_safe_ptr(*ptr)) return;
   
-  void *new_ptr = safe_malloc(n_bytes);
+  void *new_ptr = new_vec(*ptr, n_bytes);
   if (*ptr) memcpy(new_ptr, *ptr, n_bytes);
   *ptr = new_ptr;
 }
 
-static int* rw_sam_vec (ecomatrix_t *em) {
-  rw_vec((void**)&(em->sam_vec), em->nnz * sizeof(int));
-  return em->sam_vec;
-}
-
-static int* rw_pos_vec (ecomatrix_t *em) {
-  int vec_len = em->n_samples + 1;
-  rw_vec((void**)&(em->pos_vec), vec_len * sizeof(int));
+static R_xlen_t* rw_pos_vec (ecomatrix_t *em) {
+  size_t vec_len = (size_t)em->n_samples + 1;
+  rw_vec((void**)&(em->pos_vec), vec_len * sizeof(R_xlen_t));
   return em->pos_vec;
 }
 
 static int* rw_otu_vec (ecomatrix_t *em) {
-  rw_vec((void**)&(em->otu_vec), em->nnz * sizeof(int));
+  rw_vec((void**)&(em->otu_vec), (size_t)em->nnz * sizeof(int));
   return em->otu_vec;
 }
 
+static int* rw_int_vec (ecomatrix_t *em) {
+  rw_vec((void**)&(em->int_vec), (size_t)em->nnz * sizeof(int));
+  return em->int_vec;
+}
+
+// Integer counts are converted to double on first request.
+double* dbl_val_vec (ecomatrix_t *em) {
+  
+  if (em->val_vec || !em->int_vec) return em->val_vec;
+  
+  R_xlen_t  nnz     = em->nnz;
+  int      *int_vec = em->int_vec;
+  double   *val_vec = (double*) new_vec(int_vec, (size_t)nnz * sizeof(double));
+  
+  for (R_xlen_t i = 0; i < nnz; i++)
+    val_vec[i] = (double)int_vec[i];
+  
+  em->val_vec = val_vec;
+  em->int_vec = maybe_free_one(int_vec);
+  
+  return val_vec;
+}
+
+// Values are narrowed to float for single-precision
+// kernels; val_vec is released.
+float* flt_val_vec (ecomatrix_t *em) {
+  
+  if (em->flt_vec) return em->flt_vec;
+  
+  R_xlen_t  nnz     = em->nnz;
+  double   *val_vec = dbl_val_vec(em);
+  float    *flt_vec = (float*) new_vec(val_vec, (size_t)nnz * sizeof(float));
+  
+  for (R_xlen_t i = 0; i < nnz; i++)
+    flt_vec[i] = (float)val_vec[i];
+  
+  em->flt_vec = flt_vec;
+  em->val_vec = maybe_free_one(val_vec);
+  
+  return flt_vec;
+}
+
 double* rw_val_vec (ecomatrix_t *em) {
-  rw_vec((void**)&(em->val_vec), em->nnz * sizeof(double));
+  dbl_val_vec(em);
+  rw_vec((void**)&(em->val_vec), (size_t)em->nnz * sizeof(double));
   return em->val_vec;
 }
 
@@ -47,6 +93,7 @@ double* rw_clr_vec (ecomatrix_t *em) {
 
 //=========================================================
 // Accept double, integer, or logical values.
+// Integer and logical values are kept as integers.
 //=========================================================
 
 static void assign_sparse_vals(ecomatrix_t *em, SEXP sexp_vals) {
@@ -56,14 +103,7 @@ static void assign_sparse_vals(ecomatrix_t *em, SEXP sexp_vals) {
   }
   
   else if (isInteger(sexp_vals) || isLogical(sexp_vals)) {
-    
-    double *val_vec = rw_val_vec(em);
-    
-    int  nnz = em->nnz;
-    int *tmp = INTEGER(sexp_vals);
-    for (int i = 0; i < nnz; i++) {
-      val_vec[i] = (double)(tmp[i]);
-    }
+    em->int_vec = INTEGER(sexp_vals);
   }
   
   else {
@@ -75,261 +115,486 @@ static void assign_sparse_vals(ecomatrix_t *em, SEXP sexp_vals) {
 
 
 
-static void assign_dense_vals(ecomatrix_t *em, SEXP sexp_vals, int margin) {
-  
-  int n_samples = em->n_samples;
-  int n_otus    = em->n_otus;
-  int mtx_len   = length(sexp_vals);
-  
-  double *dbl_vals = NULL;
-  int    *int_vals = NULL;
-  
-  
-  // Accept double, integer, or logical values.
-  // --------------------------------------------
-  
-  if (isReal(sexp_vals)) {
-    dbl_vals = REAL(sexp_vals);
-  }
-  else if (isInteger(sexp_vals) || isLogical(sexp_vals)) {
-    int_vals = INTEGER(sexp_vals);
-  }
-  else {
-    error("Input must be numeric");
-  }
-  
-  
-  // Count the number of non-zero entries.
-  // --------------------------------------------
-  
-  int nnz = 0;
-  
-  if (dbl_vals != NULL) {
-    for (int i = 0; i < mtx_len; i++) {
-      if (dbl_vals[i]) nnz++;
-    }
-  }
-  else {
-    for (int i = 0; i < mtx_len; i++) {
-      if (int_vals[i]) nnz++;
-    }
-  }
-  em->nnz = nnz;
-  
-  
-  // Allocate based on n_samples and nnz
-  int    *pos_vec = rw_pos_vec(em);
-  int    *otu_vec = rw_otu_vec(em);
-  double *val_vec = rw_val_vec(em);
-  if (!(pos_vec && otu_vec && val_vec)) return;
-  
-  pos_vec[n_samples] = nnz;
-  
-  
-  
-  // Four modes: int|dbl * margin1|margin2
-  // --------------------------------------------
-  
-  int i = 0;
+//=========================================================
+// Dense input is converted to CSR in two parallel passes.
+// First each sample's non-zeros are counted, giving
+// pos_vec; then otu_vec/val_vec are filled in place.
+// Doubles that are all whole numbers are stored as ints.
+// Samples are handled in blocks, so samples-in-rows input
+// is read as short contiguous runs down each column
+// instead of with a stride of n_rows for every value.
+//=========================================================
+
+#define DENSE_BLOCK 64
+
+static ecomatrix_t *dense_em;
+static double      *dense_dbl;
+static int         *dense_int;
+static int          dense_margin;
+static int          dense_is_integral;
+
+#define DENSE_VAL(idx) (dense_dbl ? dense_dbl[idx] : (double)dense_int[idx])
+#define IS_INTEGRAL(v) ((v) == floor(v) && fabs(v) <= 2147483647)
+
+#define FOREACH_DENSE_BLOCK(expression)                        \
+  do {                                                         \
+    int       thread_i  = ((worker_t *)arg)->i;                \
+    int       n_threads = ((worker_t *)arg)->n;                \
+    int       n_samples = dense_em->n_samples;                 \
+    int       n_otus    = dense_em->n_otus;                    \
+    R_xlen_t *pos_vec   = dense_em->pos_vec;                   \
+    int       sam_begin = thread_i * DENSE_BLOCK;              \
+                                                               \
+    for (; sam_begin < n_samples; sam_begin += n_threads * DENSE_BLOCK) {\
+      int sam_end = sam_begin + DENSE_BLOCK;                   \
+      if (sam_end > n_samples) sam_end = n_samples;            \
+                                                               \
+      expression;                                              \
+    }                                                          \
+    (void)n_otus;                                              \
+    (void)pos_vec;                                             \
+  } while (0)
+
+
+// Stores each sample's non-zero count in pos_vec[sam + 1].
+static void *count_dense(void *arg) {
   
-  if (margin == 1) {
+  FOREACH_DENSE_BLOCK(
     
-    int n_rows = n_samples;
-    int n_cols = n_otus;
+    for (int sam = sam_begin; sam < sam_end; sam++)
+      pos_vec[sam + 1] = 0;
     
-    if (dbl_vals != NULL) { // Importing doubles
-      
-      for (int row = 0; row < n_rows; row++) {
-        pos_vec[row] = i;
-        for (int col = 0; col < n_cols; col++) {
-          double v = dbl_vals[row + n_rows * col];
+    int is_integral = 1;
+    
+    if (dense_margin == 1) { // samples are in rows
+      for (int otu = 0; otu < n_otus; otu++) {
+        size_t col = (size_t)otu * n_samples;
+        for (int sam = sam_begin; sam < sam_end; sam++) {
+          double v = DENSE_VAL(col + sam);
           if (v) {
-            otu_vec[i] = col;
-            val_vec[i] = v;
-            i++;
+            pos_vec[sam + 1]++;
+            if (!IS_INTEGRAL(v)) is_integral = 0;
           }
         }
       }
-      
     }
-    else { // Importing integers/logicals
-      
-      for (int row = 0; row < n_rows; row++) {
-        pos_vec[row] = i;
-        for (int col = 0; col < n_cols; col++) {
-          int v = int_vals[row + n_rows * col];
+    
+    else { // samples are in columns
+      for (int sam = sam_begin; sam < sam_end; sam++) {
+        size_t col = (size_t)sam * n_otus;
+        int    nnz = 0;
+        for (int otu = 0; otu < n_otus; otu++) {
+          double v = DENSE_VAL(col + otu);
           if (v) {
-            otu_vec[i] = col;
-            val_vec[i] = (double)v;
-            i++;
+            nnz++;
+            if (!IS_INTEGRAL(v)) is_integral = 0;
           }
         }
+        pos_vec[sam + 1] = nnz;
       }
-      
     }
     
-  }
-  else { // margin == 2
-    
-    int n_cols = n_samples;
-    int n_rows = n_otus;
-    
-    if (dbl_vals != NULL) { // Importing doubles
+    if (!is_integral) dense_is_integral = 0;
+  );
+  
+  return NULL;
+}
+
+
+static void *fill_dense(void *arg) {
+  
+  int    *otu_vec = dense_em->otu_vec;
+  double *val_vec = dense_em->val_vec;
+  int    *int_vec = dense_em->int_vec;
+  
+  FOREACH_DENSE_BLOCK(
     
-      for (int col = 0; col < n_cols; col++) {
-        pos_vec[col] = i;
-        for (int row = 0; row < n_rows; row++) {
-          double v = dbl_vals[row + n_rows * col];
+    if (dense_margin == 1) { // samples are in rows
+      
+      R_xlen_t cursor[DENSE_BLOCK];
+      for (int sam = sam_begin; sam < sam_end; sam++)
+        cursor[sam - sam_begin] = pos_vec[sam];
+      
+      for (int otu = 0; otu < n_otus; otu++) {
+        size_t col = (size_t)otu * n_samples;
+        for (int sam = sam_begin; sam < sam_end; sam++) {
+          double v = DENSE_VAL(col + sam);
           if (v) {
-            otu_vec[i] = row;
-            val_vec[i] = v;
-            i++;
+            R_xlen_t i = cursor[sam - sam_begin]++;
+            otu_vec[i] = otu;
+            if (int_vec) { int_vec[i] = (int)v; }
+            else         { val_vec[i] = v;      }
           }
         }
       }
-      
     }
-    else { // Importing integers/logicals
-      
-      for (int col = 0; col < n_cols; col++) {
-        pos_vec[col] = i;
-        for (int row = 0; row < n_rows; row++) {
-          int v = int_vals[row + n_rows * col];
+    
+    else { // samples are in columns
+      for (int sam = sam_begin; sam < sam_end; sam++) {
+        size_t   col = (size_t)sam * n_otus;
+        R_xlen_t i   = pos_vec[sam];
+        for (int otu = 0; otu < n_otus; otu++) {
+          double v = DENSE_VAL(col + otu);
           if (v) {
-            otu_vec[i] = row;
-            val_vec[i] = (double)v;
+            otu_vec[i] = otu;
+            if (int_vec) { int_vec[i] = (int)v; }
+            else         { val_vec[i] = v;      }
             i++;
           }
         }
       }
-      
     }
-    
+  );
+  
+  return NULL;
+}
+
+
+static void assign_dense_vals(ecomatrix_t *em, SEXP sexp_vals, int margin) {
+  
+  int n_samples = em->n_samples;
+  
+  dense_em     = em;
+  dense_dbl    = NULL;
+  dense_int    = NULL;
+  dense_margin = margin;
+  
+  dense_is_integral = 1;
+  
+  
+  // Accept double, integer, or logical values.
+  // --------------------------------------------
+  
+  if (isReal(sexp_vals)) {
+    dense_dbl = REAL(sexp_vals);
+  }
+  else if (isInteger(sexp_vals) || isLogical(sexp_vals)) {
+    dense_int = INTEGER(sexp_vals);
+  }
+  else {
+    error("Input must be numeric");
   }
   
   
+  // Count non-zeros per sample, then prefix sum.
+  // --------------------------------------------
+  
+  R_xlen_t *pos_vec = rw_pos_vec(em);
+  run_parallel(count_dense, n_threads, n_samples);
+  
+  pos_vec[0] = 0;
+  for (int sam = 0; sam < n_samples; sam++)
+    pos_vec[sam + 1] += pos_vec[sam];
+  
+  em->nnz = pos_vec[n_samples];
+  
+  
+  // Allocate based on nnz and fill per sample.
+  // --------------------------------------------
+  
+  rw_otu_vec(em);
+  if (dense_is_integral) { rw_int_vec(em); }
+  else                   { rw_val_vec(em); }
+  run_parallel(fill_dense, n_threads, n_samples);
 }
 
 
 
 //=========================================================
-// Sorts an uncompressed sparse matrix's vectors.
+// Sorts one sample's OTUs, carrying values along. Exactly
+// one of val_vec and int_vec is non-NULL.
+// Insertion sort for short runs, else heapsort; both are
+// in-place and non-recursive.
 //=========================================================
 
-static void sort_triplet_q (int *sam_vec, int *otu_vec, double *val_vec, int lo, int hi) {
-  
-  int    sam, otu;
-  double val;
-  
-  int pivot_sam = sam_vec[hi];
-  int pivot_otu = otu_vec[hi];
-  int i = lo;
-  
-  for (int j = lo; j <= hi - 1; j++) {
-    
-    sam = sam_vec[j];
-    
-    if (sam < pivot_sam || (sam == pivot_sam && otu_vec[j] < pivot_otu)) {
-      sam = sam_vec[i]; sam_vec[i] = sam_vec[j]; sam_vec[j] = sam;
-      otu = otu_vec[i]; otu_vec[i] = otu_vec[j]; otu_vec[j] = otu;
-      val = val_vec[i]; val_vec[i] = val_vec[j]; val_vec[j] = val;
-      i++;
-    }
+#define SWAP_OTU_VAL(a, b)                                     \
+  do {                                                         \
+    int otu = otu_vec[a]; otu_vec[a] = otu_vec[b]; otu_vec[b] = otu; \
+    if (val_vec) {                                             \
+      double val = val_vec[a]; val_vec[a] = val_vec[b]; val_vec[b] = val; \
+    } else {                                                   \
+      int    cnt = int_vec[a]; int_vec[a] = int_vec[b]; int_vec[b] = cnt; \
+    }                                                          \
+  } while (0)
+
+static void sift_otu_val (int *otu_vec, double *val_vec, int *int_vec, int root, int n) {
+  
+  while (1) {
+    int child = 2 * root + 1;
+    if (child >= n) return;
+    if (child + 1 < n && otu_vec[child + 1] > otu_vec[child]) child++;
+    if (otu_vec[root] >= otu_vec[child]) return;
+    SWAP_OTU_VAL(root, child);
+    root = child;
   }
+}
+
+static void sort_otu_val (int *otu_vec, double *val_vec, int *int_vec, int n) {
   
-  sam = sam_vec[i]; sam_vec[i] = sam_vec[hi]; sam_vec[hi] = sam;
-  otu = otu_vec[i]; otu_vec[i] = otu_vec[hi]; otu_vec[hi] = otu;
-  val = val_vec[i]; val_vec[i] = val_vec[hi]; val_vec[hi] = val;
+  if (n <= 32) {
+    for (int i = 1; i < n; i++)
+      for (int j = i; j > 0 && otu_vec[j - 1] > otu_vec[j]; j--)
+        SWAP_OTU_VAL(j - 1, j);
+    return;
+  }
   
-  if (lo < i - 1) sort_triplet_q(sam_vec, otu_vec, val_vec, lo, i - 1);
-  if (i + 1 < hi) sort_triplet_q(sam_vec, otu_vec, val_vec, i + 1, hi);
+  for (int i = n / 2 - 1; i >= 0; i--)
+    sift_otu_val(otu_vec, val_vec, int_vec, i, n);
   
+  for (int i = n - 1; i > 0; i--) {
+    SWAP_OTU_VAL(0, i);
+    sift_otu_val(otu_vec, val_vec, int_vec, 0, i);
+  }
+}
+
+
+
+//=========================================================
+// Bucket non-zero values by sample with a counting sort.
+// 
+// The input is split into chunks, each of which builds a
+// histogram of its sample indices. A prefix sum over 
+// (sample, chunk) gives every chunk its own write offsets,
+// and the chunks then scatter otu/val in parallel. The
+// scatter is stable: within a sample, values keep their
+// input order.
+// 
+// Chunks are ranges of triplets, or for a dgCMatrix with
+// samples in rows (bucket_col_ptr set), ranges of columns,
+// which makes the result an O(nnz) CSC to CSR transpose.
+// `bucket_base` is subtracted from the input indices (1 
+// for slam, 0 for Matrix).
+//=========================================================
+
+static ecomatrix_t *bucket_em;
+static int         *bucket_sam_vec;
+static int         *bucket_otu_vec;
+static double      *bucket_val_vec;
+static int         *bucket_int_vec;
+static int         *bucket_col_ptr;
+static R_xlen_t    *bucket_hist_mtx;
+static int          bucket_n_chunks;
+static int          bucket_base;
+
+#define FOREACH_CHUNK(expression)                              \
+  do {                                                         \
+    int thread_i  = ((worker_t *)arg)->i;                      \
+    int n_threads = ((worker_t *)arg)->n;                      \
+    int n_samples = bucket_em->n_samples;                      \
+    R_xlen_t n_units = bucket_col_ptr ? bucket_em->n_otus : bucket_em->nnz; \
+                                                               \
+    for (int chunk = thread_i; chunk < bucket_n_chunks; chunk += n_threads) { \
+      R_xlen_t *hist_vec   = bucket_hist_mtx + (size_t)chunk * n_samples; \
+      R_xlen_t  unit_begin = (R_xlen_t)((double)n_units *  chunk      / bucket_n_chunks); \
+      R_xlen_t  unit_end   = (R_xlen_t)((double)n_units * (chunk + 1) / bucket_n_chunks); \
+      R_xlen_t  k_begin    = bucket_col_ptr ? bucket_col_ptr[unit_begin] : unit_begin; \
+      R_xlen_t  k_end      = bucket_col_ptr ? bucket_col_ptr[unit_end]   : unit_end;   \
+                                                               \
+      expression;                                              \
+    }                                                          \
+  } while (0)
+
+static void *histogram_samples(void *arg) {
+  FOREACH_CHUNK(
+    memset(hist_vec, 0, n_samples * sizeof(R_xlen_t));
+    for (R_xlen_t k = k_begin; k < k_end; k++)
+      hist_vec[bucket_sam_vec[k] - bucket_base]++;
+  );
+  return NULL;
+}
+
+static void *scatter_triplet(void *arg) {
+  
+  int    *otu_vec = bucket_em->otu_vec;
+  double *val_vec = bucket_em->val_vec;
+  int    *int_vec = bucket_em->int_vec;
+  
+  FOREACH_CHUNK(
+    for (R_xlen_t k = k_begin; k < k_end; k++) {
+      R_xlen_t i = hist_vec[bucket_sam_vec[k] - bucket_base]++;
+      otu_vec[i] = bucket_otu_vec[k] - bucket_base;
+      if (int_vec) { int_vec[i] = bucket_int_vec[k]; }
+      else         { val_vec[i] = bucket_val_vec[k]; }
+    }
+  );
+  return NULL;
+}
+
+static void *scatter_csc(void *arg) {
+  
+  int    *otu_vec = bucket_em->otu_vec;
+  double *val_vec = bucket_em->val_vec;
+  int    *int_vec = bucket_em->int_vec;
+  
+  FOREACH_CHUNK(
+    (void)k_begin; (void)k_end;
+    for (int col = (int)unit_begin; col < unit_end; col++) {
+      int end = bucket_col_ptr[col + 1];
+      for (int k = bucket_col_ptr[col]; k < end; k++) {
+        R_xlen_t i = hist_vec[bucket_sam_vec[k]]++;
+        otu_vec[i] = col;
+        if (int_vec) { int_vec[i] = bucket_int_vec[k]; }
+        else         { val_vec[i] = bucket_val_vec[k]; }
+      }
+    }
+  );
+  return NULL;
 }
 
-static void sort_triplet (ecomatrix_t *em) {
+static void bucket_samples (ecomatrix_t *em, pthread_func_t scatter_func) {
   
-  int     nnz     = em->nnz;
-  int    *sam_vec = em->sam_vec;
-  int    *otu_vec = em->otu_vec;
-  double *val_vec = em->val_vec;
+  int       n_samples = em->n_samples;
+  R_xlen_t  nnz       = em->nnz;
+  R_xlen_t *pos_vec   = rw_pos_vec(em);
   
   
-  // Check if it's already sorted
+  // Per-chunk histograms, at most one offset per value.
   // --------------------------------------------
   
-  if (nnz < 2) return;
+  R_xlen_t n_chunks = n_threads;
+  if (n_chunks > nnz / n_samples)                   n_chunks = nnz / n_samples;
+  if (bucket_col_ptr && n_chunks > em->n_otus)      n_chunks = em->n_otus;
+  if (n_chunks < 1)                                 n_chunks = 1;
   
-  int sorted = 1;
-  for (int i = 1; i < nnz; i++) {
-    int s1 = sam_vec[i-1];
-    int s2 = sam_vec[i];
-    if (s1 == s2) {
-      if (otu_vec[i-1] > otu_vec[i]) {
-        sorted = 0;
-        break;
-      }
-    }
-    else if (s1 > s2) {
-      sorted = 0;
-      break;
+  bucket_em       = em;
+  bucket_sam_vec  = em->sam_vec;
+  bucket_otu_vec  = em->otu_vec;
+  bucket_val_vec  = em->val_vec;
+  bucket_int_vec  = em->int_vec;
+  bucket_n_chunks = (int)n_chunks;
+  bucket_hist_mtx = (R_xlen_t*) safe_malloc((size_t)n_chunks * n_samples * sizeof(R_xlen_t));
+  
+  run_parallel(histogram_samples, n_threads, nnz);
+  
+  
+  // Prefix sum: sample-major, then chunk order.
+  // --------------------------------------------
+  
+  R_xlen_t p = 0;
+  for (int sam = 0; sam < n_samples; sam++) {
+    pos_vec[sam] = p;
+    for (int chunk = 0; chunk < n_chunks; chunk++) {
+      R_xlen_t *hist  = bucket_hist_mtx + (size_t)chunk * n_samples + sam;
+      R_xlen_t  count = *hist;
+      *hist           = p;
+      p              += count;
     }
   }
-  
-  if (sorted) return;
+  pos_vec[n_samples] = nnz;
   
   
-  // Make sure we're not modifying original data.
+  // Scatter into new otu/val vectors.
   // --------------------------------------------
-  sam_vec = rw_sam_vec(em);
-  otu_vec = rw_otu_vec(em);
-  val_vec = rw_val_vec(em);
   
-  sort_triplet_q(sam_vec, otu_vec, val_vec, 0, nnz - 1);
+  em->otu_vec = (int*) safe_malloc((size_t)nnz * sizeof(int));
+  if (em->int_vec) { em->int_vec = (int*)    safe_malloc((size_t)nnz * sizeof(int));    }
+  else             { em->val_vec = (double*) safe_malloc((size_t)nnz * sizeof(double)); }
+  
+  run_parallel(scatter_func, n_threads, nnz);
+  
+  free_one(bucket_hist_mtx);
+  maybe_free_one(bucket_otu_vec);
+  maybe_free_one(bucket_val_vec);
+  maybe_free_one(bucket_int_vec);
+  em->sam_vec = maybe_free_one(em->sam_vec);
 }
 
 
 
 //=========================================================
 // Reorder sam/otu/val by sam/otu, then populate pos.
+// Only samples whose OTUs arrived out of order need the
+// per-sample sort after bucketing.
 //=========================================================
-static void compress_triplet (ecomatrix_t *em) {
+
+static void *sort_sample_otus(void *arg) {
+  
+  int     thread_i  = ((worker_t *)arg)->i;
+  int     n_threads = ((worker_t *)arg)->n;
+  int     n_samples = bucket_em->n_samples;
+  R_xlen_t *pos_vec   = bucket_em->pos_vec;
+  int      *otu_vec   = bucket_em->otu_vec;
+  double   *val_vec   = bucket_em->val_vec;
+  int      *int_vec   = bucket_em->int_vec;
+  
+  for (int sam = thread_i; sam < n_samples; sam += n_threads) {
+    R_xlen_t begin = pos_vec[sam];
+    R_xlen_t end   = pos_vec[sam + 1];
+    for (R_xlen_t i = begin + 1; i < end; i++) {
+      if (otu_vec[i - 1] > otu_vec[i]) {
+        sort_otu_val(
+          otu_vec + begin, 
+          val_vec ? val_vec + begin : NULL, 
+          int_vec ? int_vec + begin : NULL, 
+          (int)(end - begin) );
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void compress_triplet (ecomatrix_t *em, int base) {
+  
+  int       n_samples = em->n_samples;
+  R_xlen_t  nnz       = em->nnz;
+  int      *sam_vec   = em->sam_vec;
+  int      *otu_vec   = em->otu_vec;
   
-  sort_triplet(em);
   
-  int  n_samples = em->n_samples;
-  int  nnz       = em->nnz;
-  int *sam_vec   = em->sam_vec;
-  int *pos_vec   = rw_pos_vec(em);
+  // Check if it's already sorted
+  // --------------------------------------------
   
-  int p = 0;
-  for (int i = 0; i < n_samples; i++) {
-    pos_vec[i] = p;
-    while (p < nnz && sam_vec[p] == i) p++;
+  int sorted = 1;
+  for (R_xlen_t i = 1; i < nnz; i++) {
+    int s1 = sam_vec[i-1];
+    int s2 = sam_vec[i];
+    if (s1 > s2 || (s1 == s2 && otu_vec[i-1] > otu_vec[i])) {
+      sorted = 0;
+      break;
+    }
   }
-  pos_vec[n_samples] = nnz;
   
-  em->sam_vec = maybe_free_one(em->sam_vec);
+  if (sorted) {
+    
+    R_xlen_t *pos_vec = rw_pos_vec(em);
+    
+    R_xlen_t p = 0;
+    for (int i = 0; i < n_samples; i++) {
+      pos_vec[i] = p;
+      while (p < nnz && sam_vec[p] - base == i) p++;
+    }
+    pos_vec[n_samples] = nnz;
+    
+    if (base) {
+      otu_vec = rw_otu_vec(em);
+      for (R_xlen_t i = 0; i < nnz; i++) otu_vec[i] -= base;
+    }
+    
+    em->sam_vec = maybe_free_one(em->sam_vec);
+    return;
+  }
+  
+  bucket_col_ptr = NULL;
+  bucket_base    = base;
+  bucket_samples(em, scatter_triplet);
+  
+  run_parallel(sort_sample_otus, n_threads, n_samples);
 }
 
 
 
 //=========================================================
-// Convert pos_vec to otu_vec.
+// Transpose a dgCMatrix with samples in rows. Columns are
+// scattered in ascending order, so each sample's OTUs come
+// out sorted with no further work.
 //=========================================================
-static void inflate_triplet_otus (ecomatrix_t *em) {
-  
-  int  n_otus  = em->n_otus;
-  int *pos_vec = em->pos_vec;
-  int *otu_vec = rw_otu_vec(em);
-  
-  for (int otu = 0; otu < n_otus; otu++) {
-    int end = pos_vec[otu + 1];
-    for (int i = pos_vec[otu]; i < end; i++) {
-      otu_vec[i] = otu;
-    }
-  }
+static void transpose_csc (ecomatrix_t *em, int *col_ptr) {
   
-  em->pos_vec = maybe_free_one(em->pos_vec);
+  bucket_col_ptr = col_ptr;
+  bucket_base    = 0;
+  bucket_samples(em, scatter_csc);
+  bucket_col_ptr = NULL;
 }
 
 
@@ -419,10 +684,10 @@ static void parse_slam (ecomatrix_t *em, SEXP sexp_slam_mtx, int margin) {
   SEXP sexp_dimnames = PROTECT(get(sexp_slam_mtx, "dimnames"));
   int  n_rows        = asInteger(get(sexp_slam_mtx, "nrow"));
   int  n_cols        = asInteger(get(sexp_slam_mtx, "ncol"));
-  int  nnz           = length(sexp_slam_v);
+  R_xlen_t nnz       = xlength(sexp_slam_v);
   
   
-  // Import values as double precision
+  // Import values; integers stay as integers
   em->nnz = nnz;
   assign_sparse_vals(em, sexp_slam_v);
   
@@ -456,20 +721,8 @@ static void parse_slam (ecomatrix_t *em, SEXP sexp_slam_mtx, int margin) {
   // debug_ecomatrix(em, "Before ingest");
   
   
-  // Slam indices are 1-based. Convert to 0-based.
-  //-------------------------------------------------------
-  
-  int *sam_vec = rw_sam_vec(em);
-  int *otu_vec = rw_otu_vec(em);
-  
-  for (int i = 0; i < nnz; i++) {
-    sam_vec[i]--;
-    otu_vec[i]--;
-  }
-  
-  
-  // Compress and cleanup
-  compress_triplet(em);
+  // Compress and cleanup. Slam indices are 1-based.
+  compress_triplet(em, 1);
   
   if (!isNull(sexp_dimnames)) UNPROTECT(1);
   UNPROTECT(4);
@@ -492,10 +745,10 @@ static void parse_dgTMatrix (ecomatrix_t *em, SEXP sexp_dgTMatrix, int margin) {
   SEXP sexp_dimnames = PROTECT(R_do_slot(sexp_dgTMatrix, install("Dimnames")));
   int  n_rows        = INTEGER(sexp_dim)[0];
   int  n_cols        = INTEGER(sexp_dim)[1];
-  int  nnz           = length(sexp_dgt_x);
+  R_xlen_t nnz       = xlength(sexp_dgt_x);
   
   
-  // Import values as double precision
+  // Import values; integers stay as integers
   em->nnz = nnz;
   assign_sparse_vals(em, sexp_dgt_x);
   
@@ -520,7 +773,7 @@ static void parse_dgTMatrix (ecomatrix_t *em, SEXP sexp_dgTMatrix, int margin) {
   }
   
   
-  compress_triplet(em);
+  compress_triplet(em, 0);
   UNPROTECT(5);
 } 
 
@@ -540,10 +793,10 @@ static void parse_dgCMatrix (ecomatrix_t *em, SEXP sexp_dgCMatrix, int margin) {
   SEXP sexp_dimnames = PROTECT(R_do_slot(sexp_dgCMatrix, install("Dimnames")));
   int  n_rows        = INTEGER(sexp_dim)[0];
   int  n_cols        = INTEGER(sexp_dim)[1];
-  int  nnz           = length(sexp_dgc_x);
+  R_xlen_t nnz       = xlength(sexp_dgc_x);
   
   
-  // Import values as double precision
+  // Import values; integers stay as integers
   em->nnz = nnz;
   assign_sparse_vals(em, sexp_dgc_x);
   
@@ -554,20 +807,22 @@ static void parse_dgCMatrix (ecomatrix_t *em, SEXP sexp_dgCMatrix, int margin) {
     em->n_samples         = n_rows; // samples are in rows
     em->n_otus            = n_cols; // OTUs are in columns
     em->sam_vec           = INTEGER(sexp_dgc_i);
-    em->pos_vec           = INTEGER(sexp_dgc_p);
     em->sexp_sample_names = VECTOR_ELT(sexp_dimnames, 0);
     
-    inflate_triplet_otus(em);
-    compress_triplet(em);
+    transpose_csc(em, INTEGER(sexp_dgc_p));
   }
   
   else { // margin == 2
     
     em->n_samples         = n_cols; // samples are in columns
     em->n_otus            = n_rows; // OTUs are in rows
-    em->pos_vec           = INTEGER(sexp_dgc_p);
     em->otu_vec           = INTEGER(sexp_dgc_i);
     em->sexp_sample_names = VECTOR_ELT(sexp_dimnames, 1);
+    
+    // Widen column pointers to 64-bit offsets.
+    int      *dgc_p   = INTEGER(sexp_dgc_p);
+    R_xlen_t *pos_vec = rw_pos_vec(em);
+    for (int i = 0; i <= n_cols; i++) pos_vec[i] = dgc_p[i];
   }
   
   UNPROTECT(5);
@@ -576,23 +831,236 @@ static void parse_dgCMatrix (ecomatrix_t *em, SEXP sexp_dgCMatrix, int margin) {
 
 
 //=========================================================
-// Initialize a new ecomatrix_t struct.
+// Drop rare features after ingest: those found in fewer
+// than min_prevalence samples or whose values sum to less
+// than min_abundance. The defaults (1 and 0) are a no-op;
+// any other setting drops all-zero features as well.
+// 
+// Kept OTUs are renumbered 0..k-1, so per-OTU buffers
+// downstream shrink to k. otu_map records each one's
+// original index, for looking up tips in a tree.
+// 
+// Only the diversity entry points call this. Files,
+// indexes, and sketches must keep every feature, since
+// pruning depends on which samples are in the table.
 //=========================================================
-ecomatrix_t* new_ecomatrix(SEXP sexp_matrix, SEXP sexp_margin) {
+
+void prune_otus (ecomatrix_t *em, int min_prevalence, double min_abundance) {
   
-  int margin = asInteger(sexp_margin);
+  if (min_prevalence <= 1 && min_abundance <= 0) return;
   
+  int       n_samples = em->n_samples;
+  int       n_otus    = em->n_otus;
+  R_xlen_t  nnz       = em->nnz;
+  int      *otu_vec   = em->otu_vec;
+  double   *val_vec   = em->val_vec;
+  int      *int_vec   = em->int_vec;
   
-  // function to run
-  void (*parse_func)(ecomatrix_t*, SEXP, int) = NULL;
   
-  if      (isMatrix(sexp_matrix))                          { parse_func = parse_matrix;    }
-  else if (inherits(sexp_matrix, "simple_triplet_matrix")) { parse_func = parse_slam;      }
-  else if (inherits(sexp_matrix, "dgCMatrix"))             { parse_func = parse_dgCMatrix; }
-  else if (inherits(sexp_matrix, "dgTMatrix"))             { parse_func = parse_dgTMatrix; }
-  else if (inherits(sexp_matrix, "dgeMatrix"))             { parse_func = parse_dgeMatrix; }
-  else    { error("Unrecognized matrix format."); } // # nocov
+  // Tally prevalence and abundance per OTU.
+  // --------------------------------------------
+  
+  int    *remap_vec = (int*)    safe_malloc(n_otus * sizeof(int));
+  double *abund_vec = (double*) safe_malloc(n_otus * sizeof(double));
+  memset(remap_vec, 0, n_otus * sizeof(int));
+  memset(abund_vec, 0, n_otus * sizeof(double));
+  
+  for (R_xlen_t i = 0; i < nnz; i++) {
+    remap_vec[otu_vec[i]]++;
+    abund_vec[otu_vec[i]] += int_vec ? int_vec[i] : val_vec[i];
+  }
+  
+  int n_kept = 0;
+  for (int otu = 0; otu < n_otus; otu++) {
+    int keep = remap_vec[otu] >= min_prevalence && abund_vec[otu] >= min_abundance;
+    remap_vec[otu] = keep ? n_kept++ : -1;
+  }
+  free_one(abund_vec);
+  
+  if (n_kept == n_otus) { free_one(remap_vec); return; }
+  
+  if (n_kept == 0) {
+    free_all();
+    error("No features meet the `min_prevalence` and `min_abundance` thresholds.");
+  }
+  
+  int *otu_map = (int*) safe_malloc(n_kept * sizeof(int));
+  for (int otu = 0; otu < n_otus; otu++)
+    if (remap_vec[otu] >= 0) otu_map[remap_vec[otu]] = otu;
+  
+  
+  // Compact each sample in place.
+  // --------------------------------------------
+  
+  R_xlen_t *pos_vec = rw_pos_vec(em);
+  otu_vec = rw_otu_vec(em);
+  if (int_vec) {
+    int_vec = rw_int_vec(em);
+  } else {
+    // Not rw_val_vec(), which would promote int counts.
+    rw_vec((void**)&(em->val_vec), (size_t)nnz * sizeof(double));
+    val_vec = em->val_vec;
+  }
   
+  R_xlen_t j = 0;
+  for (int sam = 0; sam < n_samples; sam++) {
+    R_xlen_t begin = pos_vec[sam];
+    R_xlen_t end   = pos_vec[sam + 1];
+    pos_vec[sam]   = j;
+    for (R_xlen_t i = begin; i < end; i++) {
+      int otu = remap_vec[otu_vec[i]];
+      if (otu < 0) continue;
+      otu_vec[j] = otu;
+      if (int_vec) { int_vec[j] = int_vec[i]; }
+      else         { val_vec[j] = val_vec[i]; }
+      j++;
+    }
+  }
+  pos_vec[n_samples] = j;
+  
+  free_one(remap_vec);
+  
+  em->nnz     = j;
+  em->n_otus  = n_kept;
+  em->otu_map = otu_map;
+}
+
+
+
+//=========================================================
+// OTU-major (CSC) view of the sample-major data, for
+// per-feature work. Built on first request with the same
+// parallel counting sort as bucket_samples(), but chunked
+// over ranges of samples and bucketed by OTU. Chunks are
+// scattered in sample order, so each OTU's samples come
+// out sorted.
+// 
+// Values are copied as doubles, as they stand at the time
+// of the call; build after normalize().
+//=========================================================
+
+static ecomatrix_t *csc_em;
+static R_xlen_t    *csc_hist_mtx;
+static int         *csc_chunk_vec;
+static int          csc_n_chunks;
+
+static void *histogram_otus(void *arg) {
+  
+  int       thread_i  = ((worker_t *)arg)->i;
+  int       n_threads = ((worker_t *)arg)->n;
+  int       n_otus    = csc_em->n_otus;
+  R_xlen_t *pos_vec   = csc_em->pos_vec;
+  int      *otu_vec   = csc_em->otu_vec;
+  
+  for (int chunk = thread_i; chunk < csc_n_chunks; chunk += n_threads) {
+    R_xlen_t *hist_vec = csc_hist_mtx + (size_t)chunk * n_otus;
+    R_xlen_t  i_end    = pos_vec[csc_chunk_vec[chunk + 1]];
+    memset(hist_vec, 0, n_otus * sizeof(R_xlen_t));
+    for (R_xlen_t i = pos_vec[csc_chunk_vec[chunk]]; i < i_end; i++)
+      hist_vec[otu_vec[i]]++;
+  }
+  
+  return NULL;
+}
+
+static void *scatter_otus(void *arg) {
+  
+  int       thread_i  = ((worker_t *)arg)->i;
+  int       n_threads = ((worker_t *)arg)->n;
+  int       n_otus    = csc_em->n_otus;
+  R_xlen_t *pos_vec   = csc_em->pos_vec;
+  int      *otu_vec   = csc_em->otu_vec;
+  double   *val_vec   = csc_em->val_vec;
+  int      *int_vec   = csc_em->int_vec;
+  int      *sam_vec   = csc_em->csc_sam_vec;
+  double   *cval_vec  = csc_em->csc_val_vec;
+  
+  for (int chunk = thread_i; chunk < csc_n_chunks; chunk += n_threads) {
+    R_xlen_t *hist_vec = csc_hist_mtx + (size_t)chunk * n_otus;
+    for (int sam = csc_chunk_vec[chunk]; sam < csc_chunk_vec[chunk + 1]; sam++) {
+      for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++) {
+        R_xlen_t j  = hist_vec[otu_vec[i]]++;
+        sam_vec[j]  = sam;
+        cval_vec[j] = int_vec ? int_vec[i] : val_vec[i];
+      }
+    }
+  }
+  
+  return NULL;
+}
+
+void build_csc (ecomatrix_t *em, int n_threads) {
+  
+  if (em->csc_pos_vec) return;
+  
+  int       n_samples = em->n_samples;
+  int       n_otus    = em->n_otus;
+  R_xlen_t  nnz       = em->nnz;
+  R_xlen_t *pos_vec   = em->pos_vec;
+  
+  
+  // Sample ranges holding roughly equal numbers of values.
+  // --------------------------------------------
+  
+  R_xlen_t n_chunks = n_threads;
+  if (n_otus && n_chunks > nnz / n_otus) n_chunks = nnz / n_otus;
+  if (n_chunks > n_samples)              n_chunks = n_samples;
+  if (n_chunks < 1)                      n_chunks = 1;
+  
+  csc_em        = em;
+  csc_n_chunks  = (int)n_chunks;
+  csc_chunk_vec = (int*) safe_malloc((n_chunks + 1) * sizeof(int));
+  
+  csc_chunk_vec[0] = 0;
+  for (int chunk = 1, sam = 0; chunk < n_chunks; chunk++) {
+    R_xlen_t target = (R_xlen_t)((double)nnz * chunk / n_chunks);
+    while (sam < n_samples && pos_vec[sam] < target) sam++;
+    csc_chunk_vec[chunk] = sam;
+  }
+  csc_chunk_vec[n_chunks] = n_samples;
+  
+  csc_hist_mtx = (R_xlen_t*) safe_malloc((size_t)n_chunks * n_otus * sizeof(R_xlen_t));
+  run_parallel(histogram_otus, n_threads, nnz);
+  
+  
+  // Prefix sum: OTU-major, then chunk order.
+  // --------------------------------------------
+  
+  R_xlen_t *csc_pos_vec = (R_xlen_t*) safe_malloc(((size_t)n_otus + 1) * sizeof(R_xlen_t));
+  
+  R_xlen_t p = 0;
+  for (int otu = 0; otu < n_otus; otu++) {
+    csc_pos_vec[otu] = p;
+    for (int chunk = 0; chunk < n_chunks; chunk++) {
+      R_xlen_t *hist  = csc_hist_mtx + (size_t)chunk * n_otus + otu;
+      R_xlen_t  count = *hist;
+      *hist           = p;
+      p              += count;
+    }
+  }
+  csc_pos_vec[n_otus] = nnz;
+  
+  
+  // Scatter samples and values.
+  // --------------------------------------------
+  
+  em->csc_sam_vec = (int*)    safe_malloc(((size_t)nnz + 1) * sizeof(int));
+  em->csc_val_vec = (double*) safe_malloc(((size_t)nnz + 1) * sizeof(double));
+  
+  run_parallel(scatter_otus, n_threads, nnz);
+  
+  free_one(csc_hist_mtx);
+  free_one(csc_chunk_vec);
+  
+  em->csc_pos_vec = csc_pos_vec;
+}
+
+
+
+//=========================================================
+// Initialize a new ecomatrix_t struct.
+//=========================================================
+static ecomatrix_t* alloc_ecomatrix (void) {
   
   ecomatrix_t *em       = (ecomatrix_t*) safe_malloc(sizeof(ecomatrix_t));
   em->n_samples         = 0;
@@ -602,11 +1070,108 @@ ecomatrix_t* new_ecomatrix(SEXP sexp_matrix, SEXP sexp_margin) {
   em->pos_vec           = NULL;
   em->otu_vec           = NULL;
   em->val_vec           = NULL;
+  em->int_vec           = NULL;
+  em->flt_vec           = NULL;
   em->clr_vec           = NULL;
+  em->otu_map           = NULL;
+  em->csc_pos_vec       = NULL;
+  em->csc_sam_vec       = NULL;
+  em->csc_val_vec       = NULL;
   em->sexp_sample_names = R_NilValue;
   
+  return em;
+}
+
+
+ecomatrix_t* new_ecomatrix(SEXP sexp_matrix, SEXP sexp_margin, int n_threads_) {
+  
+  int margin = asInteger(sexp_margin);
+  n_threads  = n_threads_;
+  
+  
+  // function to run
+  void (*parse_func)(ecomatrix_t*, SEXP, int) = NULL;
+  
+  if      (isMatrix(sexp_matrix))                          { parse_func = parse_matrix;    }
+  else if (inherits(sexp_matrix, "simple_triplet_matrix")) { parse_func = parse_slam;      }
+  else if (inherits(sexp_matrix, "dgCMatrix"))             { parse_func = parse_dgCMatrix; }
+  else if (inherits(sexp_matrix, "dgTMatrix"))             { parse_func = parse_dgTMatrix; }
+  else if (inherits(sexp_matrix, "dgeMatrix"))             { parse_func = parse_dgeMatrix; }
+  else if (inherits(sexp_matrix, "ecomatrix_file"))        { parse_func = parse_ecmfile;   }
+  else    { error("Unrecognized matrix format."); } // # nocov
+  
+  
+  ecomatrix_t *em = alloc_ecomatrix();
   parse_func(em, sexp_matrix, margin);
   
   return em;
 }
 
+
+
+//=========================================================
+// Build from 0-based triplets in any order. The vectors
+// must come from safe_malloc(); they are consumed.
+//=========================================================
+
+ecomatrix_t* new_ecomatrix_triplet(
+    int  n_samples, int  n_otus,  R_xlen_t nnz, 
+    int *sam_vec,   int *otu_vec, double *val_vec, 
+    int  n_threads_ ) {
+  
+  n_threads = n_threads_;
+  
+  ecomatrix_t *em = alloc_ecomatrix();
+  em->n_samples   = n_samples;
+  em->n_otus      = n_otus;
+  em->nnz         = nnz;
+  em->sam_vec     = sam_vec;
+  em->otu_vec     = otu_vec;
+  em->val_vec     = val_vec;
+  
+  compress_triplet(em, 0);
+  
+  return em;
+}
+
+
+
+
+//=========================================================
+// Result matrix for distances from the first n_query
+// samples (rows) to the rest (columns), labelled from the
+// sample names. Returned unprotected.
+//=========================================================
+
+SEXP new_query_mtx (ecomatrix_t *em, int n_query) {
+  
+  int  n_ref    = em->n_samples - n_query;
+  SEXP sexp_mtx = PROTECT(allocVector(REALSXP, (R_xlen_t)n_query * n_ref));
+  SEXP sexp_dim = PROTECT(allocVector(INTSXP, 2));
+  
+  INTEGER(sexp_dim)[0] = n_query;
+  INTEGER(sexp_dim)[1] = n_ref;
+  setAttrib(sexp_mtx, R_DimSymbol, sexp_dim);
+  
+  SEXP sexp_names = em->sexp_sample_names;
+  
+  if (!isNull(sexp_names)) {
+    
+    SEXP sexp_dimnames = PROTECT(allocVector(VECSXP, 2));
+    SEXP sexp_rows     = allocVector(STRSXP, n_query);
+    SET_VECTOR_ELT(sexp_dimnames, 0, sexp_rows);
+    SEXP sexp_cols     = allocVector(STRSXP, n_ref);
+    SET_VECTOR_ELT(sexp_dimnames, 1, sexp_cols);
+    
+    for (int i = 0; i < n_query; i++)
+      SET_STRING_ELT(sexp_rows, i, STRING_ELT(sexp_names, i));
+    for (int i = 0; i < n_ref; i++)
+      SET_STRING_ELT(sexp_cols, i, STRING_ELT(sexp_names, n_query + i));
+    
+    setAttrib(sexp_mtx, R_DimNamesSymbol, sexp_dimnames);
+    UNPROTECT(1);
+  }
+  
+  UNPROTECT(2);
+  return sexp_mtx;
+}
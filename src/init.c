@@ -7,21 +7,51 @@
 #include "ecodive.h"
 
 
-extern SEXP C_alpha_div(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
-extern SEXP C_beta_div(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_alpha_div(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_beta_div(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_dist_extend(SEXP, SEXP);
+extern SEXP C_dist_file_extract(SEXP, SEXP, SEXP);
+extern SEXP C_dist_file_info(SEXP);
+extern SEXP C_dist_file_slice(SEXP, SEXP, SEXP);
+extern SEXP C_dist_file_update(SEXP, SEXP, SEXP);
+extern SEXP C_ecomatrix_info(SEXP);
+extern SEXP C_ecomatrix_sums(SEXP);
+extern SEXP C_minhash(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_minhash_dist(SEXP, SEXP);
+extern SEXP C_minhash_lsh(SEXP, SEXP, SEXP, SEXP);
 extern SEXP C_pthreads(void);
 extern SEXP C_rarefy(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_rarefy_file(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_read_counts(SEXP, SEXP, SEXP, SEXP);
 extern SEXP C_read_tree(SEXP, SEXP);
-extern SEXP C_unifrac(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_unifrac(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_vptree_build(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_vptree_query(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP C_write_ecomatrix(SEXP, SEXP, SEXP, SEXP);
 
 
 static const R_CallMethodDef CallEntries[] = {
-  {"C_alpha_div", (DL_FUNC) &C_alpha_div, 6},
-  {"C_beta_div",  (DL_FUNC) &C_beta_div,  8},
-  {"C_pthreads",  (DL_FUNC) &C_pthreads,  0},
-  {"C_rarefy",    (DL_FUNC) &C_rarefy,    5},
-  {"C_read_tree", (DL_FUNC) &C_read_tree, 2},
-  {"C_unifrac",   (DL_FUNC) &C_unifrac,   7},
+  {"C_alpha_div",         (DL_FUNC) &C_alpha_div,          8},
+  {"C_beta_div",          (DL_FUNC) &C_beta_div,          14},
+  {"C_dist_extend",       (DL_FUNC) &C_dist_extend,        2},
+  {"C_dist_file_extract", (DL_FUNC) &C_dist_file_extract,  3},
+  {"C_dist_file_info",    (DL_FUNC) &C_dist_file_info,     1},
+  {"C_dist_file_slice",   (DL_FUNC) &C_dist_file_slice,    3},
+  {"C_dist_file_update",  (DL_FUNC) &C_dist_file_update,   3},
+  {"C_ecomatrix_info",    (DL_FUNC) &C_ecomatrix_info,     1},
+  {"C_ecomatrix_sums",    (DL_FUNC) &C_ecomatrix_sums,     1},
+  {"C_minhash",           (DL_FUNC) &C_minhash,            8},
+  {"C_minhash_dist",      (DL_FUNC) &C_minhash_dist,       2},
+  {"C_minhash_lsh",       (DL_FUNC) &C_minhash_lsh,        4},
+  {"C_pthreads",          (DL_FUNC) &C_pthreads,           0},
+  {"C_rarefy",            (DL_FUNC) &C_rarefy,             5},
+  {"C_rarefy_file",       (DL_FUNC) &C_rarefy_file,        7},
+  {"C_read_counts",       (DL_FUNC) &C_read_counts,        4},
+  {"C_read_tree",         (DL_FUNC) &C_read_tree,          2},
+  {"C_unifrac",           (DL_FUNC) &C_unifrac,           13},
+  {"C_vptree_build",      (DL_FUNC) &C_vptree_build,       7},
+  {"C_vptree_query",      (DL_FUNC) &C_vptree_query,      12},
+  {"C_write_ecomatrix",   (DL_FUNC) &C_write_ecomatrix,    4},
   {NULL, NULL, 0}
 };
 
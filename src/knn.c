@@ -0,0 +1,241 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * Keeps each sample's k nearest neighbors, so pair loops can
+ * rank all pairs without storing a distance for each one.
+ *
+ * Every thread owns a bounded max-heap for each sample, with
+ * the farthest kept neighbor on top. knn_add() offers a pair
+ * to the heaps of one or both samples; knn_finish() merges the
+ * threads' heaps and writes the neighbors out nearest-first.
+ * Pair loops that call knn_add() are run with knn_run().
+ *
+ * Heaps are ordered by distance and then by neighbor index,
+ * so results do not depend on the number of threads. NaN
+ * distances are never kept.
+ */
+
+#include "ecodive.h"
+
+
+static int     n_rows;    // samples with heaps
+static int     n_query;   // query samples, or 0 for all-vs-all
+static int     n_heaps;   // one set per thread
+static int     knn_k;
+static double *heap_dist; // n_heaps * n_rows * knn_k
+static int    *heap_nbr;  // 0-based neighbor of each entry
+static int    *heap_len;  // n_heaps * n_rows
+static int    *nbr_mtx;   // knn_k x n_rows results
+static double *dist_mtx;
+
+
+// Whether (d1, n1) ranks after (d2, n2).
+#define FARTHER(d1, n1, d2, n2) ((d1) > (d2) || ((d1) == (d2) && (n1) > (n2)))
+
+
+// Fills the hole at `i` with (distance, nbr), moving
+// nearer parents down.
+static void sift_up (double *dist, int *nbrs, int i, double distance, int nbr) {
+  
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!FARTHER(distance, nbr, dist[parent], nbrs[parent])) break;
+    dist[i] = dist[parent];
+    nbrs[i] = nbrs[parent];
+    i       = parent;
+  }
+  
+  dist[i] = distance;
+  nbrs[i] = nbr;
+}
+
+// Fills the hole at `i` with (distance, nbr), moving
+// farther children up.
+static void sift_down (double *dist, int *nbrs, int len, int i, double distance, int nbr) {
+  
+  while (2 * i + 1 < len) {
+    int child = 2 * i + 1;
+    if (child + 1 < len && FARTHER(dist[child + 1], nbrs[child + 1], dist[child], nbrs[child]))
+      child++;
+    if (!FARTHER(dist[child], nbrs[child], distance, nbr)) break;
+    dist[i] = dist[child];
+    nbrs[i] = nbrs[child];
+    i       = child;
+  }
+  
+  dist[i] = distance;
+  nbrs[i] = nbr;
+}
+
+static void heap_push (R_xlen_t heap, double distance, int nbr) {
+  
+  double *dist = heap_dist + heap * knn_k;
+  int    *nbrs = heap_nbr  + heap * knn_k;
+  int     len  = heap_len[heap];
+  
+  if (len < knn_k) {
+    sift_up(dist, nbrs, len, distance, nbr);
+    heap_len[heap]++;
+  }
+  else if (FARTHER(dist[0], nbrs[0], distance, nbr)) {
+    sift_down(dist, nbrs, len, 0, distance, nbr);
+  }
+}
+
+
+//======================================================
+// Allocate heaps for `n_rows_` samples; returns the
+// (unprotected) list that knn_finish() will fill.
+//======================================================
+SEXP knn_alloc (int n_rows_, int n_nbrs, int n_query_, int k, int n_threads, SEXP sexp_names) {
+  
+  n_rows  = n_rows_;
+  n_query = n_query_;
+  n_heaps = n_threads;
+  knn_k   = (k < n_nbrs) ? k : n_nbrs;
+  
+  size_t n_sets = (size_t)n_heaps * n_rows;
+  heap_dist = (double*) safe_malloc(n_sets * (knn_k + (knn_k == 0)) * sizeof(double));
+  heap_nbr  = (int*)    safe_malloc(n_sets * (knn_k + (knn_k == 0)) * sizeof(int));
+  heap_len  = (int*)    safe_malloc(n_sets * sizeof(int));
+  memset(heap_len, 0, n_sets * sizeof(int));
+  
+  SEXP sexp_result = PROTECT(allocVector(VECSXP, 2));
+  SEXP sexp_nbrs   = allocMatrix(INTSXP,  knn_k, n_rows);
+  SET_VECTOR_ELT(sexp_result, 0, sexp_nbrs);
+  SEXP sexp_dists  = allocMatrix(REALSXP, knn_k, n_rows);
+  SET_VECTOR_ELT(sexp_result, 1, sexp_dists);
+  
+  SEXP sexp_list_names = PROTECT(allocVector(STRSXP, 2));
+  SET_STRING_ELT(sexp_list_names, 0, mkChar("index"));
+  SET_STRING_ELT(sexp_list_names, 1, mkChar("distance"));
+  setAttrib(sexp_result, R_NamesSymbol, sexp_list_names);
+  
+  // Columns are named for the samples that own them.
+  if (!isNull(sexp_names)) {
+    SEXP sexp_cols     = PROTECT(allocVector(STRSXP, n_rows));
+    SEXP sexp_dimnames = PROTECT(allocVector(VECSXP, 2));
+    for (int i = 0; i < n_rows; i++)
+      SET_STRING_ELT(sexp_cols, i, STRING_ELT(sexp_names, i));
+    SET_VECTOR_ELT(sexp_dimnames, 1, sexp_cols);
+    setAttrib(sexp_nbrs,  R_DimNamesSymbol, sexp_dimnames);
+    setAttrib(sexp_dists, R_DimNamesSymbol, sexp_dimnames);
+    UNPROTECT(2);
+  }
+  
+  nbr_mtx  = INTEGER(sexp_nbrs);
+  dist_mtx = REAL(sexp_dists);
+  
+  UNPROTECT(2);
+  return sexp_result;
+}
+
+
+//======================================================
+// Offer the distance between two samples. All-vs-all,
+// each is a neighbor of the other; with a query, sam_j
+// is a reference sample and only sam_i keeps it.
+//======================================================
+void knn_add (int thread_i, int sam_i, int sam_j, double distance) {
+  
+  if (isnan(distance) || !knn_k) return;
+  
+  R_xlen_t heaps = (R_xlen_t)thread_i * n_rows;
+  
+  if (n_query) {
+    heap_push(heaps + sam_i, distance, sam_j - n_query);
+  }
+  else {
+    heap_push(heaps + sam_i, distance, sam_j);
+    heap_push(heaps + sam_j, distance, sam_i);
+  }
+}
+
+
+//======================================================
+// Run a pair loop that calls knn_add(). run_parallel()
+// re-runs the whole loop serially if it could not start
+// every thread, so the heaps are emptied first; else the
+// pairs offered by the threads that did start would be
+// kept twice.
+//======================================================
+static pthread_func_t knn_func;
+
+static void *run_pairs (void *arg) {
+  
+  if (((worker_t *)arg)->n == 1)
+    memset(heap_len, 0, (size_t)n_heaps * n_rows * sizeof(int));
+  
+  return knn_func(arg);
+}
+
+void knn_run (pthread_func_t func, int n_threads, R_xlen_t n_tasks) {
+  knn_func = func;
+  run_parallel(run_pairs, n_threads, n_tasks);
+}
+
+
+//======================================================
+// The distance a new neighbor of `row` must not exceed
+// to be kept, from thread 0's heap; for searches that
+// offer all their pairs from one thread.
+//======================================================
+double knn_bound (int row) {
+  
+  if (!knn_k)                return R_NegInf;
+  if (heap_len[row] < knn_k) return R_PosInf;
+  return heap_dist[(R_xlen_t)row * knn_k];
+}
+
+
+// Fold every thread's heap into thread 0's, then copy it
+// out and sort it nearest-first in the result columns.
+// Folded heaps are emptied and thread 0's is left intact,
+// so a serial re-run from run_parallel() gives the same
+// result.
+static void *merge_heaps (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int row = thread_i; row < n_rows; row += n_threads) {
+    
+    for (int t = 1; t < n_heaps; t++) {
+      R_xlen_t heap = (R_xlen_t)t * n_rows + row;
+      for (int i = 0; i < heap_len[heap]; i++)
+        heap_push(row, heap_dist[heap * knn_k + i], heap_nbr[heap * knn_k + i]);
+      heap_len[heap] = 0;
+    }
+    
+    int    *nbrs = nbr_mtx  + (R_xlen_t)row * knn_k;
+    double *dist = dist_mtx + (R_xlen_t)row * knn_k;
+    int     len  = heap_len[row];
+    
+    for (int i = len; i < knn_k; i++) {
+      nbrs[i] = NA_INTEGER;
+      dist[i] = NA_REAL;
+    }
+    
+    memcpy(nbrs, heap_nbr  + (R_xlen_t)row * knn_k, len * sizeof(int));
+    memcpy(dist, heap_dist + (R_xlen_t)row * knn_k, len * sizeof(double));
+    
+    // Swap the farthest into the last open slot.
+    for (int n = len; n > 1; n--) {
+      double last_dist = dist[n - 1];
+      int    last_nbr  = nbrs[n - 1];
+      dist[n - 1] = dist[0];
+      nbrs[n - 1] = nbrs[0];
+      sift_down(dist, nbrs, n - 1, 0, last_dist, last_nbr);
+    }
+    
+    for (int i = 0; i < len; i++) nbrs[i]++;
+  }
+  
+  return NULL;
+}
+
+
+void knn_finish (int n_threads) {
+  run_parallel(merge_heaps, n_threads, n_rows);
+}
@@ -18,14 +18,35 @@
  * 
  * free_all() should be called at the end of .Call()-ed
  * C functions.
+ * 
+ * safe_mmap() maps a file read-only, and safe_scratch() creates 
+ * a writable mapping backed by an anonymous temporary file. Both 
+ * are released by free_all(). Without mmap support, they fall 
+ * back to safe_malloc(). safe_mmap_rw() maps a file for writing,
+ * and requires mmap support.
  */
 
 #include "ecodive.h"
 
+#if defined __has_include
+#  if __has_include (<sys/mman.h>)
+#    include <sys/mman.h>
+#    include <unistd.h> // ftruncate
+#    define HAVE_MMAP
+#  endif
+#endif
+
+#define MAX_MAPS 8
+
 
 static void **ptr_vec;
 static int    n_ptrs = 0;
 
+static void  *map_vec[MAX_MAPS];
+static size_t map_len[MAX_MAPS];
+static FILE  *map_fp[MAX_MAPS];   // NULL for read-only file maps
+static SEXP   sexp_preserved = NULL;
+
 
 void init_n_ptrs (int n) {
   
@@ -75,6 +96,22 @@ void* safe_malloc (size_t n_bytes) {
 
 void free_all(void) {
   
+  for (int i = 0; i < MAX_MAPS; i++) {
+    if (map_vec[i]) {
+      #ifdef HAVE_MMAP
+        munmap(map_vec[i], map_len[i]);
+      #endif
+      if (map_fp[i]) fclose(map_fp[i]);
+      map_vec[i] = NULL;
+      map_fp[i]  = NULL;
+    }
+  }
+  
+  if (sexp_preserved) {
+    R_ReleaseObject(sexp_preserved);
+    sexp_preserved = NULL;
+  }
+  
   if (!ptr_vec) return;
   
   for (int i = 0; i < n_ptrs; i++) {
@@ -96,6 +133,13 @@ int is_safe_ptr (void *ptr) {
   // Pointer already freed
   if (!ptr) return 0;
   
+  // Scratch mappings are ours to write to
+  for (int i = 0; i < MAX_MAPS; i++) {
+    if (map_vec[i] == ptr && map_fp[i]) {
+      return 1;
+    }
+  }
+  
   // Find the matching slot in ptr_vec
   for (int i = 0; i < n_ptrs; i++) {
     if (ptr_vec[i] == ptr) {
@@ -113,6 +157,19 @@ void* free_one (void *ptr) {
   // Pointer already freed
   if (!ptr) return NULL;
   
+  // Release a scratch mapping
+  for (int i = 0; i < MAX_MAPS; i++) {
+    if (map_vec[i] == ptr && map_fp[i]) {
+      #ifdef HAVE_MMAP
+        munmap(map_vec[i], map_len[i]);
+      #endif
+      fclose(map_fp[i]);
+      map_vec[i] = NULL;
+      map_fp[i]  = NULL;
+      return NULL;
+    }
+  }
+  
   // Find the matching slot in ptr_vec
   int i = 0;
   for (; i < n_ptrs; i++) {
@@ -146,3 +203,187 @@ void* maybe_free_one (void *ptr) {
   
   return NULL; // # nocov
 }
+
+
+
+//======================================================
+// Memory-mapped files.
+//======================================================
+
+static int open_map_slot (void) {
+  
+  for (int i = 0; i < MAX_MAPS; i++) {
+    if (!map_vec[i]) return i;
+  }
+  
+  free_all(); // # nocov
+  error("Insufficient map slots"); // # nocov
+  return -1; // # nocov
+}
+
+
+void* safe_mmap (const char *path, size_t *n_bytes) {
+  
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    free_all();
+    error("Unable to open '%s'.", path);
+  }
+  
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  if (size <= 0) {
+    fclose(fp);
+    free_all();
+    error("'%s' is empty.", path);
+  }
+  *n_bytes = (size_t)size;
+  
+  #ifdef HAVE_MMAP
+    
+    int   i    = open_map_slot();
+    void *addr = mmap(NULL, *n_bytes, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    fclose(fp);
+    
+    if (addr == MAP_FAILED) {
+      free_all(); // # nocov
+      error("Unable to memory-map '%s'.", path); // # nocov
+    }
+    
+    map_vec[i] = addr;
+    map_len[i] = *n_bytes;
+    map_fp[i]  = NULL;
+    
+    return addr;
+    
+  #else
+    
+    void *addr = safe_malloc(*n_bytes); // # nocov start
+    fseek(fp, 0, SEEK_SET);
+    size_t n_read = fread(addr, 1, *n_bytes, fp);
+    fclose(fp);
+    
+    if (n_read != *n_bytes) {
+      free_all();
+      error("Unable to read '%s'.", path);
+    }
+    
+    return addr; // # nocov end
+    
+  #endif
+}
+
+
+// Map a file read-write. With `create`, the file is created or
+// truncated to *n_bytes; otherwise its size is returned there.
+
+void* safe_mmap_rw (const char *path, size_t *n_bytes, int create) {
+  
+  #ifdef HAVE_MMAP
+    
+    int   i  = open_map_slot();
+    FILE *fp = fopen(path, create ? "w+b" : "r+b");
+    if (!fp) {
+      free_all();
+      error("Unable to open '%s' for writing.", path);
+    }
+    
+    if (create) {
+      if (*n_bytes == 0 || ftruncate(fileno(fp), *n_bytes)) {
+        fclose(fp);
+        free_all();
+        error("Unable to allocate %.0f bytes for '%s'.", (double)*n_bytes, path);
+      }
+    }
+    else {
+      fseek(fp, 0, SEEK_END);
+      long size = ftell(fp);
+      if (size <= 0) {
+        fclose(fp);
+        free_all();
+        error("'%s' is empty.", path);
+      }
+      *n_bytes = (size_t)size;
+    }
+    
+    void *addr = mmap(NULL, *n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fp), 0);
+    
+    if (addr == MAP_FAILED) {
+      fclose(fp);                                         // # nocov
+      free_all();                                         // # nocov
+      error("Unable to memory-map '%s' for writing.", path); // # nocov
+    }
+    
+    map_vec[i] = addr;
+    map_len[i] = *n_bytes;
+    map_fp[i]  = fp;
+    
+    return addr;
+    
+  #else
+    free_all(); // # nocov
+    error("Writing to '%s' requires memory-mapped files, which this platform lacks.", path); // # nocov
+    return NULL; // # nocov
+  #endif
+}
+
+
+void* safe_scratch (size_t n_bytes) {
+  
+  #ifdef HAVE_MMAP
+    
+    int   i  = open_map_slot();
+    FILE *fp = tmpfile();
+    
+    if (!fp || n_bytes == 0 || ftruncate(fileno(fp), n_bytes)) {
+      if (fp) fclose(fp);       // # nocov
+      return safe_malloc(n_bytes); // # nocov
+    }
+    
+    void *addr = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fp), 0);
+    
+    if (addr == MAP_FAILED) {
+      fclose(fp);                  // # nocov
+      return safe_malloc(n_bytes); // # nocov
+    }
+    
+    map_vec[i] = addr;
+    map_len[i] = n_bytes;
+    map_fp[i]  = fp;
+    
+    return addr;
+    
+  #else
+    return safe_malloc(n_bytes); // # nocov
+  #endif
+}
+
+
+int is_mapped_ptr (void *ptr) {
+  
+  if (!ptr) return 0;
+  
+  for (int i = 0; i < MAX_MAPS; i++) {
+    char *addr = (char*)map_vec[i];
+    if (addr && (char*)ptr >= addr && (char*)ptr < addr + map_len[i]) {
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+
+//======================================================
+// Keep one R object alive until free_all().
+//======================================================
+
+SEXP safe_preserve (SEXP sexp) {
+  
+  if (sexp_preserved) R_ReleaseObject(sexp_preserved);
+  
+  R_PreserveObject(sexp);
+  sexp_preserved = sexp;
+  
+  return sexp;
+}
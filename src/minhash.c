@@ -0,0 +1,553 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * MinHash sketches, for estimating distances between very many
+ * samples without comparing their full feature lists.
+ *
+ * Each sample's signature holds n_hashes 32-bit values. Two
+ * samples agree on any one value with probability equal to
+ * their Jaccard similarity; the fraction that agree estimates
+ * it. Plain MinHash keeps, for each hash function, the smallest
+ * hash of the sample's features. Weighted MinHash (Ioffe's
+ * consistent weighted sampling, ICWS) draws an OTU and a
+ * quantized weight instead, so the agreement estimates the
+ * weighted Jaccard similarity, sum(min(x, y)) / sum(max(x, y)).
+ *
+ * Hashes are keyed on feature names when R supplies them, so
+ * signatures from different tables agree on shared features.
+ * All randomness comes from pcg32, seeded by `seed`.
+ *
+ * A sample with no features has NA_INTEGER in every position;
+ * no other signature value is ever NA_INTEGER.
+ *
+ * Locality-sensitive hashing (LSH) splits each signature into
+ * bands. Samples whose values agree across a whole band are
+ * candidates; only candidates have their distance estimated.
+ */
+
+#include "ecodive.h"
+
+// Largest table of ICWS draws to cache: 2^24 OTU-hash
+// pairs, or 192 MB. Bigger tables redraw for each sample.
+#define ICWS_TABLE_MAX (1 << 24)
+
+
+typedef struct {
+  uint64_t key;
+  int      sam;
+} lsh_item_t;
+
+typedef struct {
+  float r;
+  float log_c;
+  float beta;
+} icws_t;
+
+static int       n_hashes;
+static int       n_samples;
+static int       weighted;
+static uint64_t  seed_key;
+static R_xlen_t *pos_vec;
+static int      *otu_vec;
+static double   *val_vec;
+static uint64_t *key_vec;   // hash key of each OTU
+static uint64_t *salt_vec;  // one per hash function
+static double   *best_mtx;  // n_hashes per thread, for ICWS
+static icws_t   *icws_vec;  // n_hashes per OTU, or NULL
+static int       n_otus;
+static int      *sig_vec;   // n_hashes per sample
+static double   *dist_vec;
+
+// LSH
+static int         n_bands;
+static int         n_rows;    // signature values per band
+static lsh_item_t *item_mtx;  // n_samples per thread
+static R_xlen_t   *band_vec;  // offset of each band's pairs
+static uint64_t   *cand_vec;  // sam_i << 32 | sam_j
+static R_xlen_t    n_cands;
+static int         band_lo;   // bands lsh_pairs() writes
+static int         band_hi;
+
+
+// splitmix64's finalizer: a fast, well-mixed 64-bit hash.
+static inline uint64_t mix64 (uint64_t z) {
+  z += 0x9E3779B97F4A7C15ULL;
+  z  = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z  = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// 64-bit FNV-1a of a feature name.
+static uint64_t hash_name (const char *str) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (; *str; str++) h = (h ^ (uint8_t)*str) * 0x100000001B3ULL;
+  return h;
+}
+
+// Uniform on (0, 1).
+static inline double unif (pcg32_random_t *rng) {
+  return (pcg32_random_r(rng) + 0.5) * (1.0 / 4294967296.0);
+}
+
+// ICWS draws r, c ~ Gamma(2, 1) and beta ~ Uniform(0, 1),
+// fixed for each OTU and hash function.
+static inline icws_t icws_draw (uint64_t key, int k) {
+  
+  pcg32_random_t rng;
+  pcg32_srandom_r(&rng, key ^ seed_key, (uint64_t)k);
+  
+  icws_t draw;
+  draw.r     = (float)(-log(unif(&rng) * unif(&rng)));
+  draw.log_c = (float)log(-log(unif(&rng) * unif(&rng)));
+  draw.beta  = (float)unif(&rng);
+  
+  return draw;
+}
+
+static void *calc_icws_table (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int otu = thread_i; otu < n_otus; otu += n_threads)
+    for (int k = 0; k < n_hashes; k++)
+      icws_vec[(size_t)otu * n_hashes + k] = icws_draw(key_vec[otu], k);
+  
+  return NULL;
+}
+
+
+
+//======================================================
+// Signatures, one sample per task.
+//======================================================
+static void *calc_signatures (void *arg) {
+  
+  int     thread_i  = ((worker_t *)arg)->i;
+  int     n_threads = ((worker_t *)arg)->n;
+  double *best      = best_mtx ? best_mtx + (size_t)thread_i * n_hashes : NULL;
+  
+  for (int sam = thread_i; sam < n_samples; sam += n_threads) {
+    
+    uint32_t *sig   = (uint32_t*)(sig_vec + (size_t)sam * n_hashes);
+    R_xlen_t  begin = pos_vec[sam];
+    R_xlen_t  end   = pos_vec[sam + 1];
+    
+    if (begin == end) {
+      for (int k = 0; k < n_hashes; k++) sig_vec[(size_t)sam * n_hashes + k] = NA_INTEGER;
+      continue;
+    }
+    
+    if (!weighted) {
+      
+      for (int k = 0; k < n_hashes; k++) sig[k] = UINT32_MAX;
+      
+      for (R_xlen_t i = begin; i < end; i++) {
+        uint64_t key = key_vec[otu_vec[i]];
+        for (int k = 0; k < n_hashes; k++) {
+          uint32_t h = (uint32_t)(mix64(key ^ salt_vec[k]) >> 32);
+          if (h < sig[k]) sig[k] = h;
+        }
+      }
+    }
+    
+    else {
+      
+      // ICWS. Logs of `a` are compared, rather than `a`.
+      // Weights must be positive; others are skipped.
+      for (int k = 0; k < n_hashes; k++) best[k] = R_PosInf;
+      
+      int n_drawn = 0;
+      
+      for (R_xlen_t i = begin; i < end; i++) {
+        
+        if (!(val_vec[i] > 0)) continue;
+        n_drawn++;
+        
+        uint64_t key    = key_vec[otu_vec[i]];
+        double   log_wt = log(val_vec[i]);
+        icws_t  *table  = icws_vec ? icws_vec + (size_t)otu_vec[i] * n_hashes : NULL;
+        
+        for (int k = 0; k < n_hashes; k++) {
+          
+          icws_t draw  = table ? table[k] : icws_draw(key, k);
+          double r     = draw.r;
+          double t     = floor(log_wt / r + draw.beta);
+          double log_a = draw.log_c - r * (t - draw.beta) - r;
+          
+          if (log_a < best[k]) {
+            best[k] = log_a;
+            sig[k]  = (uint32_t)(mix64(key ^ salt_vec[k] ^ mix64((uint64_t)(int64_t)t)) >> 32);
+          }
+        }
+      }
+      
+      // No positive weights; empty, as above.
+      if (!n_drawn) {
+        for (int k = 0; k < n_hashes; k++) sig_vec[(size_t)sam * n_hashes + k] = NA_INTEGER;
+        continue;
+      }
+    }
+    
+    // Keep NA_INTEGER for empty samples.
+    for (int k = 0; k < n_hashes; k++)
+      if (sig_vec[(size_t)sam * n_hashes + k] == NA_INTEGER)
+        sig_vec[(size_t)sam * n_hashes + k]++;
+  }
+  
+  return NULL;
+}
+
+
+
+//======================================================
+// The Jaccard distance estimated from two signatures:
+// the fraction of positions that disagree.
+//======================================================
+static double sig_distance (int sam_i, int sam_j) {
+  
+  int *a = sig_vec + (size_t)sam_i * n_hashes;
+  int *b = sig_vec + (size_t)sam_j * n_hashes;
+  
+  // No features in one or both samples.
+  if (a[0] == NA_INTEGER || b[0] == NA_INTEGER)
+    return (a[0] == b[0]) ? R_NaN : 1;
+  
+  int n = 0;
+  for (int k = 0; k < n_hashes; k++) n += a[k] == b[k];
+  
+  return 1 - (double)n / n_hashes;
+}
+
+
+static void *calc_all_pairs (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int sam_i = thread_i; sam_i < n_samples - 1; sam_i += n_threads) {
+    double *row = dist_vec + PAIR_ROW_START(sam_i, n_samples) - sam_i - 1;
+    for (int sam_j = sam_i + 1; sam_j < n_samples; sam_j++)
+      row[sam_j] = sig_distance(sam_i, sam_j);
+  }
+  
+  return NULL;
+}
+
+
+
+//======================================================
+// LSH. Each thread sorts its bands' samples by band value;
+// runs of equal values give the candidate pairs. The first
+// pass counts them, the second writes them out, a round of
+// bands at a time.
+//======================================================
+
+// By band value, then sample.
+static int cmp_lsh_items (const void *a, const void *b) {
+  
+  const lsh_item_t *x = (const lsh_item_t *)a;
+  const lsh_item_t *y = (const lsh_item_t *)b;
+  
+  if (x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+  return (x->sam > y->sam) - (x->sam < y->sam);
+}
+
+static int cmp_cands (const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+// Sorted items for `band`; returns how many there are.
+static int sort_band (lsh_item_t *items, int band) {
+  
+  int n = 0;
+  
+  for (int sam = 0; sam < n_samples; sam++) {
+    
+    int *sig = sig_vec + (size_t)sam * n_hashes + (size_t)band * n_rows;
+    if (sig_vec[(size_t)sam * n_hashes] == NA_INTEGER) continue;
+    
+    uint64_t key = 0;
+    for (int r = 0; r < n_rows; r++) key = mix64(key ^ (uint32_t)sig[r]);
+    
+    items[n].key = key;
+    items[n].sam = sam;
+    n++;
+  }
+  
+  qsort(items, n, sizeof(lsh_item_t), cmp_lsh_items);
+  return n;
+}
+
+
+static void *lsh_count (void *arg) {
+  
+  int         thread_i  = ((worker_t *)arg)->i;
+  int         n_threads = ((worker_t *)arg)->n;
+  lsh_item_t *items     = item_mtx + (size_t)thread_i * n_samples;
+  
+  for (int band = thread_i; band < n_bands; band += n_threads) {
+    
+    int      n       = sort_band(items, band);
+    R_xlen_t n_pairs = 0;
+    
+    for (int lo = 0, hi = 0; lo < n; lo = hi) {
+      for (hi = lo + 1; hi < n && items[hi].key == items[lo].key; hi++);
+      n_pairs += (R_xlen_t)(hi - lo) * (hi - lo - 1) / 2;
+    }
+    
+    band_vec[band + 1] = n_pairs;
+  }
+  
+  return NULL;
+}
+
+
+static void *lsh_pairs (void *arg) {
+  
+  int         thread_i  = ((worker_t *)arg)->i;
+  int         n_threads = ((worker_t *)arg)->n;
+  lsh_item_t *items     = item_mtx + (size_t)thread_i * n_samples;
+  
+  for (int band = band_lo + thread_i; band < band_hi; band += n_threads) {
+    
+    int       n    = sort_band(items, band);
+    uint64_t *cand = cand_vec + band_vec[band] - band_vec[band_lo];
+    
+    for (int lo = 0, hi = 0; lo < n; lo = hi) {
+      for (hi = lo + 1; hi < n && items[hi].key == items[lo].key; hi++);
+      for (int i = lo; i < hi; i++)
+        for (int j = i + 1; j < hi; j++)
+          *cand++ = ((uint64_t)items[i].sam << 32) | (uint64_t)items[j].sam;
+    }
+  }
+  
+  return NULL;
+}
+
+
+static void *lsh_distances (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (R_xlen_t i = thread_i; i < n_cands; i += n_threads)
+    dist_vec[i] = sig_distance((int)(cand_vec[i] >> 32), (int)(cand_vec[i] & 0xFFFFFFFF));
+  
+  return NULL;
+}
+
+
+
+//======================================================
+// R interface. Returns an n_hashes x n_samples integer
+// matrix of signatures.
+//======================================================
+SEXP C_minhash(
+    SEXP sexp_otu_mtx,  SEXP sexp_margin,
+    SEXP sexp_norm,     SEXP sexp_weighted,
+    SEXP sexp_otus,     SEXP sexp_size,
+    SEXP sexp_seed,     SEXP sexp_n_threads ) {
+  
+  int n_threads = asInteger(sexp_n_threads);
+  int norm      = asInteger(sexp_norm);
+  init_n_ptrs(20);
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
+  if (norm) normalize(em, norm, n_threads, 0);
+  
+  n_hashes  = asInteger(sexp_size);
+  n_samples = em->n_samples;
+  n_otus    = em->n_otus;
+  weighted  = asLogical(sexp_weighted) == TRUE;
+  pos_vec   = em->pos_vec;
+  otu_vec   = em->otu_vec;
+  val_vec   = NULL;
+  best_mtx  = NULL;
+  
+  if (weighted) {
+    val_vec = dbl_val_vec(em);
+    for (R_xlen_t i = 0; i < em->nnz; i++) {
+      if (val_vec[i] < 0) {
+        free_all();
+        error("Weighted MinHash requires non-negative values.");
+      }
+    }
+    best_mtx = (double*) safe_malloc((size_t)n_threads * n_hashes * sizeof(double));
+  }
+  
+  
+  // Keys from feature names, or positions if unnamed.
+  int n_names = isNull(sexp_otus) ? 0 : LENGTH(sexp_otus);
+  key_vec     = (uint64_t*) safe_malloc(((size_t)n_otus + 1) * sizeof(uint64_t));
+  
+  for (int otu = 0; otu < n_otus; otu++) {
+    int col      = em->otu_map ? em->otu_map[otu] : otu;
+    key_vec[otu] = mix64(col < n_names
+      ? hash_name(CHAR(STRING_ELT(sexp_otus, col)))
+      : (uint64_t)col + 1 );
+  }
+  
+  pcg32_random_t rng;
+  pcg32_srandom_r(&rng, (uint64_t)(int64_t)asInteger(sexp_seed), 0);
+  
+  salt_vec = (uint64_t*) safe_malloc(((size_t)n_hashes + 1) * sizeof(uint64_t));
+  for (int k = 0; k < n_hashes; k++)
+    salt_vec[k] = ((uint64_t)pcg32_random_r(&rng) << 32) | pcg32_random_r(&rng);
+  seed_key = ((uint64_t)pcg32_random_r(&rng) << 32) | pcg32_random_r(&rng);
+  
+  // Draw once per OTU rather than once per value.
+  icws_vec = NULL;
+  if (weighted && (double)n_otus * n_hashes <= ICWS_TABLE_MAX) {
+    icws_vec = (icws_t*) safe_malloc(((size_t)n_otus * n_hashes + 1) * sizeof(icws_t));
+    run_parallel(calc_icws_table, n_threads, (R_xlen_t)n_otus * n_hashes);
+  }
+  
+  
+  SEXP sexp_result   = PROTECT(allocMatrix(INTSXP, n_hashes, n_samples));
+  SEXP sexp_dimnames = PROTECT(allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(sexp_dimnames, 1, em->sexp_sample_names);
+  setAttrib(sexp_result, R_DimNamesSymbol, sexp_dimnames);
+  
+  sig_vec = INTEGER(sexp_result);
+  run_parallel(calc_signatures, n_threads, em->nnz);
+  
+  free_all();
+  UNPROTECT(2);
+  return sexp_result;
+}
+
+
+
+//======================================================
+// R interface. Estimated Jaccard distances between every
+// pair of signatures, as a dist object.
+//======================================================
+SEXP C_minhash_dist(SEXP sexp_sig, SEXP sexp_n_threads) {
+  
+  int n_threads = asInteger(sexp_n_threads);
+  
+  n_hashes  = nrows(sexp_sig);
+  n_samples = ncols(sexp_sig);
+  sig_vec   = INTEGER(sexp_sig);
+  
+  R_xlen_t n_dist = (R_xlen_t)n_samples * (n_samples - 1) / 2;
+  
+  SEXP sexp_result = PROTECT(allocVector(REALSXP, n_dist));
+  SEXP sexp_names  = getAttrib(sexp_sig, R_DimNamesSymbol);
+  
+  setAttrib(sexp_result, R_ClassSymbol,     PROTECT(mkString("dist")));
+  setAttrib(sexp_result, install("Size"),   PROTECT(ScalarInteger(n_samples)));
+  setAttrib(sexp_result, install("Diag"),   PROTECT(ScalarLogical(0)));
+  setAttrib(sexp_result, install("Upper"),  PROTECT(ScalarLogical(0)));
+  setAttrib(sexp_result, install("Labels"), isNull(sexp_names) ? R_NilValue : VECTOR_ELT(sexp_names, 1));
+  
+  dist_vec = REAL(sexp_result);
+  run_parallel(calc_all_pairs, n_threads, n_dist);
+  
+  UNPROTECT(5);
+  return sexp_result;
+}
+
+
+
+//======================================================
+// R interface. LSH candidate pairs whose estimated
+// Jaccard distance is at most `max_dist`. Returns
+// list(i, j, distance) with 1-based sample indices,
+// sorted by i then j.
+//======================================================
+SEXP C_minhash_lsh(SEXP sexp_sig, SEXP sexp_bands, SEXP sexp_max_dist, SEXP sexp_n_threads) {
+  
+  int    n_threads = asInteger(sexp_n_threads);
+  double max_dist  = asReal(sexp_max_dist);
+  init_n_ptrs(20);
+  
+  n_hashes  = nrows(sexp_sig);
+  n_samples = ncols(sexp_sig);
+  sig_vec   = INTEGER(sexp_sig);
+  n_bands   = asInteger(sexp_bands);
+  n_rows    = n_hashes / n_bands;
+  
+  item_mtx = (lsh_item_t*) safe_malloc(((size_t)n_threads * n_samples + 1) * sizeof(lsh_item_t));
+  band_vec = (R_xlen_t*)   safe_malloc(((size_t)n_bands + 1) * sizeof(R_xlen_t));
+  
+  band_vec[0] = 0;
+  run_parallel(lsh_count, n_threads, (R_xlen_t)n_bands * n_samples);
+  for (int band = 0; band < n_bands; band++)
+    band_vec[band + 1] += band_vec[band];
+  
+  
+  // A pair can collide in several bands, so each round of
+  // n_threads bands is sorted and merged into the distinct
+  // pairs found so far. Memory is bounded by the distinct
+  // pairs plus one round's, not every band's collisions.
+  uint64_t *uniq_vec = (uint64_t*) safe_malloc(sizeof(uint64_t));
+  R_xlen_t  n_uniq   = 0;
+  
+  for (band_lo = 0; band_lo < n_bands; band_lo = band_hi) {
+    
+    band_hi  = band_lo + n_threads < n_bands ? band_lo + n_threads : n_bands;
+    n_cands  = band_vec[band_hi] - band_vec[band_lo];
+    cand_vec = (uint64_t*) safe_malloc(((size_t)n_cands + 1) * sizeof(uint64_t));
+    run_parallel(lsh_pairs, n_threads, (R_xlen_t)(band_hi - band_lo) * n_samples);
+    qsort(cand_vec, n_cands, sizeof(uint64_t), cmp_cands);
+    
+    uint64_t *merged = (uint64_t*) safe_malloc(((size_t)n_uniq + n_cands + 1) * sizeof(uint64_t));
+    R_xlen_t  n      = 0;
+    
+    for (R_xlen_t a = 0, b = 0; a < n_uniq || b < n_cands; ) {
+      uint64_t x = (b == n_cands || (a < n_uniq && uniq_vec[a] <= cand_vec[b])) ? uniq_vec[a++] : cand_vec[b++];
+      if (n == 0 || merged[n - 1] != x) merged[n++] = x;
+    }
+    
+    free_one(cand_vec);
+    free_one(uniq_vec);
+    uniq_vec = merged;
+    n_uniq   = n;
+  }
+  
+  item_mtx = free_one(item_mtx);
+  cand_vec = uniq_vec;
+  n_cands  = n_uniq;
+  
+  dist_vec = (double*) safe_malloc(((size_t)n_cands + 1) * sizeof(double));
+  run_parallel(lsh_distances, n_threads, n_cands);
+  
+  R_xlen_t n_kept = 0;
+  for (R_xlen_t i = 0; i < n_cands; i++)
+    if (dist_vec[i] <= max_dist) n_kept++;
+  
+  
+  SEXP sexp_result = PROTECT(allocVector(VECSXP, 3));
+  SEXP sexp_i      = allocVector(INTSXP,  n_kept);
+  SET_VECTOR_ELT(sexp_result, 0, sexp_i);
+  SEXP sexp_j      = allocVector(INTSXP,  n_kept);
+  SET_VECTOR_ELT(sexp_result, 1, sexp_j);
+  SEXP sexp_dist   = allocVector(REALSXP, n_kept);
+  SET_VECTOR_ELT(sexp_result, 2, sexp_dist);
+  
+  SEXP sexp_names = PROTECT(allocVector(STRSXP, 3));
+  SET_STRING_ELT(sexp_names, 0, mkChar("i"));
+  SET_STRING_ELT(sexp_names, 1, mkChar("j"));
+  SET_STRING_ELT(sexp_names, 2, mkChar("distance"));
+  setAttrib(sexp_result, R_NamesSymbol, sexp_names);
+  
+  R_xlen_t k = 0;
+  for (R_xlen_t i = 0; i < n_cands; i++) {
+    if (dist_vec[i] <= max_dist) {
+      INTEGER(sexp_i)[k]  = (int)(cand_vec[i] >> 32) + 1;
+      INTEGER(sexp_j)[k]  = (int)(cand_vec[i] & 0xFFFFFFFF) + 1;
+      REAL(sexp_dist)[k]  = dist_vec[i];
+      k++;
+    }
+  }
+  
+  free_all();
+  UNPROTECT(2);
+  return sexp_result;
+}
@@ -11,13 +11,13 @@
 #define NORM_BINARY  4
 #define NORM_RCLR    5
 
-static int     n_samples;
-static int     n_otus;
-static int    *pos_vec;
-static double *val_vec;
-static double *clr_vec;
-static double  pseudocount;
-static int     is_percent_normalized;
+static int       n_samples;
+static int       n_otus;
+static R_xlen_t *pos_vec;
+static double   *val_vec;
+static double   *clr_vec;
+static double    pseudocount;
+static int       is_percent_normalized;
 
 
 // Macro to loop over each sample based on current threading setup.
@@ -158,12 +158,12 @@ static void *norm_rclr(void *arg) {
 }
 
 
-void normalize(ecomatrix_t *em, int norm, int n_threads, int pseudocount_) {
+void normalize(ecomatrix_t *em, int norm, int n_threads, double pseudocount_) {
   
   n_samples = em->n_samples;
   n_otus    = em->n_otus;
   pos_vec   = em->pos_vec;
-  val_vec   = em->val_vec;
+  val_vec   = dbl_val_vec(em);
   
   if (norm == NORM_PERCENT) {
     // Check if it's already normalized to percent. If so, skip.
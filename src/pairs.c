@@ -0,0 +1,189 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * Requested sample pairs. R passes 1-based indices into a
+ * dist object's lower triangle, in any order. The pair loops
+ * walk them sorted, so each thread's batch covers a run of
+ * whole rows: sample i is decoded once per row and its
+ * values stay in cache for every sample j it is paired with.
+ * 
+ * Or R passes a specification from resolve_pairs(), and
+ * pair_spec_next() generates its pairs row by row, without
+ * ever listing them.
+ */
+
+#include "ecodive.h"
+
+#define PAIRS_WITHIN      1
+#define PAIRS_BETWEEN     2
+#define PAIRS_CONSECUTIVE 3
+#define PAIRS_ONE_VS_ALL  4
+#define PAIRS_NEW         5
+
+static int  spec_type;
+static int  spec_sample; // one-vs-all sample, or first new one
+static int  n_spec;      // n_samples, also "no partner"
+static int *grp_vec;     // group of each sample, or NA_INTEGER
+static int *nxt_vec;     // next sample in the group or series
+static int *prv_vec;     // previous sample in the series
+
+
+static int cmp_dist_idx (const void *a, const void *b) {
+  R_xlen_t x = *(const R_xlen_t *)a;
+  R_xlen_t y = *(const R_xlen_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+
+//=========================================================
+// The 0-based dist_vec indices of `pairs`, sorted.
+//=========================================================
+
+R_xlen_t* sort_pairs (SEXP sexp_pairs_vec) {
+  
+  R_xlen_t  n        = XLENGTH(sexp_pairs_vec);
+  R_xlen_t *pair_vec = (R_xlen_t*) safe_malloc(((size_t)n + 1) * sizeof(R_xlen_t));
+  int       sorted   = 1;
+  
+  if (isReal(sexp_pairs_vec)) {
+    double *pairs_dbl = REAL(sexp_pairs_vec);
+    for (R_xlen_t i = 0; i < n; i++) pair_vec[i] = (R_xlen_t)pairs_dbl[i] - 1;
+  }
+  else {
+    int *pairs_int = INTEGER(sexp_pairs_vec);
+    for (R_xlen_t i = 0; i < n; i++) pair_vec[i] = (R_xlen_t)pairs_int[i] - 1;
+  }
+  
+  for (R_xlen_t i = 1; i < n && sorted; i++)
+    sorted = pair_vec[i - 1] <= pair_vec[i];
+  
+  // Logical `pairs` arrive through which(), already sorted.
+  if (!sorted) qsort(pair_vec, n, sizeof(R_xlen_t), cmp_dist_idx);
+  
+  return pair_vec;
+}
+
+
+
+//=========================================================
+// The row (sam_i) of dist_vec index `dist_idx`: the largest
+// i with PAIR_ROW_START(i) <= dist_idx. Solving the
+// quadratic gives it directly; the loops only correct
+// sqrt()'s rounding, which matters past 2^53 distances.
+//=========================================================
+
+int pair_row (R_xlen_t dist_idx, int n_samples) {
+  
+  double b   = 2.0 * n_samples - 1;
+  double est = (b - sqrt(b * b - 8.0 * (double)dist_idx)) / 2;
+  int    row = est < 0 ? 0 : est > n_samples - 2 ? n_samples - 2 : (int)est;
+  
+  while (row > 0 && PAIR_ROW_START(row, n_samples) > dist_idx)
+    row--;
+  while (row < n_samples - 2 && PAIR_ROW_START(row + 1, n_samples) <= dist_idx)
+    row++;
+  
+  return row;
+}
+
+
+
+//=========================================================
+// Prepare the lookups pair_spec_next() needs for a list
+// from resolve_pairs(). O(n_samples) time and memory.
+//=========================================================
+
+void pair_spec_setup (SEXP sexp_spec, int n_samples) {
+  
+  SEXP sexp_group = get(sexp_spec, "group");
+  SEXP sexp_order = get(sexp_spec, "order");
+  
+  if (LENGTH(sexp_group) != n_samples) {
+    free_all();
+    error("Pair specification is for %i samples, not %i.", LENGTH(sexp_group), n_samples);
+  }
+  
+  spec_type   = asInteger(get(sexp_spec, "type"));
+  spec_sample = asInteger(get(sexp_spec, "sample"));
+  n_spec      = n_samples;
+  grp_vec     = INTEGER(sexp_group);
+  nxt_vec     = (int*) safe_malloc((size_t)n_samples * sizeof(int));
+  prv_vec     = (int*) safe_malloc((size_t)n_samples * sizeof(int));
+  
+  for (int sam = 0; sam < n_samples; sam++)
+    nxt_vec[sam] = prv_vec[sam] = n_samples;
+  
+  if (spec_type == PAIRS_WITHIN) {
+    
+    // Chain each group's samples in ascending order.
+    int n_groups = 0;
+    for (int sam = 0; sam < n_samples; sam++)
+      if (grp_vec[sam] != NA_INTEGER && grp_vec[sam] > n_groups)
+        n_groups = grp_vec[sam];
+    
+    int *last_vec = (int*) safe_malloc(((size_t)n_groups + 1) * sizeof(int));
+    for (int grp = 0; grp <= n_groups; grp++) last_vec[grp] = n_samples;
+    
+    for (int sam = n_samples - 1; sam >= 0; sam--) {
+      if (grp_vec[sam] == NA_INTEGER) continue;
+      nxt_vec[sam]           = last_vec[grp_vec[sam]];
+      last_vec[grp_vec[sam]] = sam;
+    }
+    
+    free_one(last_vec);
+  }
+  
+  else if (spec_type == PAIRS_CONSECUTIVE) {
+    
+    // Link neighbors in the group-then-order sort.
+    int *ord_vec = INTEGER(sexp_order);
+    for (int k = 1; k < LENGTH(sexp_order); k++) {
+      int a = ord_vec[k - 1], b = ord_vec[k];
+      if (grp_vec[a] != grp_vec[b]) continue;
+      nxt_vec[a] = b;
+      prv_vec[b] = a;
+    }
+  }
+}
+
+
+
+//=========================================================
+// The first sample after sam_j that is paired with sam_i,
+// or n_samples if there are no more. Start from
+// sam_j = sam_i to visit a row's pairs in order.
+//=========================================================
+
+int pair_spec_next (int sam_i, int sam_j) {
+  
+  int grp = grp_vec[sam_i];
+  
+  switch (spec_type) {
+    
+    case PAIRS_WITHIN:
+      return grp == NA_INTEGER ? n_spec : nxt_vec[sam_j];
+    
+    case PAIRS_BETWEEN:
+      if (grp == NA_INTEGER) return n_spec;
+      for (sam_j++; sam_j < n_spec; sam_j++)
+        if (grp_vec[sam_j] != grp && grp_vec[sam_j] != NA_INTEGER) break;
+      return sam_j;
+    
+    case PAIRS_CONSECUTIVE: {
+      int a = nxt_vec[sam_i] < prv_vec[sam_i] ? nxt_vec[sam_i] : prv_vec[sam_i];
+      int b = nxt_vec[sam_i] < prv_vec[sam_i] ? prv_vec[sam_i] : nxt_vec[sam_i];
+      return a > sam_j ? a : b > sam_j ? b : n_spec;
+    }
+    
+    case PAIRS_ONE_VS_ALL:
+      if (sam_i == spec_sample) return sam_j + 1;
+      return (sam_i < spec_sample && sam_j < spec_sample) ? spec_sample : n_spec;
+    
+    case PAIRS_NEW:
+      return sam_j + 1 < spec_sample ? spec_sample : sam_j + 1;
+  }
+  
+  return n_spec; // # nocov
+}
@@ -22,7 +22,7 @@ SEXP C_pthreads(void) {
 // of POSIX threads. Handles graceful degradation to
 // single-threaded mode on failure.
 //======================================================
-void run_parallel(pthread_func_t func, int n_threads, int n_tasks) {
+void run_parallel(pthread_func_t func, int n_threads, R_xlen_t n_tasks) {
   
   // ---------------------------------------------------
   // Path A: Multithreading Attempt
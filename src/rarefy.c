@@ -9,14 +9,26 @@ static int       margin;
 static SEXP      sexp_val_mtx;
 static SEXP      sexp_res_mtx;
 static int      *sam_vec;
-static int      *pos_vec;
+static R_xlen_t *pos_vec;
 static double   *val_vec;
+static int      *int_vec; // ecomatrix integer counts, else NULL
 static double   *res_vec;
+static uint32_t *cnt_vec;
 static int       n_sams;
 static int       n_otus;
-static int       n_vals;
+static R_xlen_t  n_vals;
 static uint32_t *depth_vec;
 
+// Sparse result assembly
+static int      *in_i_vec;
+static int      *in_j_vec;
+static int      *out_i_vec;
+static int      *out_j_vec;
+static double   *out_x_vec;
+static int      *seg_vec;
+static int      *keep_vec;
+static int       n_segs;
+
 
 typedef struct {
   uint32_t tried;
@@ -118,7 +130,7 @@ static pthread_func_t setup_dense(void) {
     for (int sam = 0; sam < n_sams; sam++) {
       
       double  depth     = 0;
-      double *val_begin = val_vec + (sam * n_otus);
+      double *val_begin = val_vec + (size_t)sam * n_otus;
       
       for (int otu = 0; otu < n_otus; otu++) {
         depth += val_begin[otu];
@@ -156,7 +168,7 @@ static void *rarefy_triplet(void *arg) {
   
   // Iterate over all tuples (sam,otu,val though otu is ignored).
   // Cannot assume any particular ordering.
-  for (int i = 0; i < n_vals; i++) {
+  for (R_xlen_t i = 0; i < n_vals; i++) {
     
     int sam = sam_vec[i]; // Sample index
     
@@ -166,7 +178,7 @@ static void *rarefy_triplet(void *arg) {
       knuth_t  *knuth = &knuth_vec[sam]; // Tracks: tried, kept, and rng.
       uint32_t  depth = depth_vec[sam];  // Total observations in sample
       double    val   = val_vec[i];      // Current OTU # of observations
-      double   *res   = res_vec + i;     // Rarefied OTU # of observations
+      uint32_t *res   = cnt_vec + i;     // Rarefied OTU # of observations
       
       // Sample can be be rarefied.
       if (depth > target) {
@@ -188,20 +200,39 @@ static void *rarefy_triplet(void *arg) {
         }
       }
       
+      // Too shallow - keep the original count.
+      else {
+        *res = (uint32_t) val;
+      }
+      
     }
   }
   
   return NULL;
 }
 
+// Sparse results are assembled with int offsets, matching
+// the dgCMatrix `p` slot. Check before any rarefaction.
+static void check_n_vals(void) {
+  if (n_vals > 2147483647) {
+    free_all();
+    error("rarefy() returns at most 2^31 - 1 non-zero values; use `file` for larger tables.");
+  }
+}
+
 static pthread_func_t setup_triplet(void) {
   
+  check_n_vals();
+  
   rarefy_triplet_knuth_vec = (knuth_t*)  safe_malloc(n_sams * sizeof(knuth_t));
   depth_vec                = (uint32_t*) safe_malloc(n_sams * sizeof(uint32_t));
   
+  // Rarefied counts, one per input non-zero value.
+  cnt_vec = (uint32_t*) safe_malloc(((size_t)n_vals + 1) * sizeof(uint32_t));
+  
   // Use a single pass to sum all samples' depths
   memset(depth_vec, 0, n_sams * sizeof(uint32_t));
-  for (int i = 0; i < n_vals; i++) {
+  for (R_xlen_t i = 0; i < n_vals; i++) {
     depth_vec[sam_vec[i]] += (uint32_t) val_vec[i];
   }
   
@@ -221,7 +252,7 @@ static pthread_func_t setup_matrix(void) {
   
   val_vec = REAL(sexp_val_mtx);
   res_vec = REAL(sexp_res_mtx);
-  n_vals  = LENGTH(sexp_val_mtx);
+  n_vals  = XLENGTH(sexp_val_mtx);
   
   if (margin == 1) {
     n_sams  = nrows(sexp_val_mtx);
@@ -251,7 +282,7 @@ static pthread_func_t setup_dgeMatrix(void) {
   
   val_vec = REAL(sexp_val_vec);
   res_vec = REAL(sexp_res_vec);
-  n_vals  = LENGTH(sexp_val_vec);
+  n_vals  = XLENGTH(sexp_val_vec);
   
   if (margin == 1) {
     n_sams  = INTEGER(sexp_dim_vec)[0];
@@ -282,13 +313,11 @@ static pthread_func_t setup_slam(void) {
   SEXP sexp_j       = PROTECT(get(sexp_res_mtx, "j"));
   SEXP sexp_nrow    = PROTECT(get(sexp_res_mtx, "nrow"));
   SEXP sexp_ncol    = PROTECT(get(sexp_res_mtx, "ncol"));
-
-  SEXP sexp_res_vec = PROTECT(duplicate(sexp_val_vec));
-  set(sexp_res_mtx, "v", sexp_res_vec);
   
-  val_vec = REAL(sexp_val_vec);
-  res_vec = REAL(sexp_res_vec);
-  n_vals  = LENGTH(sexp_val_vec);
+  val_vec  = REAL(sexp_val_vec);
+  n_vals   = XLENGTH(sexp_val_vec);
+  in_i_vec = INTEGER(sexp_i);
+  in_j_vec = INTEGER(sexp_j);
   
   if (margin == 1) {
     sam_vec = INTEGER(sexp_i);
@@ -301,7 +330,7 @@ static pthread_func_t setup_slam(void) {
   
   pthread_func_t rarefy_func = setup_triplet();
   
-  UNPROTECT(6);
+  UNPROTECT(5);
   return rarefy_func;
 }
 
@@ -318,13 +347,11 @@ static pthread_func_t setup_dgTMatrix(void) {
   SEXP sexp_i       = PROTECT(R_do_slot(sexp_res_mtx, install("i")));
   SEXP sexp_j       = PROTECT(R_do_slot(sexp_res_mtx, install("j")));
   SEXP sexp_dim     = PROTECT(R_do_slot(sexp_res_mtx, install("Dim")));
-
-  SEXP sexp_res_vec = PROTECT(duplicate(sexp_val_vec));
-  R_do_slot_assign(sexp_res_mtx, install("x"), sexp_res_vec);
   
-  val_vec = REAL(sexp_val_vec);
-  res_vec = REAL(sexp_res_vec);
-  n_vals  = LENGTH(sexp_val_vec);
+  val_vec  = REAL(sexp_val_vec);
+  n_vals   = XLENGTH(sexp_val_vec);
+  in_i_vec = INTEGER(sexp_i);
+  in_j_vec = INTEGER(sexp_j);
   
   if (margin == 1) {
     sam_vec = INTEGER(sexp_i);
@@ -337,14 +364,15 @@ static pthread_func_t setup_dgTMatrix(void) {
   
   pthread_func_t rarefy_func = setup_triplet();
   
-  UNPROTECT(5);
+  UNPROTECT(4);
   return rarefy_func;
 }
 
 
 
 /*
- * `Matrix` package's `dgCMatrix` compressed sparse matrix
+ * `Matrix` package's `dgCMatrix` compressed sparse matrix,
+ * and ecomatrix files
  * 
  */
 
@@ -356,8 +384,8 @@ static void *rarefy_compressed (void *arg) {
   for (int sam = thread_i; sam < n_sams; sam += n_threads) {
     
     uint32_t depth     = depth_vec[sam];
-    int      pos_begin = pos_vec[sam];
-    int      pos_end   = pos_vec[sam + 1];
+    R_xlen_t pos_begin = pos_vec[sam];
+    R_xlen_t pos_end   = pos_vec[sam + 1];
     
     
     // Sample can be be rarefied.
@@ -369,10 +397,10 @@ static void *rarefy_compressed (void *arg) {
       
       // Knuth algorithm for choosing target seqs from depth.
       uint32_t tried = 0, kept = 0; // These are local to the sample
-      for (int pos = pos_begin; pos < pos_end; pos++) {
+      for (R_xlen_t pos = pos_begin; pos < pos_end; pos++) {
         
-        double  val = val_vec[pos];  // Current # of observations
-        double *res = res_vec + pos; // Rarefied # of observations
+        double    val = int_vec ? int_vec[pos] : val_vec[pos]; // Current # of observations
+        uint32_t *res = cnt_vec + pos; // Rarefied # of observations
         
         *res = 0;
         for (uint32_t seq = 0; seq < val && kept < target; seq++) {
@@ -391,6 +419,12 @@ static void *rarefy_compressed (void *arg) {
       }
     }
     
+    // Too shallow - keep the original counts.
+    else {
+      for (R_xlen_t pos = pos_begin; pos < pos_end; pos++)
+        cnt_vec[pos] = (uint32_t) (int_vec ? int_vec[pos] : val_vec[pos]);
+    }
+    
   }
   
   return NULL;
@@ -404,13 +438,12 @@ static pthread_func_t setup_dgCMatrix(void) {
   SEXP sexp_i       = PROTECT(R_do_slot(sexp_res_mtx, install("i")));
   SEXP sexp_p       = PROTECT(R_do_slot(sexp_res_mtx, install("p")));
   SEXP sexp_dim     = PROTECT(R_do_slot(sexp_res_mtx, install("Dim")));
-
-  SEXP sexp_res_vec = PROTECT(duplicate(sexp_val_vec));
-  R_do_slot_assign(sexp_res_mtx, install("x"), sexp_res_vec);
   
-  val_vec = REAL(sexp_val_vec);
-  res_vec = REAL(sexp_res_vec);
-  n_vals  = LENGTH(sexp_val_vec);
+  val_vec  = REAL(sexp_val_vec);
+  n_vals   = XLENGTH(sexp_val_vec);
+  in_i_vec = INTEGER(sexp_i);
+  seg_vec  = INTEGER(sexp_p); // Output is compacted column by column.
+  n_segs   = INTEGER(sexp_dim)[1];
   
   if (margin == 1) {
     sam_vec     = INTEGER(sexp_i);
@@ -419,189 +452,162 @@ static pthread_func_t setup_dgCMatrix(void) {
   }
   
   else {
-    pos_vec = INTEGER(sexp_p);
+    check_n_vals();
     n_sams  = INTEGER(sexp_dim)[1];
+    cnt_vec = (uint32_t*) safe_malloc(((size_t)n_vals + 1) * sizeof(uint32_t));
+    
+    // Widen to the 64-bit offsets rarefy_compressed uses.
+    int *p_vec = INTEGER(sexp_p);
+    pos_vec    = (R_xlen_t*) safe_malloc(((size_t)n_sams + 1) * sizeof(R_xlen_t));
+    for (int sam = 0; sam <= n_sams; sam++) pos_vec[sam] = p_vec[sam];
     
     depth_vec = (uint32_t*) safe_malloc(n_sams * sizeof(uint32_t));
     for (int sam = 0; sam < n_sams; sam++) {
       depth_vec[sam] = 0;
-      int pos_begin = pos_vec[sam];
-      int pos_end   = pos_vec[sam + 1];
-      for (int i = pos_begin; i < pos_end; i++)
+      for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++)
         depth_vec[sam] += (uint32_t) val_vec[i];
     }
     
     rarefy_func = rarefy_compressed;
   }
 
-  UNPROTECT(5);
+  UNPROTECT(4);
   return rarefy_func;
 }
 
 
+
 /*
- * Compacts a slam::simple_triplet_matrix (S3 object)
- * uses "v", "i", "j" components.
+ * Sparse results are assembled straight from cnt_vec.
+ * 
+ * The input is split into segments - the columns of a 
+ * dgCMatrix, or fixed-size blocks of triplets. Threads count 
+ * the non-zero rarefied values in each segment, a prefix sum 
+ * turns those counts into output offsets, and then threads 
+ * copy each segment's survivors into exact-size vectors. 
+ * Input order is preserved, so dgCMatrix columns stay sorted.
  */
-static void compact_slam(SEXP sexp_mtx) {
-    SEXP sexp_v = PROTECT(get(sexp_mtx, "v"));
-    SEXP sexp_i = PROTECT(get(sexp_mtx, "i"));
-    SEXP sexp_j = PROTECT(get(sexp_mtx, "j"));
-    
-    double *v     = REAL(sexp_v);
-    int    *i     = INTEGER(sexp_i);
-    int    *j     = INTEGER(sexp_j);
-    int     n_all = LENGTH(sexp_v);
-    
-    // 1. Count new non-zeros
-    int nnz_new = 0;
-    for (int k = 0; k < n_all; k++) {
-        if (v[k] != 0.0) nnz_new++;
-    }
-    
-    if (nnz_new == n_all) { UNPROTECT(3); return; }
-    
-    // 2. Allocate new vectors
-    SEXP sexp_new_v = PROTECT(allocVector(REALSXP, nnz_new));
-    SEXP sexp_new_i = PROTECT(allocVector(INTSXP,  nnz_new));
-    SEXP sexp_new_j = PROTECT(allocVector(INTSXP,  nnz_new));
+
+#define TRIPLET_SEG_SIZE 4096
+
+static void *count_kept(void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int seg = thread_i; seg < n_segs; seg += n_threads) {
     
-    double *new_v = REAL(sexp_new_v);
-    int    *new_i = INTEGER(sexp_new_i);
-    int    *new_j = INTEGER(sexp_new_j);
+    int n_kept  = 0;
+    int seg_end = seg_vec[seg + 1];
     
-    // 3. Filter data
-    int idx = 0;
-    for (int k = 0; k < n_all; k++) {
-        if (v[k] != 0.0) {
-            new_v[idx] = v[k];
-            new_i[idx] = i[k];
-            new_j[idx] = j[k];
-            idx++;
-        }
-    }
+    for (int k = seg_vec[seg]; k < seg_end; k++)
+      if (cnt_vec[k]) n_kept++;
     
-    // 4. Update the list components
-    set(sexp_mtx, "v", sexp_new_v);
-    set(sexp_mtx, "i", sexp_new_i);
-    set(sexp_mtx, "j", sexp_new_j);
-    
-    UNPROTECT(6);
+    keep_vec[seg] = n_kept;
+  }
+  
+  return NULL;
 }
 
-
-/*
- * Compacts a dgCMatrix by removing explicit zeros (0.0) from the
- * x and i slots and updating the p slot.
- */
-static void compact_dgCMatrix(SEXP sexp_mtx) {
-    // 1. Access the slots
-    SEXP sexp_p = PROTECT(R_do_slot(sexp_mtx, install("p")));
-    SEXP sexp_i = PROTECT(R_do_slot(sexp_mtx, install("i")));
-    SEXP sexp_x = PROTECT(R_do_slot(sexp_mtx, install("x")));
-
-    int    *p    = INTEGER(sexp_p);
-    int    *i    = INTEGER(sexp_i);
-    double *x    = REAL(sexp_x);
-    int     ncol = LENGTH(sexp_p) - 1;
-    int     nnz_old = p[ncol];
-
-    // 2. Pass 1: Count new non-zeros (nnz)
-    int nnz_new = 0;
-    for (int k = 0; k < nnz_old; k++) {
-        if (x[k] != 0.0) nnz_new++;
-    }
-
-    // Optimization: If no zeros were created, do nothing.
-    if (nnz_new == nnz_old) { UNPROTECT(3); return; }
-
-    // 3. Allocate new x and i vectors of the correct size
-    SEXP sexp_new_i = PROTECT(allocVector(INTSXP, nnz_new));
-    SEXP sexp_new_x = PROTECT(allocVector(REALSXP, nnz_new));
-    int    *new_i = INTEGER(sexp_new_i);
-    double *new_x = REAL(sexp_new_x);
-
-    // 4. Pass 2: Compact data and update 'p'
-    // We must be careful updating 'p' in-place because it defines 
-    // the boundaries of the data we are currently reading.
+static void *write_kept(void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int seg = thread_i; seg < n_segs; seg += n_threads) {
     
-    int write_idx = 0;
-    int col_start = p[0]; // Always 0
+    int pos     = keep_vec[seg];
+    int seg_end = seg_vec[seg + 1];
     
-    for (int col = 0; col < ncol; col++) {
-        int col_end = p[col + 1]; // Save old end before overwriting
-
-        for (int k = col_start; k < col_end; k++) {
-            if (x[k] != 0.0) {
-                new_x[write_idx] = x[k];
-                new_i[write_idx] = i[k];
-                write_idx++;
-            }
-        }
-        
-        // Update p for the *next* column boundary
-        p[col + 1] = write_idx; 
-        
-        // Move to next column
-        col_start = col_end; 
+    for (int k = seg_vec[seg]; k < seg_end; k++) {
+      
+      if (!cnt_vec[k]) continue;
+      
+      out_x_vec[pos] = (double) cnt_vec[k];
+      if (out_i_vec) out_i_vec[pos] = in_i_vec[k];
+      if (out_j_vec) out_j_vec[pos] = in_j_vec[k];
+      pos++;
     }
-
-    // 5. Assign new slots back to the matrix
-    R_do_slot_assign(sexp_mtx, install("i"), sexp_new_i);
-    R_do_slot_assign(sexp_mtx, install("x"), sexp_new_x);
-
-    UNPROTECT(5); // Unprotect new_i and new_x
+  }
+  
+  return NULL;
 }
 
+static void set_component(const char *name, SEXP sexp_value) {
+  
+  if (inherits(sexp_res_mtx, "simple_triplet_matrix")) {
+    set(sexp_res_mtx, strcmp(name, "x") ? name : "v", sexp_value);
+  }
+  else {
+    R_do_slot_assign(sexp_res_mtx, install(name), sexp_value);
+  }
+}
 
-/*
- * Compacts a Matrix::dgTMatrix (S4 object)
- * uses "x", "i", "j" slots.
- */
-static void compact_dgTMatrix(SEXP sexp_mtx) {
-    SEXP sexp_x = PROTECT(R_do_slot(sexp_mtx, install("x")));
-    SEXP sexp_i = PROTECT(R_do_slot(sexp_mtx, install("i")));
-    SEXP sexp_j = PROTECT(R_do_slot(sexp_mtx, install("j")));
-    
-    double *x     = REAL(sexp_x);
-    int    *i     = INTEGER(sexp_i);
-    int    *j     = INTEGER(sexp_j);
-    int     n_all = LENGTH(sexp_x);
-    
-    // 1. Count new non-zeros
-    int nnz_new = 0;
-    for (int k = 0; k < n_all; k++) {
-        if (x[k] != 0.0) nnz_new++;
-    }
-    
-    if (nnz_new == n_all) { UNPROTECT(3); return; }
-    
-    // 2. Allocate new vectors
-    SEXP sexp_new_x = PROTECT(allocVector(REALSXP, nnz_new));
-    SEXP sexp_new_i = PROTECT(allocVector(INTSXP,  nnz_new));
-    SEXP sexp_new_j = PROTECT(allocVector(INTSXP,  nnz_new));
-    
-    double *new_x = REAL(sexp_new_x);
-    int    *new_i = INTEGER(sexp_new_i);
-    int    *new_j = INTEGER(sexp_new_j);
+static void build_sparse(int n_threads) {
+  
+  int  n_protect = 0;
+  SEXP sexp_p    = R_NilValue;
+  
+  
+  // dgCMatrix: per-column offsets become the new `p` slot.
+  // Triplets:  per-block offsets are only needed internally.
+  if (in_j_vec == NULL) {
+    sexp_p   = PROTECT(allocVector(INTSXP, n_segs + 1)); n_protect++;
+    keep_vec = INTEGER(sexp_p);
+  }
+  else {
+    n_segs   = (n_vals + TRIPLET_SEG_SIZE - 1) / TRIPLET_SEG_SIZE;
+    seg_vec  = (int*) safe_malloc((n_segs + 1) * sizeof(int));
+    keep_vec = (int*) safe_malloc((n_segs + 1) * sizeof(int));
     
-    // 3. Filter data
-    int idx = 0;
-    for (int k = 0; k < n_all; k++) {
-        if (x[k] != 0.0) {
-            new_x[idx] = x[k];
-            new_i[idx] = i[k];
-            new_j[idx] = j[k];
-            idx++;
-        }
+    for (int seg = 0; seg < n_segs; seg++)
+      seg_vec[seg] = seg * TRIPLET_SEG_SIZE;
+    seg_vec[n_segs] = n_vals;
+  }
+  
+  
+  // Count survivors per segment, then convert to offsets.
+  run_parallel(count_kept, n_threads, n_segs);
+  
+  int nnz = 0;
+  for (int seg = 0; seg < n_segs; seg++) {
+    int n_kept    = keep_vec[seg];
+    keep_vec[seg] = nnz;
+    nnz          += n_kept;
+  }
+  keep_vec[n_segs] = nnz;
+  
+  
+  // Index vectors can be shared with the input when
+  // rarefaction didn't zero out any values.
+  SEXP sexp_x = PROTECT(allocVector(REALSXP, nnz)); n_protect++;
+  SEXP sexp_i = R_NilValue;
+  SEXP sexp_j = R_NilValue;
+  
+  out_x_vec = REAL(sexp_x);
+  out_i_vec = NULL;
+  out_j_vec = NULL;
+  
+  if (nnz < n_vals) {
+    sexp_i    = PROTECT(allocVector(INTSXP, nnz)); n_protect++;
+    out_i_vec = INTEGER(sexp_i);
+    if (in_j_vec) {
+      sexp_j    = PROTECT(allocVector(INTSXP, nnz)); n_protect++;
+      out_j_vec = INTEGER(sexp_j);
     }
-    
-    // 4. Update the S4 slots
-    R_do_slot_assign(sexp_mtx, install("x"), sexp_new_x);
-    R_do_slot_assign(sexp_mtx, install("i"), sexp_new_i);
-    R_do_slot_assign(sexp_mtx, install("j"), sexp_new_j);
-    
-    UNPROTECT(6);
+  }
+  
+  run_parallel(write_kept, n_threads, n_segs);
+  
+  
+  set_component("x", sexp_x);
+  if (nnz < n_vals) {
+    set_component("i", sexp_i);
+    if (in_j_vec) { set_component("j", sexp_j); }
+    else          { set_component("p", sexp_p); }
+  }
+  
+  UNPROTECT(n_protect);
 }
 
 
@@ -622,15 +628,21 @@ SEXP C_rarefy(
   
   int n_threads = asInteger(sexp_n_threads);
   
+  cnt_vec  = NULL;
+  int_vec  = NULL;
+  in_i_vec = NULL;
+  in_j_vec = NULL;
+  
   
   /*
-   * Shallow copy input matrix to result matrix.
-   * For `VECSXP`s like slam and Matrix objects,
-   * the underlying `REALSXP`s are still shared by
-   * the input and result `SEXP`s at this point.
+   * Copy input matrix to result matrix. A base R matrix is 
+   * rarefied in place, so needs a deep copy. For slam and 
+   * Matrix objects a shallow copy suffices - new slot vectors
+   * are assigned to the result while the input's are shared.
    */
   sexp_val_mtx = sexp_otu_mtx;
-  sexp_res_mtx = PROTECT(duplicate(sexp_otu_mtx));
+  if (isMatrix(sexp_otu_mtx)) { sexp_res_mtx = PROTECT(duplicate(sexp_otu_mtx));         }
+  else                        { sexp_res_mtx = PROTECT(shallow_duplicate(sexp_otu_mtx)); }
   
   
   // function to run
@@ -650,12 +662,64 @@ SEXP C_rarefy(
   run_parallel(rarefy_func, n_threads, n_sams);
   
   
-  // Post-process: Remove explicit zeros to restore sparsity
-  if      (inherits(sexp_res_mtx, "simple_triplet_matrix")) { compact_slam(sexp_res_mtx);      }
-  else if (inherits(sexp_res_mtx, "dgCMatrix"))             { compact_dgCMatrix(sexp_res_mtx); }
-  else if (inherits(sexp_res_mtx, "dgTMatrix"))             { compact_dgTMatrix(sexp_res_mtx); }
+  // Sparse formats: collect non-zero counts into the result.
+  if (cnt_vec) build_sparse(n_threads);
   
   free_all();
   UNPROTECT(1);
   return sexp_res_mtx;
 }
+
+
+
+//======================================================
+// R interface for writing rarefied counts to an
+// ecomatrix file. The input may be a mapped ecomatrix
+// file, so rarefied counts go to a scratch mapping and
+// are streamed out by write_ecmfile().
+//======================================================
+SEXP C_rarefy_file(
+    SEXP sexp_otu_mtx, SEXP sexp_depth,
+    SEXP sexp_seed,    SEXP sexp_margin,
+    SEXP sexp_drop,    SEXP sexp_path,
+    SEXP sexp_n_threads ) {
+  
+  init_n_ptrs(10);
+  
+  target = (uint32_t) asInteger(sexp_depth);
+  seed   = (uint64_t) asInteger(sexp_seed);
+  
+  int n_threads = asInteger(sexp_n_threads);
+  int drop      = asLogical(sexp_drop);
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
+  
+  n_sams  = em->n_samples;
+  pos_vec = em->pos_vec;
+  val_vec = em->val_vec;
+  int_vec = em->int_vec;
+  cnt_vec = (uint32_t*) safe_scratch(((size_t)em->nnz + 1) * sizeof(uint32_t));
+  
+  depth_vec = (uint32_t*) safe_malloc(n_sams * sizeof(uint32_t));
+  for (int sam = 0; sam < n_sams; sam++) {
+    depth_vec[sam] = 0;
+    for (R_xlen_t i = pos_vec[sam]; i < pos_vec[sam + 1]; i++)
+      depth_vec[sam] += (uint32_t) (int_vec ? int_vec[i] : val_vec[i]);
+  }
+  
+  run_parallel(rarefy_compressed, n_threads, n_sams);
+  
+  
+  // Samples short of the target depth are dropped or kept as-is.
+  int *keep_vec = NULL;
+  if (drop) {
+    keep_vec = (int*) safe_malloc(n_sams * sizeof(int));
+    for (int sam = 0; sam < n_sams; sam++)
+      keep_vec[sam] = depth_vec[sam] >= target;
+  }
+  
+  write_ecmfile(em, cnt_vec, keep_vec, CHAR(asChar(sexp_path)));
+  
+  free_all();
+  return sexp_path;
+}
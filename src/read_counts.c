@@ -0,0 +1,790 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * Streaming reader for delimited text (TSV/CSV) and BIOM-JSON
+ * (v1.0) feature tables.
+ *
+ * The file is memory-mapped and the data section is split into
+ * chunks at record boundaries. Each chunk is tokenized by its
+ * own thread into non-zero (row, col, value) triplets, which
+ * are then compressed into an ecomatrix. The dense table is
+ * never built.
+ *
+ * Worker threads can't touch the R API or safe_malloc(), so
+ * chunk buffers use plain malloc() and parse errors are stored
+ * on the chunk for the main thread to report.
+ */
+
+#include "ecodive.h"
+
+#define FMT_TABLE       1
+#define FMT_BIOM_SPARSE 2
+#define FMT_BIOM_DENSE  3
+
+typedef struct {
+  const char  *begin;
+  const char  *end;
+  int          n_rows;     // lines, or dense BIOM rows
+  size_t       nnz;
+  size_t       cap;
+  int         *row_vec;    // chunk-local, except sparse BIOM
+  int         *col_vec;
+  double      *val_vec;
+  int          label_cap;
+  const char **label_vec;  // first field of each line
+  int         *label_len;
+  const char  *err_msg;
+  const char  *err_at;
+} chunk_t;
+
+static int         fmt;
+static char        sep;
+static int         n_cols;     // values per line / dense row
+static int         tax_col;    // a dropped taxonomy field ends each line
+static int         n_rows;     // BIOM only
+static int         n_chunks;
+static chunk_t    *chunk_vec;
+static const char *file_begin;
+
+
+
+//=========================================================
+// Per-chunk buffers.
+//=========================================================
+
+static int push_val (chunk_t *chunk, int row, int col, double val) {
+  
+  if (chunk->nnz == chunk->cap) {
+    size_t  cap     = chunk->cap ? chunk->cap * 2 : 1024;
+    int    *row_vec = realloc(chunk->row_vec, cap * sizeof(int));
+    if (row_vec) chunk->row_vec = row_vec;
+    int    *col_vec = realloc(chunk->col_vec, cap * sizeof(int));
+    if (col_vec) chunk->col_vec = col_vec;
+    double *val_vec = realloc(chunk->val_vec, cap * sizeof(double));
+    if (val_vec) chunk->val_vec = val_vec;
+    if (!row_vec || !col_vec || !val_vec) return 0;
+    chunk->cap = cap;
+  }
+  
+  chunk->row_vec[chunk->nnz] = row;
+  chunk->col_vec[chunk->nnz] = col;
+  chunk->val_vec[chunk->nnz] = val;
+  chunk->nnz++;
+  
+  return 1;
+}
+
+static int push_label (chunk_t *chunk, const char *str, int len) {
+  
+  if (chunk->n_rows == chunk->label_cap) {
+    int          cap       = chunk->label_cap ? chunk->label_cap * 2 : 1024;
+    const char **label_vec = realloc(chunk->label_vec, cap * sizeof(char*));
+    if (label_vec) chunk->label_vec = label_vec;
+    int         *label_len = realloc(chunk->label_len, cap * sizeof(int));
+    if (label_len) chunk->label_len = label_len;
+    if (!label_vec || !label_len) return 0;
+    chunk->label_cap = cap;
+  }
+  
+  chunk->label_vec[chunk->n_rows] = str;
+  chunk->label_len[chunk->n_rows] = len;
+  
+  return 1;
+}
+
+static void free_chunks (void) {
+  
+  if (!chunk_vec) return;
+  
+  for (int i = 0; i < n_chunks; i++) {
+    free(chunk_vec[i].row_vec);
+    free(chunk_vec[i].col_vec);
+    free(chunk_vec[i].val_vec);
+    free(chunk_vec[i].label_vec);
+    free(chunk_vec[i].label_len);
+  }
+  
+  free(chunk_vec);
+  chunk_vec = NULL;
+}
+
+#define CHUNK_ERROR(msg, at)                                   \
+  do {                                                         \
+    chunk->err_msg = msg;                                      \
+    chunk->err_at  = at;                                       \
+    return;                                                    \
+  } while (0)
+
+
+
+//=========================================================
+// Numbers. Plain integers are converted directly; anything
+// else goes through a NUL-terminated copy to strtod, since
+// the mapped file isn't NUL-terminated.
+//=========================================================
+
+static int parse_num (const char *p, const char *end, double *val) {
+  
+  while (p < end && (*p == ' ' || *p == '"')) p++;
+  while (end > p && (end[-1] == ' ' || end[-1] == '"')) end--;
+  
+  if (p == end) { *val = 0; return 1; } // empty field
+  
+  if (end - p < 16) {
+    const char *q = p;
+    double      x = 0;
+    while (q < end && *q >= '0' && *q <= '9') x = x * 10 + (*q++ - '0');
+    if (q == end) { *val = x; return 1; }
+  }
+  
+  char buf[64];
+  if (end - p >= (int)sizeof(buf)) return 0;
+  memcpy(buf, p, end - p);
+  buf[end - p] = '\0';
+  
+  char *buf_end;
+  *val = strtod(buf, &buf_end);
+  
+  return buf_end == buf + (end - p) && !ISNAN(*val);
+}
+
+
+
+//=========================================================
+// Delimited text. One line per row; the first field is the
+// row label and the next n_cols fields are values. Only a
+// taxonomy field may follow them.
+//=========================================================
+
+static void parse_table_chunk (chunk_t *chunk) {
+  
+  const char *p   = chunk->begin;
+  const char *end = chunk->end;
+  
+  while (p < end) {
+    
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+    
+    if (line_end == p) { p = eol + 1; continue; } // blank line
+    
+    
+    // Row label
+    const char *field_end = memchr(p, sep, line_end - p);
+    if (!field_end) CHUNK_ERROR("row has no values", p);
+    
+    const char *label = p, *label_end = field_end;
+    if (label_end - label >= 2 && *label == '"' && label_end[-1] == '"') {
+      label++;
+      label_end--;
+    }
+    if (!push_label(chunk, label, label_end - label))
+      CHUNK_ERROR("insufficient memory", p); // # nocov
+    
+    
+    // Values
+    int col = 0;
+    for (p = field_end + 1; col < n_cols; col++) {
+      
+      if (p > line_end) CHUNK_ERROR("row has too few values", label);
+      
+      field_end = memchr(p, sep, line_end - p);
+      if (!field_end) field_end = line_end;
+      
+      double val;
+      if (!parse_num(p, field_end, &val)) CHUNK_ERROR("non-numeric value", p);
+      if (val && !push_val(chunk, chunk->n_rows, col, val))
+        CHUNK_ERROR("insufficient memory", p); // # nocov
+      
+      p = field_end + 1;
+    }
+    
+    // A header without a corner label has one field too few.
+    if (p < line_end && !tax_col) CHUNK_ERROR("row has too many values", label);
+    
+    chunk->n_rows++;
+    p = eol + 1;
+  }
+}
+
+
+
+//=========================================================
+// BIOM-JSON data arrays. Sparse entries are [row, col, val]
+// triplets; dense entries are one array per row.
+//=========================================================
+
+static const char *skip_ws (const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+  return p;
+}
+
+static const char *parse_json_num (const char *p, const char *end, double *val) {
+  
+  p = skip_ws(p, end);
+  
+  const char *num_end = p;
+  while (num_end < end && *num_end != ',' && *num_end != ']' &&
+         *num_end != ' ' && *num_end != '\n' && *num_end != '\r') num_end++;
+  
+  if (num_end == p || !parse_num(p, num_end, val)) return NULL;
+  
+  return skip_ws(num_end, end);
+}
+
+static void parse_biom_chunk (chunk_t *chunk) {
+  
+  const char *p   = chunk->begin;
+  const char *end = chunk->end;
+  
+  while ((p = memchr(p, '[', end - p))) {
+    
+    double x;
+    p++;
+    
+    if (fmt == FMT_BIOM_SPARSE) {
+      
+      double row, col;
+      const char *at = p;
+      if (!(p = parse_json_num(p, end, &row)) || p == end || *p++ != ',' ||
+          !(p = parse_json_num(p, end, &col)) || p == end || *p++ != ',' ||
+          !(p = parse_json_num(p, end, &x))   || p == end || *p++ != ']' )
+        CHUNK_ERROR("malformed sparse data entry", at);
+      
+      if (row < 0 || row >= n_rows || col < 0 || col >= n_cols || row != floor(row) || col != floor(col))
+        CHUNK_ERROR("data entry out of range", at);
+      
+      if (x && !push_val(chunk, (int)row, (int)col, x))
+        CHUNK_ERROR("insufficient memory", at); // # nocov
+    }
+    
+    else { // FMT_BIOM_DENSE
+      
+      const char *at = p;
+      int col = 0;
+      
+      if ((p = skip_ws(p, end)) < end && *p == ']') {
+        p++;
+      }
+      else {
+        for (;; col++) {
+          if (!(p = parse_json_num(p, end, &x)) || p == end)
+            CHUNK_ERROR("malformed dense data row", at);
+          if (col < n_cols && x && !push_val(chunk, chunk->n_rows, col, x))
+            CHUNK_ERROR("insufficient memory", at); // # nocov
+          if (*p == ']') { p++; col++; break; }
+          if (*p++ != ',') CHUNK_ERROR("malformed dense data row", at);
+        }
+      }
+      
+      if (col != n_cols) CHUNK_ERROR("dense data row has the wrong length", at);
+      chunk->n_rows++;
+    }
+  }
+}
+
+
+
+static void *parse_chunks (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int i = thread_i; i < n_chunks; i += n_threads) {
+    
+    chunk_t *chunk = chunk_vec + i;
+    chunk->n_rows  = 0;
+    chunk->nnz     = 0;
+    chunk->err_msg = NULL;
+    
+    if (fmt == FMT_TABLE) { parse_table_chunk(chunk); }
+    else                  { parse_biom_chunk(chunk);  }
+  }
+  
+  return NULL;
+}
+
+
+//=========================================================
+// Split [begin, end) into n_chunks pieces, each starting
+// just after a `delim` byte (or at begin).
+//=========================================================
+
+static void split_chunks (const char *begin, const char *end, char delim, int n_threads) {
+  
+  size_t n_bytes = end - begin;
+  
+  n_chunks  = n_threads > 1 && n_bytes > 65536 ? n_threads * 4 : 1;
+  chunk_vec = calloc(n_chunks, sizeof(chunk_t));
+  if (!chunk_vec) {
+    free_all(); // # nocov
+    error("Insufficient memory."); // # nocov
+  }
+  
+  const char *prev = begin;
+  for (int i = 0; i < n_chunks; i++) {
+    
+    const char *p = begin + (n_bytes / n_chunks) * (i + 1);
+    if (i == n_chunks - 1 || p <= prev) p = end;
+    
+    if (p < end) {
+      p = memchr(p, delim, end - p);
+      p = p ? (delim == '\n' ? p + 1 : p) : end;
+    }
+    
+    chunk_vec[i].begin = prev;
+    chunk_vec[i].end   = p;
+    prev = p;
+  }
+}
+
+
+
+//=========================================================
+// Minimal JSON scanning for the BIOM header fields.
+//=========================================================
+
+static const char *skip_string (const char *p, const char *end) {
+  
+  for (p++; p < end; p++) {
+    if      (*p == '\\') p++;
+    else if (*p == '"')  return p + 1;
+  }
+  
+  return NULL;
+}
+
+static const char *skip_value (const char *p, const char *end) {
+  
+  p = skip_ws(p, end);
+  if (p >= end) return NULL;
+  
+  if (*p == '"') return skip_string(p, end);
+  
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    for (; p < end; p++) {
+      if      (*p == '"') { if (!(p = skip_string(p, end))) return NULL; p--; }
+      else if (*p == '{' || *p == '[') depth++;
+      else if (*p == '}' || *p == ']') { if (--depth == 0) return p + 1; }
+    }
+    return NULL;
+  }
+  
+  while (p < end && *p != ',' && *p != '}' && *p != ']') p++;
+  return p;
+}
+
+static int utf8_encode (char *buf, unsigned int cp) {
+  
+  if (cp < 0x80)    { buf[0] = cp; return 1; }
+  if (cp < 0x800)   { buf[0] = 0xC0 | (cp >> 6);  buf[1] = 0x80 | (cp & 0x3F); return 2; }
+  if (cp < 0x10000) { buf[0] = 0xE0 | (cp >> 12); buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+                      buf[2] = 0x80 | (cp & 0x3F); return 3; }
+  buf[0] = 0xF0 | (cp >> 18);         buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+  buf[2] = 0x80 | ((cp >> 6) & 0x3F); buf[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+// p points at the opening quote.
+static SEXP mk_json_string (const char *p, const char *end) {
+  
+  const char *str_end = skip_string(p, end) - 1;
+  p++;
+  
+  if (!memchr(p, '\\', str_end - p))
+    return mkCharLenCE(p, str_end - p, CE_UTF8);
+  
+  char *buf = (char*) safe_malloc(str_end - p + 1);
+  int   len = 0;
+  
+  for (; p < str_end; p++) {
+    
+    if (*p != '\\') { buf[len++] = *p; continue; }
+    
+    switch (*++p) {
+      case 'b': buf[len++] = '\b'; break;
+      case 'f': buf[len++] = '\f'; break;
+      case 'n': buf[len++] = '\n'; break;
+      case 'r': buf[len++] = '\r'; break;
+      case 't': buf[len++] = '\t'; break;
+      case 'u': {
+        if (str_end - p < 5) { buf[len++] = 'u'; break; }
+        unsigned int cp = (unsigned int) strtoul((char[]){ p[1], p[2], p[3], p[4], 0 }, NULL, 16);
+        p += 4;
+        if (cp >= 0xD800 && cp < 0xDC00 && str_end - p > 6 && p[1] == '\\' && p[2] == 'u') {
+          unsigned int lo = (unsigned int) strtoul((char[]){ p[3], p[4], p[5], p[6], 0 }, NULL, 16);
+          cp  = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          p  += 6;
+        }
+        len += utf8_encode(buf + len, cp);
+        break;
+      }
+      default: buf[len++] = *p; break; // \" \\ \/
+    }
+  }
+  
+  SEXP sexp_str = mkCharLenCE(buf, len, CE_UTF8);
+  free_one(buf);
+  
+  return sexp_str;
+}
+
+// Collect the "id" of each object in a "rows" or "columns" array.
+static SEXP parse_biom_ids (const char *p, const char *end) {
+  
+  int n = 0;
+  const char *q;
+  
+  // Count objects first.
+  p = skip_ws(p, end);
+  if (p >= end || *p != '[') return R_NilValue;
+  for (q = skip_ws(p + 1, end); q && q < end && *q == '{'; n++) {
+    if (!(q = skip_value(q, end))) return R_NilValue;
+    q = skip_ws(q, end);
+    if (q < end && *q == ',') q = skip_ws(q + 1, end);
+  }
+  
+  SEXP sexp_ids = PROTECT(allocVector(STRSXP, n));
+  
+  q = skip_ws(p + 1, end);
+  for (int i = 0; i < n; i++) {
+    
+    const char *obj_end = skip_value(q, end);
+    
+    for (q = skip_ws(q + 1, obj_end); q < obj_end && *q == '"'; ) {
+      
+      const char *key     = q;
+      const char *key_end = skip_string(q, obj_end);
+      const char *val     = skip_ws(skip_ws(key_end, obj_end) + 1, obj_end); // past ':'
+      
+      if (key_end - key == 4 && !memcmp(key, "\"id\"", 4) && *val == '"')
+        SET_STRING_ELT(sexp_ids, i, mk_json_string(val, obj_end));
+      
+      if (!(q = skip_value(val, obj_end))) break;
+      q = skip_ws(q, obj_end);
+      if (q < obj_end && *q == ',') q = skip_ws(q + 1, obj_end);
+    }
+    
+    q = skip_ws(obj_end, end);
+    if (q < end && *q == ',') q = skip_ws(q + 1, end);
+  }
+  
+  UNPROTECT(1);
+  return sexp_ids;
+}
+
+
+
+//=========================================================
+// Report the first chunk error, with its line number.
+//=========================================================
+
+static void check_chunks (const char *path) {
+  
+  for (int i = 0; i < n_chunks; i++) {
+    
+    const char *err_msg = chunk_vec[i].err_msg;
+    const char *err_at  = chunk_vec[i].err_at;
+    if (!err_msg) continue;
+    
+    size_t line = 1;
+    for (const char *p = file_begin; (p = memchr(p, '\n', err_at - p)); p++) line++;
+    
+    free_chunks();
+    free_all();
+    error("%s, line %lu: %s.", path, (unsigned long)line, err_msg);
+  }
+}
+
+
+static void check_unique (SEXP sexp_names, const char *path, const char *what) {
+  
+  // CHARSXPs are cached, so equal strings share one pointer.
+  int    n      = LENGTH(sexp_names);
+  size_t n_slot = 16;
+  while (n_slot < 2 * (size_t)n) n_slot *= 2;
+  
+  SEXP *slot_vec = (SEXP*) safe_malloc(n_slot * sizeof(SEXP));
+  memset(slot_vec, 0, n_slot * sizeof(SEXP));
+  
+  for (int i = 0; i < n; i++) {
+    
+    SEXP   str = STRING_ELT(sexp_names, i);
+    size_t h   = ((uintptr_t)str >> 3) * 0x9E3779B97F4A7C15ULL;
+    
+    for (h &= n_slot - 1; slot_vec[h]; h = (h + 1) & (n_slot - 1)) {
+      if (slot_vec[h] == str) {
+        free_all();
+        error("%s: duplicate %s ID '%s'.", path, what, CHAR(str));
+      }
+    }
+    
+    slot_vec[h] = str;
+  }
+  
+  free_one(slot_vec);
+}
+
+
+
+//=========================================================
+// R interface. Returns the CSR vectors and names, with
+// samples as the compressed dimension, ready to become a
+// dgCMatrix of features x samples.
+//=========================================================
+SEXP C_read_counts(
+    SEXP sexp_path,   SEXP sexp_sep,
+    SEXP sexp_margin, SEXP sexp_n_threads ) {
+  
+  const char *path      = CHAR(asChar(sexp_path));
+  int         margin    = asInteger(sexp_margin);
+  int         n_threads = asInteger(sexp_n_threads);
+  
+  sep = CHAR(asChar(sexp_sep))[0];
+  init_n_ptrs(10);
+  
+  size_t      n_bytes = 0;
+  const char *begin   = (const char*) safe_mmap(path, &n_bytes);
+  const char *end     = begin + n_bytes;
+  const char *p       = skip_ws(begin, end);
+  
+  SEXP sexp_row_names = R_NilValue;
+  SEXP sexp_col_names = R_NilValue;
+  int  n_protect      = 0;
+  
+  file_begin = begin;
+  chunk_vec  = NULL;
+  tax_col    = 0;
+  
+  
+  if (p < end && *p == '{') {
+    
+    // BIOM-JSON header fields
+    // --------------------------------------------
+    
+    const char *data_begin = NULL, *data_end = NULL;
+    fmt = 0;
+    
+    for (p = skip_ws(p + 1, end); p < end && *p == '"'; ) {
+      
+      const char *key     = p;
+      const char *key_end = skip_string(p, end);
+      if (!key_end) break;
+      const char *val     = skip_ws(skip_ws(key_end, end) + 1, end);
+      const char *val_end = skip_value(val, end);
+      if (!val_end) break;
+      
+      #define KEY_IS(s) (key_end - key == (int)strlen(s) + 2 && !memcmp(key + 1, s, strlen(s)))
+      
+      if (KEY_IS("rows")) {
+        sexp_row_names = PROTECT(parse_biom_ids(val, val_end));
+        n_protect++;
+      }
+      else if (KEY_IS("columns")) {
+        sexp_col_names = PROTECT(parse_biom_ids(val, val_end));
+        n_protect++;
+      }
+      else if (KEY_IS("matrix_type")) {
+        if (!memcmp(val, "\"sparse\"", 8)) fmt = FMT_BIOM_SPARSE;
+        if (!memcmp(val, "\"dense\"",  7)) fmt = FMT_BIOM_DENSE;
+      }
+      else if (KEY_IS("data")) {
+        data_begin = val + 1;     // inside the outer [
+        data_end   = val_end - 1; // at the closing ]
+      }
+      
+      #undef KEY_IS
+      
+      p = skip_ws(val_end, end);
+      if (p < end && *p == ',') p = skip_ws(p + 1, end);
+    }
+    
+    if (!fmt || !data_begin || isNull(sexp_row_names) || isNull(sexp_col_names)) {
+      free_all();
+      error("%s: not a valid BIOM-JSON (v1.0) file.", path);
+    }
+    
+    n_rows = LENGTH(sexp_row_names);
+    n_cols = LENGTH(sexp_col_names);
+    margin = 2; // BIOM stores samples in columns
+    
+    split_chunks(data_begin, data_end, '[', n_threads);
+  }
+  
+  else {
+    
+    // Delimited header line
+    // --------------------------------------------
+    
+    // An empty corner label may start with a tab.
+    for (p = begin; p < end && (*p == '\n' || *p == '\r'); p++);
+    
+    // Skip comment lines that have no delimiters.
+    while (p < end && *p == '#') {
+      const char *eol = memchr(p, '\n', end - p);
+      if (!eol || memchr(p, sep, eol - p)) break;
+      p = eol + 1;
+    }
+    
+    const char *eol = p < end ? memchr(p, '\n', end - p) : NULL;
+    if (!eol) eol = end;
+    const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+    
+    // Count fields after the corner label.
+    n_cols = 0;
+    for (const char *q = p; (q = memchr(q, sep, line_end - q)); q++) n_cols++;
+    if (n_cols == 0) {
+      free_all();
+      error("%s: no '%c' delimiters in header line.", path, sep);
+    }
+    
+    sexp_col_names = PROTECT(allocVector(STRSXP, n_cols));
+    n_protect++;
+    
+    const char *field = (const char*)memchr(p, sep, line_end - p) + 1;
+    for (int i = 0; i < n_cols; i++) {
+      const char *field_end = memchr(field, sep, line_end - field);
+      if (!field_end) field_end = line_end;
+      const char *str = field, *str_end = field_end;
+      if (str_end - str >= 2 && *str == '"' && str_end[-1] == '"') { str++; str_end--; }
+      SET_STRING_ELT(sexp_col_names, i, mkCharLen(str, str_end - str));
+      field = field_end + 1;
+    }
+    
+    // Drop a trailing QIIME taxonomy column.
+    const char *last = CHAR(STRING_ELT(sexp_col_names, n_cols - 1));
+    if (!strcmp(last, "taxonomy") || !strcmp(last, "Taxonomy") || !strcmp(last, "Consensus Lineage")) {
+      tax_col = 1;
+      n_cols--;
+      sexp_col_names = PROTECT(lengthgets(sexp_col_names, n_cols));
+      n_protect++;
+    }
+    
+    fmt = FMT_TABLE;
+    split_chunks(eol < end ? eol + 1 : end, end, '\n', n_threads);
+  }
+  
+  
+  // Tokenize
+  // --------------------------------------------
+  
+  run_parallel(parse_chunks, n_threads, (end - begin) / 1024);
+  check_chunks(path);
+  
+  
+  // Global row offsets and totals
+  // --------------------------------------------
+  
+  size_t nnz = 0;
+  int    row = 0;
+  for (int i = 0; i < n_chunks; i++) {
+    nnz += chunk_vec[i].nnz;
+    if (fmt != FMT_BIOM_SPARSE) {
+      int n = chunk_vec[i].n_rows;
+      chunk_vec[i].n_rows = row; // now the offset
+      row += n;
+    }
+  }
+  
+  if (fmt == FMT_BIOM_DENSE && row != n_rows) {
+    free_chunks();
+    free_all();
+    error("%s: dense data has %d rows, expected %d.", path, row, n_rows);
+  }
+  if (fmt == FMT_TABLE) n_rows = row;
+  
+  if (n_rows == 0 || n_cols == 0) {
+    free_chunks();
+    free_all();
+    error("%s: table has no data.", path);
+  }
+  
+  if (nnz > 2147483647) {
+    free_chunks();
+    free_all();
+    error("%s: more than 2^31 non-zero values, the dgCMatrix limit.", path);
+  }
+  
+  
+  // Row labels (delimited text only)
+  // --------------------------------------------
+  
+  if (fmt == FMT_TABLE) {
+    sexp_row_names = PROTECT(allocVector(STRSXP, n_rows));
+    n_protect++;
+    for (int i = 0; i < n_chunks; i++) {
+      int offset = chunk_vec[i].n_rows;
+      int n      = (i + 1 < n_chunks ? chunk_vec[i + 1].n_rows : n_rows) - offset;
+      for (int j = 0; j < n; j++)
+        SET_STRING_ELT(sexp_row_names, offset + j, mkCharLen(chunk_vec[i].label_vec[j], chunk_vec[i].label_len[j]));
+    }
+  }
+  
+  
+  // Gather triplets, oriented by margin
+  // --------------------------------------------
+  
+  int    *sam_vec = (int*)    safe_malloc((nnz + 1) * sizeof(int));
+  int    *otu_vec = (int*)    safe_malloc((nnz + 1) * sizeof(int));
+  double *val_vec = (double*) safe_malloc((nnz + 1) * sizeof(double));
+  
+  int *row_dst = margin == 1 ? sam_vec : otu_vec;
+  int *col_dst = margin == 1 ? otu_vec : sam_vec;
+  
+  size_t k = 0;
+  for (int i = 0; i < n_chunks; i++) {
+    chunk_t *chunk  = chunk_vec + i;
+    int      offset = fmt == FMT_BIOM_SPARSE ? 0 : chunk->n_rows;
+    for (size_t j = 0; j < chunk->nnz; j++, k++) {
+      row_dst[k] = chunk->row_vec[j] + offset;
+      col_dst[k] = chunk->col_vec[j];
+      val_vec[k] = chunk->val_vec[j];
+    }
+  }
+  free_chunks();
+  
+  SEXP sexp_sam_names = margin == 1 ? sexp_row_names : sexp_col_names;
+  SEXP sexp_otu_names = margin == 1 ? sexp_col_names : sexp_row_names;
+  int  n_samples      = margin == 1 ? n_rows : n_cols;
+  int  n_otus         = margin == 1 ? n_cols : n_rows;
+  
+  check_unique(sexp_sam_names, path, "sample");
+  check_unique(sexp_otu_names, path, "feature");
+  
+  ecomatrix_t *em = new_ecomatrix_triplet(
+    n_samples, n_otus, (R_xlen_t)nnz,
+    sam_vec, otu_vec, val_vec, n_threads );
+  
+  
+  // Package for R
+  // --------------------------------------------
+  
+  const char *names[] = { "p", "i", "x", "n_otus", "n_samples", "otu_names", "sample_names", "" };
+  SEXP sexp_result = PROTECT(mkNamed(VECSXP, names));
+  n_protect++;
+  
+  SEXP sexp_p = allocVector(INTSXP,  n_samples + 1);
+  SET_VECTOR_ELT(sexp_result, 0, sexp_p);
+  for (int i = 0; i <= n_samples; i++) INTEGER(sexp_p)[i] = (int)em->pos_vec[i];
+  
+  SEXP sexp_i = allocVector(INTSXP,  nnz);
+  SET_VECTOR_ELT(sexp_result, 1, sexp_i);
+  memcpy(INTEGER(sexp_i), em->otu_vec, nnz * sizeof(int));
+  
+  SEXP sexp_x = allocVector(REALSXP, nnz);
+  SET_VECTOR_ELT(sexp_result, 2, sexp_x);
+  memcpy(REAL(sexp_x), em->val_vec, nnz * sizeof(double));
+  
+  SET_VECTOR_ELT(sexp_result, 3, ScalarInteger(n_otus));
+  SET_VECTOR_ELT(sexp_result, 4, ScalarInteger(n_samples));
+  SET_VECTOR_ELT(sexp_result, 5, sexp_otu_names);
+  SET_VECTOR_ELT(sexp_result, 6, sexp_sam_names);
+  
+  free_all();
+  UNPROTECT(n_protect);
+  
+  return sexp_result;
+}
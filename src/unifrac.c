@@ -15,21 +15,25 @@
 // Variables shared between main and worker threads.
 //======================================================
 
-static int     n_samples;
-static int     n_otus;
-static int     n_edges;
-static int     n_pairs;
-static int     n_dist;
-static int    *pos_vec;
-static int    *otu_vec;
-static double *val_vec;
-static node_t *node_vec;
-static double *edge_lengths;
-static int    *pairs_vec;
-static SEXP   *sexp_extra;
-static double *weight_mtx;
-static double *sample_norm_vec;
-static double *dist_vec;
+static int       n_samples;
+static int       n_otus;
+static int       n_edges;
+static R_xlen_t  n_pairs;
+static R_xlen_t  n_dist;
+static R_xlen_t *pos_vec;
+static int      *otu_vec;
+static int      *otu_map; // tree tip of each OTU, or NULL
+static double   *val_vec;
+static node_t   *node_vec;
+static double   *edge_lengths;
+static R_xlen_t *pair_vec;  // sorted 0-based pair indices, or NULL
+static int       pair_spec; // pairs come from pair_spec_next()
+static int       n_query;   // query samples, ahead of the reference; or 0
+static SEXP     *sexp_extra;
+static double   *weight_mtx;
+static double   *sample_norm_vec;
+static double   *dist_vec; // NULL when keeping k nearest neighbors
+static float    *dist_flt; // a float32 file's values, or NULL
 
 
   
@@ -46,9 +50,9 @@ static double *dist_vec;
                                                                \
     for (; sam < n_samples; sam += n_threads) {                \
       double *sample_norm = sample_norm_vec + sam;             \
-      double *weight_vec  = weight_mtx + (sam * n_edges);      \
-      int     offset      = pos_vec[sam];                      \
-      int     nnz         = pos_vec[sam + 1] - offset;         \
+      double  *weight_vec  = weight_mtx + (size_t)sam*n_edges; \
+      R_xlen_t offset      = pos_vec[sam];                     \
+      int      nnz         = (int)(pos_vec[sam + 1] - offset); \
                                                                \
       expression;                                              \
                                                                \
@@ -94,7 +98,7 @@ static double *dist_vec;
  */
 #define FOREACH_NODE_WEIGHT(expression)                        \
   do {                                                         \
-    int node_i = *otu;                                         \
+    int node_i = otu_map ? otu_map[*otu] : *otu;               \
     while (node_i > -1) {                                      \
       node_t *node   = node_vec + node_i;                      \
       double *weight = weight_vec + node->edge;                \
@@ -110,8 +114,10 @@ static double *dist_vec;
 /*
  * FOREACH_SAMPLE_PAIR runs `expression` on all unique sample 
  * pairs, dividing the workload evenly across multiple CPU 
- * threads. When `pairs_vec == NULL`, a simpler algorithm is used
- * to iterate all-vs-all pairs.
+ * threads. When no pairs are given, a simpler algorithm is used
+ * to iterate all-vs-all pairs. With n_query, the first n_query
+ * samples are compared to the rest instead. Without dist_vec,
+ * each distance is offered to the k-nearest-neighbor heaps.
  * 
  * In all cases, FOREACH_SAMPLE_PAIR provides:
  *   - `*x_weight_vec` and `*y_weight_vec`   (from `weight_mtx`)
@@ -124,63 +130,104 @@ static double *dist_vec;
  * call or the messiness of duplicated code.
  */
 
+#define STORE_DISTANCE(idx, sam_i, sam_j, expression)          \
+  do {                                                         \
+    double  value    = 0;                                      \
+    double *distance = &value;                                 \
+                                                               \
+    expression;                                                \
+                                                               \
+    if      (dist_flt) { dist_flt[idx] = (float)value;           } \
+    else if (dist_vec) { dist_vec[idx] = value;                  } \
+    else               { knn_add(thread_i, sam_i, sam_j, value); } \
+  } while (0)
+
 #define FOREACH_SAMPLE_PAIR(expression)                        \
   do {                                                         \
     int     thread_i  = ((worker_t *)arg)->i;                  \
     int     n_threads = ((worker_t *)arg)->n;                  \
-    int     dist_idx  = 0;                                     \
+    R_xlen_t dist_idx = 0;                                     \
     double *x_weight_vec, *x_sample_norm;                      \
     double *y_weight_vec, *y_sample_norm;                      \
                                                                \
-    if (pairs_vec == NULL) { /* All vs All */                  \
+    if (n_query) { /* Query vs Reference */                    \
+                                                               \
+      for (int j = n_query; j < n_samples; j++) {              \
+        y_weight_vec  = weight_mtx + (size_t)j * n_edges;      \
+        y_sample_norm = sample_norm_vec + j;                   \
+                                                               \
+        for (int i = 0; i < n_query; i++) {                    \
+                                                               \
+          if (dist_idx % n_threads == thread_i) {              \
+            x_weight_vec  = weight_mtx + (size_t)i * n_edges;  \
+            x_sample_norm = sample_norm_vec + i;               \
+                                                               \
+            STORE_DISTANCE(dist_idx, i, j, expression);        \
+          }                                                    \
+          dist_idx++;                                          \
+        }                                                      \
+      }                                                        \
+                                                               \
+    } else if (!pair_vec && !pair_spec) { /* All vs All */     \
                                                                \
       for (int i = 0; i < n_samples - 1; i++) {                \
-        x_weight_vec  = weight_mtx + (i * n_edges);            \
+        x_weight_vec  = weight_mtx + (size_t)i * n_edges;      \
         x_sample_norm = sample_norm_vec + i;                   \
                                                                \
         for (int j = i + 1; j < n_samples; j++) {              \
                                                                \
           if (dist_idx % n_threads == thread_i) {              \
-            y_weight_vec  = weight_mtx + (j * n_edges);        \
+            y_weight_vec  = weight_mtx + (size_t)j * n_edges;  \
             y_sample_norm = sample_norm_vec + j;               \
                                                                \
-            double *distance = dist_vec + dist_idx;            \
-            *distance = 0;                                     \
-                                                               \
-            expression;                                        \
+            STORE_DISTANCE(dist_idx, i, j, expression);        \
           }                                                    \
           dist_idx++;                                          \
         }                                                      \
       }                                                        \
                                                                \
-    } else { /* Specific Pairs of Samples */                   \
+    } else if (pair_spec) { /* Pairs from a Specification */   \
+                                                               \
+      for (int sam_i = thread_i; sam_i < n_samples - 1; sam_i += n_threads) { \
+        x_weight_vec  = weight_mtx + (size_t)sam_i * n_edges;  \
+        x_sample_norm = sample_norm_vec + sam_i;               \
+                                                               \
+        int sam_j = pair_spec_next(sam_i, sam_i);              \
+        for (; sam_j < n_samples; sam_j = pair_spec_next(sam_i, sam_j)) { \
+          y_weight_vec  = weight_mtx + (size_t)sam_j * n_edges; \
+          y_sample_norm = sample_norm_vec + sam_j;             \
+                                                               \
+          dist_idx = PAIR_ROW_START(sam_i, n_samples) + sam_j - sam_i - 1; \
+          STORE_DISTANCE(dist_idx, sam_i, sam_j, expression);  \
+        }                                                      \
+      }                                                        \
+                                                               \
+    } else { /* Specific Pairs, Sorted by Row */               \
                                                                \
-      int pair_idx = thread_i;                                 \
-      for (; pair_idx < n_pairs; pair_idx += n_threads) {      \
+      R_xlen_t block     = n_pairs / n_threads + 1;            \
+      R_xlen_t pair_idx  = block * thread_i;                   \
+      R_xlen_t pair_end  = pair_idx + block < n_pairs ? pair_idx + block : n_pairs; \
+      R_xlen_t row_start = 0, row_end = 0;                     \
+      int      sam_i     = 0;                                  \
                                                                \
-        dist_idx = pairs_vec[pair_idx]; /* 1-based */          \
+      for (; pair_idx < pair_end; pair_idx++) {                \
                                                                \
-        int sam_i          = 0;                                \
-        int sam_j          = dist_idx;                         \
-        int pairs_in_block = n_samples - 1;                    \
+        dist_idx = pair_vec[pair_idx];                         \
                                                                \
-        while (sam_j > pairs_in_block) {                       \
-          sam_i++;                                             \
-          sam_j -= pairs_in_block;                             \
-          pairs_in_block--;                                    \
+        if (dist_idx >= row_end) {                             \
+          sam_i     = pair_row(dist_idx, n_samples);           \
+          row_start = PAIR_ROW_START(sam_i, n_samples);        \
+          row_end   = row_start + n_samples - sam_i - 1;       \
         }                                                      \
                                                                \
-        sam_j += sam_i;                                        \
+        int sam_j = sam_i + 1 + (int)(dist_idx - row_start);   \
                                                                \
         x_sample_norm = sample_norm_vec + sam_i;               \
         y_sample_norm = sample_norm_vec + sam_j;               \
-        x_weight_vec  = weight_mtx + (sam_i * n_edges);        \
-        y_weight_vec  = weight_mtx + (sam_j * n_edges);        \
-                                                               \
-        double *distance = dist_vec + (dist_idx - 1);          \
-        *distance = 0;                                         \
+        x_weight_vec  = weight_mtx + (size_t)sam_i * n_edges;  \
+        y_weight_vec  = weight_mtx + (size_t)sam_j * n_edges;  \
                                                                \
-        expression;                                            \
+        STORE_DISTANCE(dist_idx, sam_i, sam_j, expression);    \
       }                                                        \
     }                                                          \
                                                                \
@@ -375,30 +422,64 @@ static void *generalized_mtx (void *arg) {
   return NULL;
 }
 
+/*
+ * Each edge is weighted by its length times sum^alpha, where
+ * `sum` is the two samples' combined relative abundance.
+ * alpha = 0, 0.5, and 1 are the usual choices, and have
+ * their own kernels that avoid calling pow() for every edge.
+ */
+#define GENERALIZED_DIST(sum_alpha)                            \
+  FOREACH_SAMPLE_PAIR(                                         \
+                                                               \
+    double denominator = 0;                                    \
+                                                               \
+    FOREACH_WEIGHT_PAIR(                                       \
+                                                               \
+      double sum  = *x_weight + *y_weight;                     \
+      double frac = fabs((*x_weight - *y_weight) / sum);       \
+      double norm = *edge_length * (sum_alpha);                \
+                                                               \
+      *distance   += norm * frac;                              \
+      denominator += norm;                                     \
+                                                               \
+    );                                                         \
+                                                               \
+    *distance /= denominator;                                  \
+  )
+
 static void *generalized_dist (void *arg) {
   
   double alpha = asReal(*sexp_extra);
   
-  FOREACH_SAMPLE_PAIR(
-    
-    double denominator = 0;
+  GENERALIZED_DIST(pow(sum, alpha));
   
-    FOREACH_WEIGHT_PAIR(
-      
-      double sum  = *x_weight + *y_weight;
-      double frac = fabs((*x_weight - *y_weight) / sum);
-      double norm = *edge_length * pow(sum, alpha);
-      
-      *distance   += norm * frac;
-      denominator += norm;
-  
-    );
+  return NULL;
+}
+
+static void *generalized_dist_0 (void *arg) {
+  GENERALIZED_DIST(1);
+  return NULL;
+}
+
+static void *generalized_dist_half (void *arg) {
+  GENERALIZED_DIST(sqrt(sum));
+  return NULL;
+}
+
+static void *generalized_dist_1 (void *arg) {
+  GENERALIZED_DIST(sum);
+  return NULL;
+}
+
+static pthread_func_t generalized_setup (void) {
   
-    *distance /= denominator;
+  double alpha = asReal(*sexp_extra);
   
-  );
+  if (alpha == 0)   return generalized_dist_0;
+  if (alpha == 0.5) return generalized_dist_half;
+  if (alpha == 1)   return generalized_dist_1;
   
-  return NULL;
+  return generalized_dist;
 }
 
 
@@ -463,23 +544,27 @@ static void *var_adjusted_dist (void *arg) {
 // R interface. Dispatches threads on unifrac variants.
 //======================================================
 SEXP C_unifrac(
-    SEXP sexp_algorithm, SEXP sexp_otu_mtx,   SEXP sexp_phylo_tree, 
-    SEXP sexp_margin,    SEXP sexp_pairs_vec, SEXP sexp_n_threads,  
-    SEXP sexp_extra_args ) {
+    SEXP sexp_algorithm,      SEXP sexp_otu_mtx,   SEXP sexp_phylo_tree, 
+    SEXP sexp_margin,         SEXP sexp_min_prevalence, 
+    SEXP sexp_min_abundance,  SEXP sexp_pairs_vec, SEXP sexp_n_query, 
+    SEXP sexp_k,              SEXP sexp_file,      SEXP sexp_precision, 
+    SEXP sexp_n_threads,      SEXP sexp_extra_args ) {
   
   sexp_extra     = &sexp_extra_args;
   int n_threads  = asInteger(sexp_n_threads);
   init_n_ptrs(n_threads + 10);
   
   
-  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin);
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, sexp_margin, n_threads);
   ecotree_t   *et = new_ecotree(sexp_phylo_tree);
+  prune_otus(em, asInteger(sexp_min_prevalence), asReal(sexp_min_abundance));
   
   n_samples    = em->n_samples;
   n_otus       = em->n_otus;
   pos_vec      = em->pos_vec;
   otu_vec      = em->otu_vec;
-  val_vec      = em->val_vec;
+  otu_map      = em->otu_map;
+  val_vec      = dbl_val_vec(em);
   n_edges      = et->n_edges;
   edge_lengths = et->edge_lengths;
   node_vec     = et->node_vec;
@@ -506,7 +591,7 @@ SEXP C_unifrac(
       break;
     case G_UNIFRAC:
       calc_weight_mtx = generalized_mtx;
-      calc_dist_vec   = generalized_dist;
+      calc_dist_vec   = generalized_setup();
       break;
     case V_UNIFRAC:
       calc_weight_mtx = var_adjusted_mtx;
@@ -519,57 +604,111 @@ SEXP C_unifrac(
   
   
   // intermediary values
-  weight_mtx      = (double *)safe_malloc(n_samples * n_edges * sizeof(double));
-  sample_norm_vec = (double *)safe_malloc(n_samples           * sizeof(double));
+  size_t n_weights = (size_t)n_samples * n_edges;
+  weight_mtx       = (double *)safe_malloc(n_weights * sizeof(double));
+  sample_norm_vec  = (double *)safe_malloc(n_samples * sizeof(double));
+  
+  memset(weight_mtx,      0, n_weights * sizeof(double));
+  memset(sample_norm_vec, 0, n_samples * sizeof(double));
+  
   
-  memset(weight_mtx,      0, n_samples * n_edges * sizeof(double));
-  memset(sample_norm_vec, 0, n_samples           * sizeof(double));
+  // Create the dist object to return, or for query-vs-
+  // reference, a matrix sized to the output. For the k
+  // nearest neighbors, heaps stand in for dist_vec; with
+  // `file`, distances go straight to a mapped file.
+  n_query = isNull(sexp_n_query) ? 0 : asInteger(sexp_n_query);
+  int k   = isNull(sexp_k)       ? 0 : asInteger(sexp_k);
+  SEXP sexp_result_dist;
   
+  if (k) {
+    
+    int n_rows       = n_query ? n_query : n_samples;
+    int n_nbrs       = n_query ? n_samples - n_query : n_samples - 1;
+    n_dist           = n_query 
+      ? (R_xlen_t)n_query * (n_samples - n_query) 
+      : (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(knn_alloc(
+      n_rows, n_nbrs, n_query, k, n_threads, em->sexp_sample_names ));
+    
+  } else if (n_query) {
+    
+    n_dist           = (R_xlen_t)n_query * (n_samples - n_query);
+    sexp_result_dist = PROTECT(new_query_mtx(em, n_query));
+    
+  } else if (!isNull(sexp_file)) {
+    
+    n_dist           = (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(sexp_file);
+    
+  } else {
+    
+    n_dist           = (R_xlen_t)n_samples * (n_samples - 1) / 2;
+    sexp_result_dist = PROTECT(allocVector(REALSXP, n_dist));
+    
+    SEXP sexp_dist_class = PROTECT(mkString("dist"));
+    SEXP sexp_size_val   = PROTECT(ScalarInteger(n_samples));
+    SEXP sexp_diag_val   = PROTECT(ScalarLogical(0));
+    SEXP sexp_upper_val  = PROTECT(ScalarLogical(0));
+    
+    setAttrib(sexp_result_dist, R_ClassSymbol, sexp_dist_class);
+    setAttrib(sexp_result_dist, install("Size"), sexp_size_val);
+    setAttrib(sexp_result_dist, install("Diag"), sexp_diag_val);
+    setAttrib(sexp_result_dist, install("Upper"), sexp_upper_val);
+    setAttrib(sexp_result_dist, install("Labels"), em->sexp_sample_names);
+    UNPROTECT(4);
+  }
   
-  // Create the dist object to return
-  n_dist                = n_samples * (n_samples - 1) / 2;
-  SEXP sexp_result_dist = PROTECT(allocVector(REALSXP, n_dist));
-  dist_vec              = REAL(sexp_result_dist);
+  dist_vec = NULL;
+  dist_flt = NULL;
   
-  SEXP sexp_dist_class = PROTECT(mkString("dist"));
-  SEXP sexp_size_val   = PROTECT(ScalarInteger(n_samples));
-  SEXP sexp_diag_val   = PROTECT(ScalarLogical(0));
-  SEXP sexp_upper_val  = PROTECT(ScalarLogical(0));
+  if (!isNull(sexp_file)) {
+    int   is_float;
+    void *values = new_dist_file(
+      sexp_file, n_samples, em->sexp_sample_names, 
+      asInteger(sexp_precision) == PRECISION_SINGLE, &is_float );
+    if (is_float) { dist_flt = (float*)  values; }
+    else          { dist_vec = (double*) values; }
+  }
+  else if (!k) {
+    dist_vec = REAL(sexp_result_dist);
+  }
   
-  setAttrib(sexp_result_dist, R_ClassSymbol, sexp_dist_class);
-  setAttrib(sexp_result_dist, install("Size"), sexp_size_val);
-  setAttrib(sexp_result_dist, install("Diag"), sexp_diag_val);
-  setAttrib(sexp_result_dist, install("Upper"), sexp_upper_val);
-  setAttrib(sexp_result_dist, install("Labels"), em->sexp_sample_names);
   
+  // Avoid allocating pair_vec for common all-vs-all case
+  pair_vec  = NULL;
+  pair_spec = TYPEOF(sexp_pairs_vec) == VECSXP;
   
-  // Avoid allocating pairs_vec for common all-vs-all case
   if (isNull(sexp_pairs_vec)) {
     
-    pairs_vec = NULL;
-    n_pairs   = n_dist;
+    n_pairs = n_dist;
     
   } else {
     
-    pairs_vec = INTEGER(sexp_pairs_vec);
-    n_pairs   = LENGTH(sexp_pairs_vec);
+    if (pair_spec) { pair_spec_setup(sexp_pairs_vec, n_samples); n_pairs = n_dist; }
+    else           { pair_vec = sort_pairs(sexp_pairs_vec); n_pairs = XLENGTH(sexp_pairs_vec); }
     
-    for (int i = 0; i < n_dist; i++)
-      dist_vec[i] = R_NaReal;
+    if (dist_flt) { for (R_xlen_t i = 0; i < n_dist; i++) dist_flt[i] = (float)R_NaReal; }
+    else          { for (R_xlen_t i = 0; i < n_dist; i++) dist_vec[i] = R_NaReal;        }
     
     if (n_pairs == 0) {
       free_all();
-      UNPROTECT(5);
-      return sexp_result_dist;
+      UNPROTECT(1);
+      return isNull(sexp_file) ? sexp_result_dist : C_dist_file_info(sexp_file);
     }
   }
   
   
   run_parallel(calc_weight_mtx, n_threads, n_pairs);
-  run_parallel(calc_dist_vec,   n_threads, n_pairs);
+  if (k) {
+    knn_run(calc_dist_vec, n_threads, n_pairs);
+    knn_finish(n_threads);
+  }
+  else {
+    run_parallel(calc_dist_vec, n_threads, n_pairs);
+  }
   
   
   free_all();
-  UNPROTECT(5);
-  return sexp_result_dist;
+  UNPROTECT(1);
+  return isNull(sexp_file) ? sexp_result_dist : C_dist_file_info(sexp_file);
 }
@@ -0,0 +1,438 @@
+// Copyright (c) 2026 ecodive authors
+// Licensed under the MIT License: https://opensource.org/license/mit
+
+/*
+ * Vantage-point trees over a reference panel, for finding the
+ * nearest reference samples to each query without computing
+ * every query-reference distance.
+ *
+ * The tree is stored implicitly in two vectors: `order` lists
+ * the reference samples and `radius` holds each node's median
+ * distance. The node at position `lo` owns positions lo..hi-1;
+ * it is the vantage point, and the rest are split at
+ * mid = lo + 1 + (hi - lo - 1) / 2 into an inside half
+ * (distance <= radius) and an outside half (>= radius). Both
+ * vectors are plain R data, so the index can be saved to disk.
+ *
+ * Distances come from the kernels in beta_div.c, in batches:
+ * the tree is built one level at a time, and queries advance
+ * in rounds of one distance each. The triangle inequality
+ * gives every subtree a lower bound on its distance to the
+ * query, and subtrees that cannot beat the current k-th
+ * neighbor (or the radius) are skipped.
+ */
+
+#include "ecodive.h"
+
+// Relative allowance for rounding when bounding subtrees.
+#define VPTREE_SLACK 1e-9
+
+
+typedef struct {
+  double distance;
+  int    sam;
+} vp_item_t;
+
+typedef struct {
+  int    qry;
+  int    ref;
+  double distance;
+} vp_match_t;
+
+
+static pthread_func_t bdiv_func;
+static int            n_threads;
+static int            root;      // take sqrt() of kernel distances
+static int           *pair_vec;  // 2 * batch size
+static double        *dist_vec;  // batch size
+
+static int           *node_vec;  // 0-based reference sample at each node
+static double        *radius_vec;
+static vp_item_t     *item_vec;
+static int           *seg_vec;   // lo, hi of each segment in a level
+static int            n_segs;
+
+
+// Run a batch of n pairs, queued in pair_vec.
+static void batch_distances (R_xlen_t n) {
+  
+  bdiv_pairs(bdiv_func, pair_vec, n, dist_vec, n_threads);
+  
+  if (root)
+    for (R_xlen_t i = 0; i < n; i++)
+      dist_vec[i] = sqrt(dist_vec[i]);
+}
+
+
+// Nearest first, then by sample; NaN last.
+static int cmp_items (const void *a, const void *b) {
+  
+  const vp_item_t *x = (const vp_item_t *)a;
+  const vp_item_t *y = (const vp_item_t *)b;
+  
+  if (isnan(x->distance) != isnan(y->distance)) return isnan(x->distance) ? 1 : -1;
+  if (x->distance < y->distance) return -1;
+  if (x->distance > y->distance) return  1;
+  return (x->sam > y->sam) - (x->sam < y->sam);
+}
+
+
+// By query, then nearest first, then by sample.
+static int cmp_matches (const void *a, const void *b) {
+  
+  const vp_match_t *x = (const vp_match_t *)a;
+  const vp_match_t *y = (const vp_match_t *)b;
+  
+  if (x->qry != y->qry) return (x->qry > y->qry) - (x->qry < y->qry);
+  if (x->distance < y->distance) return -1;
+  if (x->distance > y->distance) return  1;
+  return (x->ref > y->ref) - (x->ref < y->ref);
+}
+
+
+// Sort each segment's non-vantage items by distance and
+// record the median as the vantage point's radius.
+static void *split_segments (void *arg) {
+  
+  int thread_i  = ((worker_t *)arg)->i;
+  int n_threads = ((worker_t *)arg)->n;
+  
+  for (int seg = thread_i; seg < n_segs; seg += n_threads) {
+    
+    int lo  = seg_vec[2 * seg];
+    int hi  = seg_vec[2 * seg + 1];
+    int mid = lo + 1 + (hi - lo - 1) / 2;
+    
+    qsort(item_vec + lo + 1, hi - lo - 1, sizeof(vp_item_t), cmp_items);
+    
+    for (int i = lo + 1; i < hi; i++)
+      node_vec[i] = item_vec[i].sam;
+    
+    radius_vec[lo] = item_vec[mid].distance;
+  }
+  
+  return NULL;
+}
+
+
+// Shared by both R entry points: the ecomatrix and kernel.
+static ecomatrix_t *vptree_setup (
+    SEXP sexp_algorithm, SEXP sexp_otu_mtx, SEXP sexp_norm, SEXP sexp_root,
+    SEXP sexp_n_threads, SEXP sexp_pseudocount, SEXP *sexp_extra ) {
+  
+  n_threads = asInteger(sexp_n_threads);
+  root      = asLogical(sexp_root) == TRUE;
+  
+  ecomatrix_t *em = new_ecomatrix(sexp_otu_mtx, PROTECT(ScalarInteger(1)), n_threads);
+  UNPROTECT(1);
+  
+  int norm = asInteger(sexp_norm);
+  if (norm) normalize(em, norm, n_threads, asReal(sexp_pseudocount));
+  
+  bdiv_func = bdiv_pairs_setup(em, asInteger(sexp_algorithm), n_threads, sexp_extra);
+  
+  return em;
+}
+
+
+
+//======================================================
+// R interface. Builds the tree over every sample in
+// `otu_mtx`; returns list(order, radius).
+//======================================================
+SEXP C_vptree_build(
+    SEXP sexp_algorithm,   SEXP sexp_otu_mtx,
+    SEXP sexp_norm,        SEXP sexp_root,
+    SEXP sexp_n_threads,   SEXP sexp_pseudocount,
+    SEXP sexp_extra_args ) {
+  
+  init_n_ptrs(20);
+  
+  ecomatrix_t *em = vptree_setup(
+    sexp_algorithm, sexp_otu_mtx, sexp_norm, sexp_root,
+    sexp_n_threads, sexp_pseudocount, &sexp_extra_args );
+  
+  int n_samples = em->n_samples;
+  
+  SEXP sexp_result = PROTECT(allocVector(VECSXP, 2));
+  SEXP sexp_order  = allocVector(INTSXP,  n_samples);
+  SET_VECTOR_ELT(sexp_result, 0, sexp_order);
+  SEXP sexp_radius = allocVector(REALSXP, n_samples);
+  SET_VECTOR_ELT(sexp_result, 1, sexp_radius);
+  
+  SEXP sexp_names = PROTECT(allocVector(STRSXP, 2));
+  SET_STRING_ELT(sexp_names, 0, mkChar("order"));
+  SET_STRING_ELT(sexp_names, 1, mkChar("radius"));
+  setAttrib(sexp_result, R_NamesSymbol, sexp_names);
+  
+  node_vec   = INTEGER(sexp_order);
+  radius_vec = REAL(sexp_radius);
+  item_vec   = (vp_item_t*) safe_malloc(((size_t)n_samples + 1) * sizeof(vp_item_t));
+  pair_vec   = (int*)       safe_malloc(((size_t)n_samples + 1) * 2 * sizeof(int));
+  dist_vec   = (double*)    safe_malloc(((size_t)n_samples + 1) * sizeof(double));
+  seg_vec    = (int*)       safe_malloc(((size_t)n_samples + 1) * 2 * sizeof(int));
+  int *next_vec = (int*)    safe_malloc(((size_t)n_samples + 1) * 2 * sizeof(int));
+  
+  for (int i = 0; i < n_samples; i++) {
+    node_vec[i]   = i;
+    radius_vec[i] = 0;
+  }
+  
+  
+  // One level of the tree per pass. Segments of one sample
+  // are leaves and drop out.
+  n_segs = 0;
+  if (n_samples > 1) {
+    seg_vec[0] = 0;
+    seg_vec[1] = n_samples;
+    n_segs     = 1;
+  }
+  
+  while (n_segs) {
+    
+    R_xlen_t n_pairs = 0;
+    for (int seg = 0; seg < n_segs; seg++) {
+      int lo = seg_vec[2 * seg], hi = seg_vec[2 * seg + 1];
+      for (int i = lo + 1; i < hi; i++) {
+        pair_vec[2 * n_pairs]     = node_vec[lo];
+        pair_vec[2 * n_pairs + 1] = node_vec[i];
+        n_pairs++;
+      }
+    }
+    
+    batch_distances(n_pairs);
+    
+    R_xlen_t pair_i = 0;
+    for (int seg = 0; seg < n_segs; seg++) {
+      int lo = seg_vec[2 * seg], hi = seg_vec[2 * seg + 1];
+      for (int i = lo + 1; i < hi; i++, pair_i++)
+        item_vec[i] = (vp_item_t){ dist_vec[pair_i], node_vec[i] };
+    }
+    
+    run_parallel(split_segments, n_threads, n_pairs);
+    
+    int n_next = 0;
+    for (int seg = 0; seg < n_segs; seg++) {
+      int lo  = seg_vec[2 * seg], hi = seg_vec[2 * seg + 1];
+      int mid = lo + 1 + (hi - lo - 1) / 2;
+      if (mid - lo - 1 > 1) { next_vec[2 * n_next] = lo + 1; next_vec[2 * n_next + 1] = mid; n_next++; }
+      if (hi - mid     > 1) { next_vec[2 * n_next] = mid;    next_vec[2 * n_next + 1] = hi;  n_next++; }
+    }
+    
+    int *tmp = seg_vec; seg_vec = next_vec; next_vec = tmp;
+    n_segs   = n_next;
+  }
+  
+  for (int i = 0; i < n_samples; i++) node_vec[i]++; // 1-based
+  
+  free_all();
+  UNPROTECT(2);
+  return sexp_result;
+}
+
+
+
+//======================================================
+// R interface. The first n_query samples of `otu_mtx` are
+// queries; the rest are the reference panel, in the order
+// the tree was built with. Returns the k nearest as
+// list(index, distance) matrices, or without k, every
+// reference within `max_dist` as lists of vectors.
+//======================================================
+SEXP C_vptree_query(
+    SEXP sexp_algorithm,   SEXP sexp_otu_mtx,
+    SEXP sexp_norm,        SEXP sexp_root,
+    SEXP sexp_n_query,     SEXP sexp_order,
+    SEXP sexp_radius,      SEXP sexp_k,
+    SEXP sexp_max_dist,    SEXP sexp_n_threads,
+    SEXP sexp_pseudocount, SEXP sexp_extra_args ) {
+  
+  init_n_ptrs(24);
+  
+  ecomatrix_t *em = vptree_setup(
+    sexp_algorithm, sexp_otu_mtx, sexp_norm, sexp_root,
+    sexp_n_threads, sexp_pseudocount, &sexp_extra_args );
+  
+  int     n_query  = asInteger(sexp_n_query);
+  int     n_ref    = em->n_samples - n_query;
+  int     k        = isNull(sexp_k) ? 0 : asInteger(sexp_k);
+  double  max_dist = isNull(sexp_max_dist) ? R_PosInf : asReal(sexp_max_dist);
+  int    *order    = INTEGER(sexp_order); // 1-based
+  double *radius   = REAL(sexp_radius);
+  
+  SEXP sexp_result = R_NilValue;
+  if (k) {
+    sexp_result = PROTECT(knn_alloc(
+      n_query, n_ref, n_query, k, 1, em->sexp_sample_names ));
+  }
+  
+  
+  // A stack of pending subtrees per query, each with a lower
+  // bound on its distance. Nearer halves are pushed last, so
+  // a stack never holds more than one subtree per level.
+  int stack_cap = 2;
+  for (int n = n_ref; n > 1; n /= 2) stack_cap += 2;
+  
+  size_t  n_slots   = (size_t)n_query * stack_cap;
+  int    *lo_stack  = (int*)    safe_malloc(n_slots * sizeof(int));
+  int    *hi_stack  = (int*)    safe_malloc(n_slots * sizeof(int));
+  double *lb_stack  = (double*) safe_malloc(n_slots * sizeof(double));
+  int    *n_stack   = (int*)    safe_malloc(((size_t)n_query + 1) * sizeof(int));
+  int    *batch_qry = (int*)    safe_malloc(((size_t)n_query + 1) * sizeof(int));
+  int    *batch_lo  = (int*)    safe_malloc(((size_t)n_query + 1) * sizeof(int));
+  int    *batch_hi  = (int*)    safe_malloc(((size_t)n_query + 1) * sizeof(int));
+  double *batch_lb  = (double*) safe_malloc(((size_t)n_query + 1) * sizeof(double));
+  pair_vec          = (int*)    safe_malloc(((size_t)n_query + 1) * 2 * sizeof(int));
+  dist_vec          = (double*) safe_malloc(((size_t)n_query + 1) * sizeof(double));
+  
+  size_t      match_cap = 1024, n_matches = 0;
+  vp_match_t *match_vec = k ? NULL : (vp_match_t*) safe_malloc(match_cap * sizeof(vp_match_t));
+  
+  for (int qry = 0; qry < n_query; qry++) {
+    size_t slot = (size_t)qry * stack_cap;
+    lo_stack[slot] = 0;
+    hi_stack[slot] = n_ref;
+    lb_stack[slot] = 0;
+    n_stack[qry]   = n_ref > 0;
+  }
+  
+  
+  while (1) {
+    
+    // Each query's next subtree that could still hold a match.
+    int n_batch = 0;
+    for (int qry = 0; qry < n_query; qry++) {
+      
+      double bound = k ? fmin(knn_bound(qry), max_dist) : max_dist;
+      size_t base  = (size_t)qry * stack_cap;
+      
+      while (n_stack[qry]) {
+        size_t slot = base + --n_stack[qry];
+        if (lb_stack[slot] > bound) continue;
+        
+        int lo = lo_stack[slot];
+        batch_qry[n_batch]        = qry;
+        batch_lo[n_batch]         = lo;
+        batch_hi[n_batch]         = hi_stack[slot];
+        batch_lb[n_batch]         = lb_stack[slot];
+        pair_vec[2 * n_batch]     = qry;
+        pair_vec[2 * n_batch + 1] = n_query + order[lo] - 1;
+        n_batch++;
+        break;
+      }
+    }
+    
+    if (!n_batch) break;
+    
+    batch_distances(n_batch);
+    
+    for (int b = 0; b < n_batch; b++) {
+      
+      int    qry = batch_qry[b];
+      int    lo  = batch_lo[b];
+      int    hi  = batch_hi[b];
+      int    ref = order[lo] - 1;
+      double d   = dist_vec[b];
+      
+      if (d <= max_dist) {
+        if (k) {
+          knn_add(0, qry, n_query + ref, d);
+        }
+        else {
+          if (n_matches == match_cap) {
+            vp_match_t *grown = (vp_match_t*) safe_malloc(2 * match_cap * sizeof(vp_match_t));
+            memcpy(grown, match_vec, match_cap * sizeof(vp_match_t));
+            free_one(match_vec);
+            match_vec  = grown;
+            match_cap *= 2;
+          }
+          match_vec[n_matches++] = (vp_match_t){ qry, ref, d };
+        }
+      }
+      
+      if (hi - lo < 2) continue;
+      
+      // Points inside are no nearer than d - mu; points
+      // outside no nearer than mu - d. A NaN bound never
+      // prunes.
+      int    mid    = lo + 1 + (hi - lo - 1) / 2;
+      double mu     = radius[lo];
+      double slack  = VPTREE_SLACK * (fabs(d) + fabs(mu));
+      double lb_in  = fmax(batch_lb[b], d - mu - slack);
+      double lb_out = fmax(batch_lb[b], mu - d - slack);
+      if (isnan(d) || isnan(mu)) lb_in = lb_out = batch_lb[b];
+      
+      size_t slot = (size_t)qry * stack_cap + n_stack[qry];
+      int    has_in = mid > lo + 1;
+      
+      if (d < mu) { // inside is nearer; push it last
+        lo_stack[slot] = mid;    hi_stack[slot] = hi;  lb_stack[slot++] = lb_out;
+        if (has_in) {
+          lo_stack[slot] = lo + 1; hi_stack[slot] = mid; lb_stack[slot++] = lb_in;
+        }
+      }
+      else {
+        if (has_in) {
+          lo_stack[slot] = lo + 1; hi_stack[slot] = mid; lb_stack[slot++] = lb_in;
+        }
+        lo_stack[slot] = mid;    hi_stack[slot] = hi;  lb_stack[slot++] = lb_out;
+      }
+      
+      n_stack[qry] = (int)(slot - (size_t)qry * stack_cap);
+    }
+  }
+  
+  
+  if (k) {
+    knn_finish(n_threads);
+    free_all();
+    UNPROTECT(1);
+    return sexp_result;
+  }
+  
+  
+  // Every match within max_dist, as a list of vectors per
+  // query, nearest first.
+  qsort(match_vec, n_matches, sizeof(vp_match_t), cmp_matches);
+  
+  sexp_result           = PROTECT(allocVector(VECSXP, 2));
+  SEXP sexp_index_list  = allocVector(VECSXP, n_query);
+  SET_VECTOR_ELT(sexp_result, 0, sexp_index_list);
+  SEXP sexp_dist_list   = allocVector(VECSXP, n_query);
+  SET_VECTOR_ELT(sexp_result, 1, sexp_dist_list);
+  
+  SEXP sexp_list_names = PROTECT(allocVector(STRSXP, 2));
+  SET_STRING_ELT(sexp_list_names, 0, mkChar("index"));
+  SET_STRING_ELT(sexp_list_names, 1, mkChar("distance"));
+  setAttrib(sexp_result, R_NamesSymbol, sexp_list_names);
+  
+  if (!isNull(em->sexp_sample_names)) {
+    SEXP sexp_qry_names = PROTECT(allocVector(STRSXP, n_query));
+    for (int i = 0; i < n_query; i++)
+      SET_STRING_ELT(sexp_qry_names, i, STRING_ELT(em->sexp_sample_names, i));
+    setAttrib(sexp_index_list, R_NamesSymbol, sexp_qry_names);
+    setAttrib(sexp_dist_list,  R_NamesSymbol, sexp_qry_names);
+    UNPROTECT(1);
+  }
+  
+  size_t m = 0;
+  for (int qry = 0; qry < n_query; qry++) {
+    
+    size_t end = m;
+    while (end < n_matches && match_vec[end].qry == qry) end++;
+    
+    SEXP sexp_index = allocVector(INTSXP,  end - m);
+    SET_VECTOR_ELT(sexp_index_list, qry, sexp_index);
+    SEXP sexp_dist  = allocVector(REALSXP, end - m);
+    SET_VECTOR_ELT(sexp_dist_list,  qry, sexp_dist);
+    
+    for (size_t i = 0; m < end; i++, m++) {
+      INTEGER(sexp_index)[i] = match_vec[m].ref + 1;
+      REAL(sexp_dist)[i]     = match_vec[m].distance;
+    }
+  }
+  
+  free_all();
+  UNPROTECT(2);
+  return sexp_result;
+}
@@ -36,6 +36,68 @@
     current = as.vector(unweighted_unifrac(counts, tree, pairs = 1:2)), 
     target  = c(0.426927101499826, 0.426927101499826, NA, NA, NA, NA) )
   
+  # Unsorted and repeated pairs, across rows and threads
+  idx  <- c(5000, 17, 103, 17, 2, 5355, 104, 950)
+  full <- as.vector(bray(big_mtx))
+  expect_equal(as.vector(bray(big_mtx, pairs = idx, cpus = 3))[idx], full[idx])
+  expect_equal(
+    current = as.vector(weighted_unifrac(big_mtx, tree, pairs = idx, cpus = 3))[idx],
+    target  = as.vector(weighted_unifrac(big_mtx, tree))[idx] )
+  
+  # Enough pairs to run threaded, so each thread's batch
+  # starts and ends part way through a row.
+  set.seed(1)
+  idx <- c(sample(5356, 600, replace = TRUE), 1, 5356)
+  expect_equal(as.vector(bray(big_mtx, pairs = idx, cpus = 3))[idx], full[idx])
+  expect_equal(
+    current = as.vector(euclidean(big_mtx, pairs = idx, cpus = 3))[idx],
+    target  = as.vector(euclidean(big_mtx))[idx] )
+  expect_equal(
+    current = as.vector(weighted_unifrac(big_mtx, tree, pairs = idx, cpus = 3))[idx],
+    target  = as.vector(weighted_unifrac(big_mtx, tree))[idx] )
+  
+  
+  
+  # Pairs from a study design ====
+  
+  # The same pairs as a logical vector over the dist object.
+  by_design <- function (keep) {
+    n <- nrow(big_mtx)
+    m <- matrix(FALSE, n, n)
+    for (i in seq_len(n)) for (j in seq_len(n)) m[i, j] <- keep(i, j)
+    m[lower.tri(m)]
+  }
+  
+  subject <- rep_len(c('a', 'b', 'c', NA), nrow(big_mtx))
+  visit   <- rev(seq_len(nrow(big_mtx)))
+  same    <- function (i, j) !is.na(subject[i]) && identical(subject[i], subject[j])
+  differ  <- function (i, j) !anyNA(subject[c(i, j)]) && subject[i] != subject[j]
+  series  <- which(!is.na(subject))[order(subject[!is.na(subject)], visit[!is.na(subject)])]
+  consec  <- function (i, j) any(abs(diff(match(c(i, j), series))) == 1 & same(i, j))
+  
+  expect_equal(
+    current = bray(big_mtx, pairs = pairs_within(subject), cpus = 2), 
+    target  = bray(big_mtx, pairs = by_design(same)) )
+  expect_equal(
+    current = bray(big_mtx, pairs = pairs_between(setNames(subject, rownames(big_mtx)))), 
+    target  = bray(big_mtx, pairs = by_design(differ)) )
+  expect_equal(
+    current = euclidean(big_mtx, pairs = pairs_consecutive(subject, visit), cpus = 2), 
+    target  = euclidean(big_mtx, pairs = by_design(consec)) )
+  expect_equal(
+    current = bray(big_mtx, pairs = pairs_one_vs_all('S50')), 
+    target  = bray(big_mtx, pairs = by_design(function (i, j) 50 %in% c(i, j))) )
+  expect_equal(
+    current = weighted_unifrac(big_mtx, tree, pairs = pairs_within(subject), cpus = 2), 
+    target  = weighted_unifrac(big_mtx, tree, pairs = by_design(same)) )
+  expect_equal(
+    current = bray(t(big_mtx), margin = 2, pairs = pairs_one_vs_all(3)), 
+    target  = bray(big_mtx, pairs = pairs_one_vs_all('S3')) )
+  
+  expect_stdout(print(pairs_within(subject)))
+  expect_error(bray(big_mtx, pairs = pairs_within(subject[-1])))
+  expect_error(bray(big_mtx, pairs = pairs_one_vs_all('nope')))
+  
   
   
   # Pairs == integer(0) ====
@@ -155,6 +217,11 @@
     target  = c(0.461633430665443,  0.452969548713512, 0.601617618207151, 
                  0.0514229205275909, 0.248010203981353, 0.294478054449811 ))
   
+  # alpha = 0, 0.5, and 1 have their own kernels.
+  expect_equal(generalized_unifrac(counts, tree, alpha = 1), normalized_unifrac(counts, tree))
+  expect_equal(generalized_unifrac(counts, tree, alpha = 0.5), generalized_unifrac(counts, tree, alpha = 0.5 + 1e-12))
+  expect_equal(generalized_unifrac(counts, tree, alpha = 0), generalized_unifrac(counts, tree, alpha = 1e-12))
+  
   
   
   # Gower ====
@@ -164,6 +231,11 @@
     target  = c(0.388571428571429,  0.408571428571429, 0.571428571428571, 
                  0.0771428571428571, 0.182857142857143, 0.22))
   
+  expect_equal( # ranges come from the parallel OTU-major view
+    current = gower(big_mtx, cpus = 2), 
+    target  = gower(big_mtx, cpus = 1) )
+  expect_equal(gower(counts_int), gower(counts))
+  
   
   
   # Hellinger ====
@@ -251,6 +323,13 @@
     target  = c(8.87866660953074, 9.83182738119092, 13.417493822195, 
                  2.44726081477148, 5.81121051366182,  7.24976150371949 ))
   
+  # p = 1, 2, and 3 have their own kernels.
+  for (p in 1:3)
+    expect_equal(
+      current = as.vector(minkowski(counts, power = p)), 
+      target  = as.vector(stats::dist(counts, 'minkowski', p = p)), 
+      info    = p )
+  
   
   
   # Morisita ====
@@ -393,4 +472,185 @@
     target  = c(0.682012820512821,  0.641941391941392, 1.05051282051282, 
                  0.0899920634920635, 0.438388888888889, 0.528380952380952 ))
   
+  
+  
+  # Inverted index and per-pair kernels agree ====
+  
+  neg_mtx <- big_mtx
+  neg_mtx[3,2] <- -1
+  
+  run_all <- function (engine) {
+    op <- options(ecodive.inverted_index = engine)
+    on.exit(options(op))
+    list(
+      bray(big_mtx),    bray(big_mtx, norm = 'percent'),  bray(neg_mtx), 
+      jaccard(big_mtx), sorensen(big_mtx),  ochiai(big_mtx), 
+      soergel(big_mtx), motyka(big_mtx),    horn(big_mtx), 
+      morisita(big_mtx), bray(big_mtx, cpus = 2), 
+      bhattacharyya(big_mtx), squared_chord(big_mtx), jsd(big_mtx), 
+      lorentzian(big_mtx),    lorentzian(neg_mtx),    squared_chord(neg_mtx) )
+  }
+  expect_equal(run_all(TRUE), run_all(FALSE))
+  
+  # Both engines against the closed forms, one pair at a time.
+  pairwise <- function (mtx, f, pct = TRUE) {
+    if (pct) mtx <- mtx / rowSums(mtx)
+    ij <- combn(nrow(mtx), 2L)
+    vapply(seq_len(ncol(ij)), function (k) f(mtx[ij[1,k],], mtx[ij[2,k],]), 0)
+  }
+  kl <- function (p, m) sum(p[p > 0] * log(p[p > 0] / m[p > 0]))
+  closed <- list(
+    pairwise(big_mtx, function (p, q) -log(sum(sqrt(p * q)))), 
+    pairwise(big_mtx, function (p, q) sum((sqrt(p) - sqrt(q)) ^ 2)), 
+    pairwise(big_mtx, function (p, q) (kl(p, (p + q) / 2) + kl(q, (p + q) / 2)) / 2), 
+    pairwise(big_mtx, function (x, y) sum(log1p(abs(x - y))), pct = FALSE), 
+    pairwise(neg_mtx, function (x, y) sum(log1p(abs(x - y))), pct = FALSE) )
+  for (engine in c(TRUE, FALSE)) {
+    op <- options(ecodive.inverted_index = engine)
+    expect_equal(
+      current = lapply(
+        X   = list(
+          bhattacharyya(big_mtx), squared_chord(big_mtx), jsd(big_mtx), 
+          lorentzian(big_mtx),    lorentzian(neg_mtx) ), 
+        FUN = as.vector ), 
+      target  = closed )
+    options(op)
+  }
+  
+  # Cached transforms can round below zero for identical samples.
+  for (f in list(jensen, hellinger, matusita))
+    expect_false(anyNA(f(big_mtx[c(1, 1, 2),])))
+  
+  # Stored zeros, one of them shared by samples A and B.
+  if (requireNamespace('slam', quietly = TRUE)) {
+    stm   <- slam::as.simple_triplet_matrix(counts)
+    stm$i <- c(stm$i, 1L, 2L, 2L)
+    stm$j <- c(stm$j, 1L, 1L, 4L)
+    stm$v <- c(stm$v, 0,  0,  0)
+    for (engine in c(TRUE, FALSE)) {
+      op <- options(ecodive.inverted_index = engine)
+      expect_equal(jsd(stm),    jsd(counts))
+      expect_equal(jensen(stm), jensen(counts))
+      options(op)
+    }
+  }
+  
+  
+  
+  # Per-pair kernels gallop over much longer samples ====
+  
+  skew_mtx <- cbind(big_mtx, matrix(0, nrow(big_mtx), 200))
+  colnames(skew_mtx) <- paste0('OTU', seq_len(ncol(skew_mtx)))
+  skew_mtx[1,] <- seq_len(ncol(skew_mtx))
+  first_row    <- seq_len(nrow(skew_mtx) - 1)
+  
+  for (f in list(bray, jaccard, horn, motyka))
+    expect_equal(
+      current = as.vector(f(skew_mtx, pairs = first_row))[first_row], 
+      target  = as.vector(f(skew_mtx))[first_row] )
+  
+  x      <- skew_mtx[1,]
+  oracle <- function (f) apply(skew_mtx[-1,], 1L, function (y) f(x, y))
+  expect_equal(
+    current = as.vector(bray(skew_mtx, pairs = first_row))[first_row], 
+    target  = unname(oracle(function (x, y) 1 - 2 * sum(pmin(x, y)) / sum(x, y))) )
+  expect_equal(
+    current = as.vector(jaccard(skew_mtx, pairs = first_row, cpus = 2))[first_row], 
+    target  = unname(oracle(function (x, y) 1 - sum(x & y) / sum(x | y))) )
+  expect_equal(
+    current = as.vector(motyka(skew_mtx, pairs = first_row))[first_row], 
+    target  = unname(oracle(function (x, y) sum(pmax(x, y)) / sum(x, y))) )
+  
+  
+  
+  # Fractional pseudocounts and sparse double zeros under CLR ====
+  
+  clr <- function (x) { x <- log(x + 0.5); x - mean(x) }
+  expect_equal(
+    current = as.vector(aitchison(counts, pseudocount = 0.5)), 
+    target  = as.vector(dist(t(apply(counts, 1L, clr)))) )
+  expect_equal(
+    current = as.vector(manhattan(counts, norm = 'clr', pseudocount = 0.5)), 
+    target  = as.vector(dist(t(apply(counts, 1L, clr)), 'manhattan')) )
+  expect_equal(
+    current = as.vector(chebyshev(counts, norm = 'clr', pseudocount = 0.5)), 
+    target  = as.vector(dist(t(apply(counts, 1L, clr)), 'maximum')) )
+  
+  
+  
+  # Query samples against a reference panel ====
+  
+  qry  <- big_mtx[1:3,]
+  ref  <- big_mtx[4:104, 5:1] # features matched by name
+  rect <- function (d) as.matrix(d)[1:3, 4:104]
+  
+  expect_equal(bray(qry, reference = ref),            rect(bray(big_mtx)))
+  expect_equal(bray(qry, reference = ref, cpus = 2),  rect(bray(big_mtx)))
+  expect_equal(jaccard(qry, reference = ref),         rect(jaccard(big_mtx)))
+  expect_equal(hellinger(qry, reference = ref),       rect(hellinger(big_mtx)))
+  expect_equal(
+    current = aitchison(qry, reference = ref, pseudocount = 1), 
+    target  = rect(aitchison(big_mtx, pseudocount = 1)) )
+  expect_equal(
+    current = bray(t(qry), margin = 2, reference = t(ref)), 
+    target  = rect(bray(big_mtx)) )
+  expect_equal(
+    current = beta_div(counts[1:2,], 'u_unifrac', tree = tree, reference = counts[3:4,]), 
+    target  = as.matrix(unweighted_unifrac(counts, tree))[1:2, 3:4] )
+  
+  expect_identical(dim(bray(qry, reference = cbind(ref, OTU9 = 1))), c(3L, 101L))
+  expect_error(bray(qry, reference = ref, pairs = 1))
+  expect_error(unweighted_unifrac(counts[1:2,], tree, reference = cbind(counts[3:4,], OTU9 = 1)))
+  
+  
+  
+  # Nearest neighbors without the full matrix ====
+  
+  knn <- function (d, k) {
+    m <- as.matrix(d)
+    diag(m) <- NA
+    list(
+      index    = unname(apply(m, 2L, function (x) order(x)[seq_len(k)])), 
+      distance = unname(apply(m, 2L, function (x) sort(x)[seq_len(k)])) )
+  }
+  unnamed <- function (x) lapply(x, unname)
+  
+  expect_equal(unnamed(bray(big_mtx, k = 3)),           knn(bray(big_mtx), 3))
+  expect_equal(unnamed(bray(big_mtx, k = 3, cpus = 2)), knn(bray(big_mtx), 3))
+  expect_equal(unnamed(hellinger(big_mtx, k = 1)),      knn(hellinger(big_mtx), 1))
+  expect_equal(
+    current = unnamed(weighted_unifrac(counts, tree, k = 2)), 
+    target  = knn(weighted_unifrac(counts, tree), 2) )
+  expect_identical(colnames(bray(big_mtx, k = 1)$index), rownames(big_mtx))
+  expect_identical(dim(bray(counts, k = 100)$distance), c(3L, 4L))
+  expect_equal(
+    current = unname(bray(qry, reference = ref, k = 2)$distance), 
+    target  = unname(apply(rect(bray(big_mtx)), 1L, function (x) sort(x)[1:2])) )
+  expect_error(bray(big_mtx, k = 0))
+  expect_error(bray(big_mtx, k = 1.5))
+  expect_error(bray(big_mtx, k = 2, pairs = 1))
+  
+  
+  
+  # Single precision agrees to float accuracy ====
+  
+  for (metric in c('bray', 'euclidean', 'hellinger', 'jsd', 'canberra', 'aitchison', 'gower')) {
+    expect_equal(
+      current = beta_div(big_mtx, metric, norm = 'percent', precision = 'single', cpus = 2), 
+      target  = beta_div(big_mtx, metric, norm = 'percent'), 
+      tolerance = 1e-6 )
+  }
+  expect_identical(bray(counts, precision = 'single'), bray(counts))
+  expect_equal(
+    current = weighted_unifrac(counts, tree, precision = 'single'), 
+    target  = weighted_unifrac(counts, tree) )
+  
+  path <- tempfile(fileext = '.ecd')
+  x    <- manhattan(big_mtx, norm = 'percent', file = path, precision = 'single')
+  expect_identical(x$type, 'float32')
+  expect_equal(as.matrix(x), as.matrix(manhattan(big_mtx, norm = 'percent')), tolerance = 1e-6)
+  unlink(path)
+  
+  expect_error(bray(counts, precision = 'half'))
+  
 #})
@@ -0,0 +1,66 @@
+#test_that("distance files", {
+  
+  path <- tempfile(fileext = '.ecd')
+  on.exit(unlink(path), add = TRUE)
+  
+  
+  
+  # Same distances as a dist object ====
+  
+  x <- bray(counts, file = path)
+  expect_inherits(x, 'ecodive_dist_file')
+  expect_identical(x$path, normalizePath(path))
+  expect_identical(dim(x), c(4L, 4L))
+  expect_identical(rownames(x), rownames(counts))
+  expect_equal(as.matrix(x), as.matrix(bray(counts)))
+  expect_stdout(print(x))
+  
+  expect_equal(as.matrix(hellinger(counts, file = path)),   as.matrix(hellinger(counts)))
+  expect_equal(as.matrix(jaccard(big_mtx, file = path)),    as.matrix(jaccard(big_mtx)))
+  expect_equal(as.matrix(bray(counts, pairs = 1:3, file = path)), as.matrix(bray(counts, pairs = 1:3)))
+  expect_equal(
+    current = as.matrix(weighted_unifrac(counts, tree = tree, file = path, cpus = 2)), 
+    target  = as.matrix(weighted_unifrac(counts, tree = tree)) )
+  
+  
+  
+  # Rows and columns are read on demand ====
+  
+  x    <- euclidean(big_mtx, file = path, cpus = 2)
+  full <- as.matrix(euclidean(big_mtx))
+  
+  expect_equal(x[3, ],              full[3, ])
+  expect_equal(x[c(9, 2), 5:7],     full[c(9, 2), 5:7])
+  expect_equal(x['S10', c('S1', 'S104')], full['S10', c('S1', 'S104')])
+  expect_equal(x[-1, 1, drop = FALSE],    full[-1, 1, drop = FALSE])
+  expect_equal(dist_file(path)[2:4, ],    full[2:4, ])
+  
+  expect_error(x[1])
+  expect_error(x[105, ])
+  expect_error(x['nope', ])
+  
+  
+  
+  # Single-precision files ====
+  
+  op <- options(ecodive.dist_file_type = 'float32')
+  x  <- bray(big_mtx, file = path)
+  options(op)
+  
+  expect_identical(x$type, 'float32')
+  expect_equal(as.matrix(x), as.matrix(bray(big_mtx)), tolerance = 1e-6)
+  
+  
+  
+  # Invalid arguments ====
+  
+  expect_error(bray(counts, file = NA_character_))
+  expect_error(bray(counts, file = file.path(tempfile(), 'x.ecd')))
+  expect_error(bray(counts, file = path, k = 1))
+  expect_error(bray(counts[1:2,], reference = counts[3:4,], file = path))
+  
+  writeLines('not a distance file', path)
+  expect_error(dist_file(path))
+  expect_error(dist_file(tempfile()))
+  
+#})
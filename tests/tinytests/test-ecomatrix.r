@@ -118,12 +118,41 @@
   unsorted_m_slam$v <- unsorted_m_slam$v[idx]
   expect_equal(test_parsing(unsorted_m_slam, margin = 1L), expected_margin1, info = "unsorted slam")
 
+  # Reverse-sorted triplets, samples in rows and columns
+  rev_idx       <- rev(seq_along(m_dgT@i))
+  reversed_dgT  <- m_dgT
+  reversed_dgT@i <- reversed_dgT@i[rev_idx]
+  reversed_dgT@j <- reversed_dgT@j[rev_idx]
+  reversed_dgT@x <- reversed_dgT@x[rev_idx]
+  expect_equal(test_parsing(reversed_dgT, margin = 1L), expected_margin1, info = "reversed dgTMatrix")
+  expect_equal(test_parsing(Matrix::t(reversed_dgT), margin = 2L), expected_margin1, info = "reversed dgTMatrix margin 2")
+  expect_equal(
+    current = bray(reversed_dgT), 
+    target  = bray(m_base), 
+    info    = "reversed dgTMatrix values" )
+
   # Test already sorted triplet
   sorted_m_dgT   <- as(m_dgC, TRIPLET) # dgC is sorted by column, then row
   sorted_m_dgT_t <- as(m_dgC_t, TRIPLET)
   expect_equal(test_parsing(sorted_m_dgT_t, margin = 2L), expected_margin1, info = "sorted dgTMatrix")
 
 
+  # === Integer storage matches double storage ===
+  for (m in list(counts_int, m_slam_int, m_base, m_dgC)) {
+    expect_equal(chao1(m), chao1(m_slam_double))
+    expect_equal(brillouin(m), brillouin(m_dgC))
+    expect_equal(squares(m), squares(m_slam_double))
+    expect_equal(shannon(m), shannon(m_slam_double))
+    expect_equal(bray(m), bray(m_slam_double))
+    expect_equal(gower(m), gower(m_slam_double))
+    expect_equal(aitchison(m, pseudocount = 1), aitchison(m_slam_double, pseudocount = 1))
+    expect_equal(weighted_unifrac(m, tree = tree), weighted_unifrac(m_slam_double, tree = tree))
+  }
+
+  # Fractional values in a dense matrix are kept as doubles.
+  expect_equal(bray(m_double), bray(m_dgC * 1.1))
+
+
   # === Test error handling ===
   expect_error(test_parsing("not a matrix"))
   expect_error(test_parsing(m_base, margin = 3L))
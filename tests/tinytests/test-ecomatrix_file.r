@@ -0,0 +1,87 @@
+#test_that("ecomatrix files", {
+
+  path <- tempfile(fileext = '.ecm')
+  on.exit(unlink(path), add = TRUE)
+
+
+  # Round trip, samples in rows and columns ====
+
+  expect_identical(write_ecomatrix(counts, path), path)
+
+  expect_equal(shannon(path),  shannon(counts))
+  expect_equal(chao1(path),    chao1(counts))
+  expect_equal(bray(path),     bray(counts))
+  expect_equal(jaccard(path),  jaccard(counts))
+  expect_equal(bray(path, norm = 'percent'), bray(counts, norm = 'percent'))
+  expect_equal(bray(path, pairs = 1:2),      bray(counts, pairs = 1:2))
+
+  write_ecomatrix(t(counts), path, margin = 2L)
+  expect_equal(shannon(path), shannon(counts))
+
+  write_ecomatrix(big_mtx, path, cpus = 2)
+  expect_equal(bray(path, cpus = 2), bray(big_mtx))
+
+
+  # Header statistics stand in for scanning values ====
+
+  write_ecomatrix(counts, path)
+  expect_warning(aitchison(path))
+  expect_equal(
+    current = suppressWarnings(aitchison(path)),
+    target  = suppressWarnings(aitchison(counts)) )
+  expect_equal(robust_aitchison(path), robust_aitchison(counts))
+
+  write_ecomatrix(counts_p, path)
+  expect_error(chao1(path))
+  expect_equal(simpson(path), simpson(counts_p))
+
+
+  # Rarefaction writes a new file ====
+
+  out <- tempfile(fileext = c('.1.ecm', '.2.ecm'))
+  on.exit(unlink(out), add = TRUE)
+
+  write_ecomatrix(counts, path)
+  expect_identical(rarefy(path, depth = 15, seed = 1, file = out[1]), out[1])
+  expected <- rarefy(counts, depth = 15, seed = 1)
+  expect_equal(observed(out[1]), observed(expected))
+  expect_equal(bray(out[1]),     bray(expected))
+
+  rarefy(path, depth = 15, seed = 1, drop = FALSE, file = out[1])
+  expected <- rarefy(counts, depth = 15, seed = 1, drop = FALSE)
+  expect_equal(shannon(out[1]), shannon(expected))
+
+  rarefy(big_mtx, depth = 12, times = 2, cpus = 2, file = out)
+  expected <- rarefy(big_mtx, depth = 12, times = 2)
+  expect_equal(bray(out[1]), bray(expected[[1]]))
+  expect_equal(bray(out[2]), bray(expected[[2]]))
+
+  expect_error(rarefy(path, depth = 15, file = out))
+  expect_error(rarefy(path, depth = 100, file = out[1]))
+
+
+  # Unsupported uses ====
+
+  write_ecomatrix(counts, path)
+  expect_error(faith(path, tree = tree))
+  expect_error(weighted_unifrac(path, tree = tree))
+  expect_error(rarefy(path))
+
+  # Corrupt indices: 64-byte header, then pos_vec, then otu_vec.
+  write_ecomatrix(counts, path)
+  bytes <- readBin(path, 'raw', file.size(path))
+  otus  <- bytes
+  otus[105:108] <- writeBin(99L, raw())
+  writeBin(otus, path)
+  expect_error(shannon(path), 'otu_vec')
+  rows  <- bytes
+  rows[73:80] <- as.raw(255) # pos_vec[1] = -1
+  writeBin(rows, path)
+  expect_error(bray(path), 'pos_vec')
+
+  writeLines('not an ecomatrix', path)
+  expect_error(shannon(path))
+  expect_error(shannon(tempfile()))
+  expect_error(write_ecomatrix(counts, NA_character_))
+
+#})
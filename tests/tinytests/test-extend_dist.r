@@ -0,0 +1,76 @@
+#test_that("extending distance matrices", {
+  
+  set.seed(1)
+  mtx <- matrix(
+    data     = rpois(150 * 12, 2), nrow = 150, 
+    dimnames = list(paste0('S', 1:150), paste0('OTU', 1:12)) )
+  old <- mtx[1:120,]
+  new <- mtx[121:150,]
+  
+  path  <- tempfile(fileext = '.ecd')
+  path2 <- tempfile(fileext = '.ecd')
+  on.exit(unlink(c(path, path2)), add = TRUE)
+  
+  
+  
+  # Same distances as computing them all ====
+  
+  for (metric in c('bray', 'hellinger', 'jaccard', 'minkowski', 'canberra'))
+    expect_equal(
+      current = extend_dist(beta_div(old, metric), old, new, metric, cpus = 2), 
+      target  = beta_div(mtx, metric), 
+      info    = metric )
+  
+  expect_equal(
+    current = extend_dist(bray(old[1:2,]), old[1:2,], old[3:4,], 'bray'), 
+    target  = bray(old[1:4,]) )
+  expect_equal(
+    current = extend_dist(manhattan(old, norm = 'percent'), old, new, 'manhattan', norm = 'percent'), 
+    target  = manhattan(mtx, norm = 'percent') )
+  expect_equal(
+    current = extend_dist(aitchison(old, pseudocount = 1), old, new, 'aitchison', pseudocount = 1), 
+    target  = aitchison(mtx, pseudocount = 1) )
+  expect_equal(
+    current = extend_dist(weighted_unifrac(big_mtx[1:90,], tree), big_mtx[1:90,], big_mtx[91:104,], 'w_unifrac', tree = tree), 
+    target  = weighted_unifrac(big_mtx, tree) )
+  expect_equal(
+    current = extend_dist(bray(t(old), margin = 2), t(old), t(new), 'bray', margin = 2), 
+    target  = bray(mtx) )
+  
+  
+  
+  # File-backed distances ====
+  
+  x <- extend_dist(bray(old, file = path), old, new, 'bray', file = path2)
+  expect_inherits(x, 'ecodive_dist_file')
+  expect_equal(as.matrix(x), as.matrix(bray(mtx)))
+  expect_equal(as.matrix(extend_dist(bray(old), old, new, 'bray', file = path2)), as.matrix(bray(mtx)))
+  expect_equal(extend_dist(dist_file(path), old, new, 'bray'), bray(mtx))
+  expect_error(extend_dist(dist_file(path), old, new, 'bray', file = path))
+  
+  
+  
+  # Table-dependent distances must be recomputed ====
+  
+  expect_error(extend_dist(gower(old), old, new, 'gower'))
+  expect_error(extend_dist(aitchison(old), old, new, 'aitchison'))
+  
+  more <- new
+  colnames(more)[12] <- 'OTU13'
+  wide <- cbind(mtx, OTU13 = 0)
+  wide[121:150, 'OTU13'] <- wide[121:150, 'OTU12']
+  wide[121:150, 'OTU12'] <- 0
+  
+  expect_error(extend_dist(euclidean(old, norm = 'clr', pseudocount = 1), old, more, 'euclidean', norm = 'clr', pseudocount = 1))
+  expect_equal(extend_dist(euclidean(old), old, more, 'euclidean'), euclidean(wide))
+  
+  expect_equal(
+    current = extend_dist(gower(old), old, new, 'gower', recompute = TRUE), 
+    target  = gower(mtx) )
+  
+  expect_error(extend_dist(bray(old), old[-1,], new, 'bray'))
+  expect_error(extend_dist(bray(old), old[120:1,], new, 'bray'))
+  expect_error(extend_dist(as.matrix(bray(old)), old, new, 'bray'))
+  expect_error(extend_dist(bray(old), old, new, 'bray', recompute = NA))
+  
+#})
@@ -0,0 +1,26 @@
+#test_that("64-bit indexing", {
+
+  # Needs about 9 GB of memory; opt in with ECODIVE_LARGE_TESTS=true.
+  exit_if_not(isTRUE(as.logical(Sys.getenv('ECODIVE_LARGE_TESTS'))))
+  exit_if_not(requireNamespace("slam", quietly=TRUE))
+  
+  
+  # 46,342 samples: n * (n - 1) overflows a 32-bit int ====
+  
+  n      <- 46342L
+  n_dist <- as.double(n) * (n - 1) / 2
+  m      <- slam::simple_triplet_matrix(
+    i = seq_len(n), j = rep(1:2, length.out = n), v = rep(1, n), 
+    nrow = n, ncol = 2 )
+  
+  d <- bray(m, pairs = c(1, n_dist - 1, n_dist))
+  expect_equal(length(d), n_dist)
+  expect_equal(attr(d, 'Size'), n)
+  expect_equal(d[c(1, n_dist - 1, n_dist)], c(1, 0, 1))
+  expect_true(is.na(d[2]))
+  
+  rm(d)
+  d <- jaccard(m, cpus = 2)
+  expect_equal(d[c(1, 2, n_dist)], c(1, 0, 1))
+
+#})
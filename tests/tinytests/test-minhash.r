@@ -0,0 +1,87 @@
+#test_that("minhash sketches", {
+  
+  set.seed(1)
+  mtx <- matrix(
+    data     = rpois(30 * 20, 2), nrow = 30, 
+    dimnames = list(paste0('S', 1:30), paste0('OTU', 1:20)) )
+  mtx[2,] <- mtx[1,]
+  
+  
+  
+  # Estimates are close to exact distances ====
+  
+  exact <- list(
+    jaccard = jaccard(mtx), 
+    soergel = soergel(mtx), 
+    bray    = bray(mtx, norm = 'percent') )
+  
+  for (metric in names(exact)) {
+    est <- minhash_dist(minhash(mtx, metric, size = 4096))
+    expect_identical(attr(est, 'Labels'), rownames(mtx), info = metric)
+    expect_true(max(abs(est - exact[[metric]])) < 0.06, info = metric)
+    expect_equal(as.matrix(est)['S1', 'S2'], 0, info = metric)
+  }
+  
+  
+  
+  # Signatures depend on seed, not feature order ====
+  
+  sketch <- minhash(mtx, 'soergel', size = 64)
+  
+  expect_identical(dim(sketch$signatures), c(64L, 30L))
+  expect_identical(minhash(mtx[,20:1], 'soergel', size = 64), sketch)
+  expect_identical(minhash(t(mtx), 'soergel', size = 64, margin = 2, cpus = 2), sketch)
+  expect_false(identical(minhash(mtx, 'soergel', size = 64, seed = 1)$signatures, sketch$signatures))
+  expect_stdout(print(sketch))
+  
+  sketch <- minhash(rbind(mtx[1:2,], S0 = 0))
+  expect_true(all(is.na(sketch$signatures[,'S0'])))
+  expect_equal(unname(as.matrix(minhash_dist(sketch))[3, 1:2]), c(1, 1))
+  
+  # Stored zeros carry no weight, even in an otherwise empty sample.
+  if (requireNamespace('slam', quietly = TRUE)) {
+    dense      <- rbind(mtx[1:2,], S0 = 0)
+    dense[1,1] <- 0
+    stm        <- slam::as.simple_triplet_matrix(dense)
+    stm$i      <- c(stm$i, 1L, 3L, 3L)
+    stm$j      <- c(stm$j, 1L, 1L, 2L)
+    stm$v      <- c(stm$v, 0,  0,  0)
+    for (metric in c('soergel', 'bray'))
+      expect_identical(
+        current = minhash(stm,   metric, size = 64),
+        target  = minhash(dense, metric, size = 64),
+        info    = metric )
+  }
+  
+  
+  
+  # Banded search finds the close pairs ====
+  
+  for (metric in c('jaccard', 'bray')) {
+    
+    sketch <- minhash(mtx, metric, size = 256)
+    full   <- as.matrix(minhash_dist(sketch))
+    pairs  <- minhash_dist(sketch, max_dist = 0.3)
+    
+    expect_true(all(pairs$distance <= 0.3), info = metric)
+    expect_equal(pairs$distance, full[cbind(pairs$sample1, pairs$sample2)], info = metric)
+    expect_true(any(pairs$sample1 == 'S1' & pairs$sample2 == 'S2'), info = metric)
+    
+    # One hash per band compares every pair with any hash in common.
+    expect_identical(
+      current = nrow(minhash_dist(sketch, max_dist = 0.3, bands = 256)), 
+      target  = sum(full[lower.tri(full)] <= 0.3) )
+  }
+  
+  
+  
+  # Invalid arguments ====
+  
+  expect_error(minhash(mtx, 'euclidean'))
+  expect_error(minhash(mtx, size = 0))
+  expect_error(minhash_dist(mtx))
+  expect_error(minhash_dist(sketch, max_dist = 1))
+  expect_error(minhash_dist(sketch, max_dist = 0.5, bands = 0))
+  expect_error(minhash_dist(sketch, max_dist = 0.5, bands = 1000))
+  
+#})
@@ -0,0 +1,72 @@
+#test_that("features are pruned at ingest", {
+
+  # OTU1 is all zeros; OTU4 is seen in one sample.
+  pruned <- counts[,c('OTU2', 'OTU3', 'OTU5')]
+  
+  path <- tempfile(fileext = '.ecm')
+  on.exit(unlink(path), add = TRUE)
+  
+  
+  # Prevalence threshold ====
+  
+  expect_equal(shannon(counts, min_prevalence = 2),  shannon(pruned))
+  expect_equal(observed(counts, min_prevalence = 2), observed(pruned))
+  expect_equal(bray(counts, min_prevalence = 2),     bray(pruned))
+  expect_equal(jaccard(counts, min_prevalence = 2),  jaccard(pruned))
+  expect_equal(bray(counts_int, min_prevalence = 2), bray(pruned))
+  
+  expect_equal(
+    current = shannon(t(counts), margin = 2L, min_prevalence = 2),
+    target  = shannon(pruned) )
+  expect_equal(
+    current = aitchison(counts, pseudocount = 1, min_prevalence = 2),
+    target  = aitchison(pruned, pseudocount = 1) )
+  expect_equal(
+    current = alpha_div(counts, 'shannon', min_prevalence = 2),
+    target  = shannon(pruned) )
+  expect_equal(
+    current = beta_div(counts, 'bray', min_prevalence = 2),
+    target  = bray(pruned) )
+  
+  write_ecomatrix(counts, path)
+  expect_equal(observed(path, min_prevalence = 2), observed(pruned))
+  
+  
+  # Tree tips are looked up by original index ====
+  
+  expect_equal(
+    current = faith(counts, tree = tree, min_prevalence = 2),
+    target  = faith(pruned, tree = tree) )
+  expect_equal(
+    current = weighted_unifrac(counts, tree = tree, min_prevalence = 2),
+    target  = weighted_unifrac(pruned, tree = tree) )
+  expect_equal(
+    current = unweighted_unifrac(counts, tree = tree, min_prevalence = 2),
+    target  = unweighted_unifrac(pruned, tree = tree) )
+  
+  
+  # Abundance threshold ====
+  
+  expect_equal(
+    current = bray(counts, min_abundance = 20),
+    target  = bray(counts[,c('OTU2', 'OTU3')]) )
+  
+  expect_error(shannon(counts, min_abundance = 1e6), 'min_abundance')
+  
+  
+  # Defaults leave counts untouched ====
+  
+  expect_equal(observed(counts), c(A = 3, B = 3, C = 3, D = 2))
+  expect_equal(observed(path),   c(A = 3, B = 3, C = 3, D = 2))
+  
+  
+  # Invalid thresholds ====
+  
+  expect_error(bray(counts, min_prevalence = 0))
+  expect_error(bray(counts, min_prevalence = 1.5))
+  expect_error(bray(counts, min_prevalence = NA))
+  expect_error(bray(counts, min_abundance = -1))
+  expect_error(bray(counts, min_abundance = c(1, 2)))
+  expect_error(shannon(counts, min_abundance = 'a'))
+
+#})
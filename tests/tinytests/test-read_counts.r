@@ -0,0 +1,109 @@
+#test_that("read_counts", {
+
+  exit_if_not(requireNamespace("Matrix", quietly=TRUE))
+  
+  path <- tempfile(fileext = '.tsv')
+  on.exit(unlink(path), add = TRUE)
+  
+  as_dense <- function (m) as.matrix(Matrix::t(m))
+  
+  
+  # Delimited text, samples in columns and rows ====
+  
+  write.table(t(counts), path, sep = '\t', quote = FALSE, col.names = NA)
+  m <- read_counts(path)
+  expect_inherits(m, 'dgCMatrix')
+  expect_equal(as_dense(m), counts)
+  expect_equal(bray(m, margin = 2), bray(counts))
+  
+  write.table(counts, path, sep = '\t', quote = FALSE, col.names = NA)
+  expect_equal(as_dense(read_counts(path, margin = 1)), counts)
+  
+  csv <- tempfile(fileext = '.csv')
+  on.exit(unlink(csv), add = TRUE)
+  write.csv(t(counts), csv)
+  expect_equal(as_dense(read_counts(csv)), counts)
+  
+  
+  # QIIME classic layout ====
+  
+  writeLines(con = path, c(
+    '# Constructed from biom file',
+    '#OTU ID\tS1\tS2\ttaxonomy',
+    'O1\t1\t0\tk__A',
+    'O2\t\t2.5\tk__B\r',
+    '"O3"\t0\t4\tk__C' ))
+  m <- read_counts(path)
+  expect_equal(dimnames(m), list(c('O1', 'O2', 'O3'), c('S1', 'S2')))
+  expect_equal(as.vector(as.matrix(m)), c(1, 0, 0, 0, 2.5, 4))
+  
+  
+  # Large enough to split across threads ====
+  
+  big <- big_mtx[rep(1:104, 60),]
+  write.table(big, path, sep = '\t', quote = FALSE, col.names = NA)
+  expect_error(read_counts(path, margin = 1, cpus = 2), 'duplicate')
+  
+  rownames(big) <- paste0('S', seq_len(nrow(big)))
+  write.table(big, path, sep = '\t', quote = FALSE, col.names = NA)
+  expect_equal(as_dense(read_counts(path, margin = 1, cpus = 2)), big)
+  expect_equal(
+    current = read_counts(path, margin = 1, cpus = 2), 
+    target  = read_counts(path, margin = 1, cpus = 1) )
+  
+  
+  # BIOM-JSON ====
+  
+  writeLines(con = path, c(
+    '{"id": null, "format": "Biological Observation Matrix 1.0.0",',
+    ' "rows": [{"id": "OTU_1", "metadata": {"taxonomy": ["k__A", "p__]B"]}},',
+    '          {"id": "OTU\\u00e9_2", "metadata": null}],',
+    ' "columns": [{"id": "Sa\\"mp1"}, {"id": "Samp2"}, {"id": "Samp3"}],',
+    ' "matrix_type": "sparse", "shape": [2, 3],',
+    ' "data": [[0, 2, 1], [1, 0, 5], [1, 1, 1e1]]}' ))
+  m <- read_counts(path)
+  expect_equal(rownames(m), c('OTU_1', 'OTUé_2'))
+  expect_equal(colnames(m), c('Sa"mp1', 'Samp2', 'Samp3'))
+  expect_equal(as.vector(as.matrix(m)), c(0, 5, 0, 10, 1, 0))
+  
+  writeLines(con = path, paste0(
+    '{"rows": [{"id": "A"}, {"id": "B"}], "columns": [{"id": "x"}, {"id": "y"}],',
+    ' "matrix_type": "dense", "data": [[0, 1], [2, 0]]}' ))
+  expect_equal(as.vector(as.matrix(read_counts(path))), c(0, 2, 1, 0))
+  
+  
+  # Malformed input ====
+  
+  writeLines(c(',O1,O2', 'S1,1,x'), csv)
+  expect_error(read_counts(csv), 'line 2')
+  
+  writeLines(c(',O1,O2', 'S1,1'), csv)
+  expect_error(read_counts(csv), 'too few')
+  
+  # write.table() leaves out the corner cell by default.
+  utils::write.table(counts, csv, sep = ',', quote = FALSE)
+  expect_error(read_counts(csv), 'too many')
+  
+  writeLines('no delimiters', csv)
+  expect_error(read_counts(csv))
+  
+  writeLines(paste0(
+    '{"rows": [{"id": "A"}], "columns": [{"id": "x"}],',
+    ' "matrix_type": "sparse", "data": [[0, 3, 1]]}' ), path)
+  expect_error(read_counts(path), 'out of range')
+  
+  writeLines(paste0(
+    '{"rows": [{"id": "A"}, {"id": "B"}], "columns": [{"id": "x"}],',
+    ' "matrix_type": "sparse", "data": [[0, 0, 1 [1, 0, 5]]}' ), path)
+  expect_error(read_counts(path), 'malformed')
+  
+  writeLines(paste0(
+    '{"rows": [{"id": "A"}, {"id": "B"}], "columns": [{"id": "x"}],',
+    ' "matrix_type": "dense", "data": [[1 [5]]}' ), path)
+  expect_error(read_counts(path), 'malformed')
+  
+  expect_error(read_counts(tempfile()))
+  expect_error(read_counts(path, sep = 'ab'))
+  expect_error(read_counts(path, margin = 3))
+
+#})
@@ -33,6 +33,15 @@
   env$pairs <- c(F,F,T,T,T,F,F,F,F,F)
   expect_silent(validate_pairs(env))
 
+  # More than 2^31 - 1 distances keeps pairs as doubles.
+  env$counts <- matrix(0, nrow = 1, ncol = 70000)
+  env$pairs  <- c(1, 2449965000)
+  expect_silent(validate_pairs(env))
+  expect_identical(env$pairs, c(1, 2449965000))
+  env$pairs  <- 2449965001
+  expect_error(validate_pairs(env))
+  env$counts <- counts
+
 
 
 
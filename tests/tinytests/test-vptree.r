@@ -0,0 +1,76 @@
+#test_that("vantage-point trees", {
+  
+  set.seed(1)
+  mtx <- matrix(
+    data     = rpois(300 * 20, 2), nrow = 300, 
+    dimnames = list(paste0('S', 1:300), paste0('OTU', 1:20)) )
+  qry <- mtx[1:20,]
+  ref <- mtx[21:300,]
+  
+  nearest <- function (d, k) list(
+    index    = unname(apply(d, 1L, function (x) order(x)[seq_len(k)])), 
+    distance = unname(apply(d, 1L, function (x) sort(x)[seq_len(k)])) )
+  
+  
+  
+  # Nearest neighbors match a full search ====
+  
+  for (metric in c('euclidean', 'manhattan', 'hellinger', 'jaccard', 'aitchison')) {
+    index <- vptree(ref, metric, pseudocount = 1)
+    full  <- beta_div(qry, metric, reference = ref, pseudocount = 1)
+    expect_equal(lapply(vptree_query(index, qry, k = 3), unname), nearest(full, 3), info = metric)
+  }
+  
+  expect_equal(
+    current = lapply(vptree_query(vptree(big_mtx[5:104,]), big_mtx[1:4,], k = 3), unname), 
+    target  = nearest(beta_div(big_mtx[1:4,], 'euclidean', reference = big_mtx[5:104,]), 3) )
+  expect_equal(
+    current = lapply(vptree_query(vptree(t(ref), margin = 2, cpus = 2), t(qry), margin = 2, k = 2, cpus = 2), unname), 
+    target  = nearest(euclidean(qry, reference = ref), 2) )
+  
+  
+  
+  # Searches by radius ====
+  
+  index <- vptree(ref)
+  full  <- euclidean(qry, reference = ref)
+  r     <- median(full)
+  res   <- vptree_query(index, qry, radius = r)
+  
+  expect_identical(names(res$index), rownames(qry))
+  expect_equal(unname(lengths(res$index)), unname(rowSums(full <= r)))
+  expect_equal(unname(res$distance[[1]]), unname(sort(full[1, full[1,] <= r])))
+  expect_true(all(is.na(vptree_query(index, qry, k = 2, radius = 0)$index)))
+  
+  
+  
+  # Indexes survive a round trip to disk ====
+  
+  path <- tempfile(fileext = '.rds')
+  saveRDS(index, path)
+  expect_identical(vptree_query(readRDS(path), qry, k = 2), vptree_query(index, qry, k = 2))
+  unlink(path)
+  
+  expect_stdout(print(index))
+  
+  
+  
+  # CLR keeps the reference's features ====
+  
+  index <- vptree(ref, 'aitchison', pseudocount = 1)
+  expect_identical(
+    current = vptree_query(index, cbind(qry, OTU99 = 5), k = 2), 
+    target  = vptree_query(index, qry, k = 2) )
+  
+  
+  
+  # Invalid arguments ====
+  
+  expect_error(vptree(ref, 'bray'))
+  expect_error(vptree(ref, 'minkowski', power = 0.5))
+  expect_error(vptree_query(index, qry))
+  expect_error(vptree_query(ref, qry, k = 1))
+  expect_error(vptree_query(index, qry, radius = -1))
+  expect_error(vptree_query(index, qry, k = 0))
+  
+#})